@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "hist.h"
+#include "aconc.h"
+
+int
+aconc_init(struct aconc *a, int limit_max, uint64_t now_usec)
+{
+
+	bzero(a, sizeof(*a));
+	if (limit_max < 1)
+		limit_max = 1;
+	a->limit_max = limit_max;
+	a->limit = ACONC_LIMIT_INIT < limit_max ? ACONC_LIMIT_INIT : limit_max;
+	a->slow_start = 1;
+	a->window_start_usec = now_usec;
+
+	a->base = calloc(1, sizeof(*a->base));
+	a->diff = calloc(1, sizeof(*a->diff));
+	a->buckets = calloc(limit_max + 1, sizeof(*a->buckets));
+	if (a->base == NULL || a->diff == NULL || a->buckets == NULL) {
+		warn("%s: calloc", __func__);
+		aconc_free(a);
+		return (-1);
+	}
+	return (0);
+}
+
+void
+aconc_free(struct aconc *a)
+{
+
+	free(a->base);
+	free(a->diff);
+	free(a->buckets);
+	a->base = NULL;
+	a->diff = NULL;
+	a->buckets = NULL;
+}
+
+/*
+ * Called each tick with the worker's cumulative latency histogram and
+ * completed request count; returns the (possibly new) limit.
+ */
+int
+aconc_update(struct aconc *a, uint64_t now_usec, const struct hist *lat,
+    uint64_t done)
+{
+	struct aconc_bucket *b;
+	uint64_t p50;
+	double secs;
+	int limit;
+
+	if (now_usec - a->window_start_usec < ACONC_WINDOW_USEC)
+		return (a->limit);
+
+	hist_diff(a->base, lat, a->diff);
+	if (a->diff->count < ACONC_MIN_SAMPLES)
+		return (a->limit);
+
+	/* Record this window's throughput at this limit */
+	secs = (double) (now_usec - a->window_start_usec) / 1000000.0;
+	b = &a->buckets[a->limit];
+	b->windows++;
+	b->rate_sum += (double) (done - a->base_done) / secs;
+
+	p50 = hist_percentile(a->diff, 50.0);
+	if (a->lat_min == 0 || p50 < a->lat_min) {
+		a->lat_min = p50;
+		a->baseline_windows = 0;
+	}
+
+	limit = a->limit;
+	if (++a->baseline_windows >= ACONC_BASELINE_WINDOWS) {
+		/*
+		 * Re-measure the baseline: halve the limit to drain any
+		 * standing queue and take the next window's latency as
+		 * the new minimum.
+		 */
+		limit /= 2;
+		a->lat_min = 0;
+		a->baseline_windows = 0;
+	} else if ((double) p50 <= (double) a->lat_min * ACONC_TOLERANCE) {
+		/* No queueing to speak of: additive increase */
+		limit = a->slow_start ? limit * 2 : limit + 1;
+	} else {
+		/* Queueing: multiplicative decrease */
+		limit = (int) ((double) limit * ACONC_DECREASE);
+		a->slow_start = 0;
+	}
+	if (limit < 1)
+		limit = 1;
+	if (limit > a->limit_max)
+		limit = a->limit_max;
+	a->limit = limit;
+
+	memcpy(a->base, lat, sizeof(*a->base));
+	a->base_done = done;
+	a->window_start_usec = now_usec;
+	return (a->limit);
+}
+
+/*
+ * The worker's stats were reset; start a new window from zero.  The
+ * limit, baseline and throughput seen so far are kept.
+ */
+void
+aconc_reset(struct aconc *a, uint64_t now_usec)
+{
+
+	bzero(a->base, sizeof(*a->base));
+	a->base_done = 0;
+	a->window_start_usec = now_usec;
+}
+
+/*
+ * Where does throughput plateau?  Returns the knee limit (0 if there
+ * isn't enough data yet) and the throughput there.
+ */
+int
+aconc_knee(const struct aconc *a, double *rate)
+{
+	double r, best = 0.0;
+	int i;
+
+	*rate = 0.0;
+	for (i = 1; i <= a->limit_max; i++) {
+		if (a->buckets[i].windows == 0)
+			continue;
+		r = a->buckets[i].rate_sum / (double) a->buckets[i].windows;
+		if (r > best)
+			best = r;
+	}
+	if (best == 0.0)
+		return (0);
+
+	for (i = 1; i <= a->limit_max; i++) {
+		if (a->buckets[i].windows == 0)
+			continue;
+		r = a->buckets[i].rate_sum / (double) a->buckets[i].windows;
+		if (r >= best * ACONC_KNEE_PCT / 100.0) {
+			*rate = r;
+			return (i);
+		}
+	}
+	return (0);
+}
@@ -0,0 +1,61 @@
+#ifndef	__ACONC_H__
+#define	__ACONC_H__
+
+/*
+ * Adaptive concurrency: grow and shrink a worker's connection limit
+ * (and so, with one request per connection, its in-flight requests)
+ * from the latency it sees, like the adaptive concurrency limiters
+ * in service meshes.
+ *
+ * Each window the median latency is compared with the lowest seen
+ * (the no-queueing baseline.)  While latency stays within
+ * ACONC_TOLERANCE of it the limit grows - doubling until the first
+ * backoff, then by one per window - and once queueing pushes it
+ * past that the limit is cut to ACONC_DECREASE of itself.  Every
+ * ACONC_BASELINE_WINDOWS the limit is halved and the baseline
+ * re-measured, in case it has drifted.
+ *
+ * Throughput is recorded against the limit for each window; the knee
+ * is the smallest limit reaching ACONC_KNEE_PCT of the best
+ * throughput seen, ie where adding concurrency stops helping.
+ */
+#define	ACONC_WINDOW_USEC		(500 * 1000)
+#define	ACONC_MIN_SAMPLES		20
+#define	ACONC_TOLERANCE			1.5
+#define	ACONC_DECREASE			0.8
+#define	ACONC_BASELINE_WINDOWS		120
+#define	ACONC_KNEE_PCT			90.0
+#define	ACONC_LIMIT_INIT		4
+
+struct aconc_bucket {
+	uint64_t windows;
+	double rate_sum;
+};
+
+struct aconc {
+	int limit;
+	int limit_max;
+	int slow_start;
+
+	/* Baseline latency, and windows since it was last reset */
+	uint64_t lat_min;
+	int baseline_windows;
+
+	/* The current window */
+	uint64_t window_start_usec;
+	struct hist *base;
+	struct hist *diff;
+	uint64_t base_done;
+
+	/* Throughput by limit, 1..limit_max */
+	struct aconc_bucket *buckets;
+};
+
+extern	int aconc_init(struct aconc *a, int limit_max, uint64_t now_usec);
+extern	int aconc_update(struct aconc *a, uint64_t now_usec,
+	    const struct hist *lat, uint64_t done);
+extern	void aconc_reset(struct aconc *a, uint64_t now_usec);
+extern	int aconc_knee(const struct aconc *a, double *rate);
+extern	void aconc_free(struct aconc *a);
+
+#endif	/* __ACONC_H__ */
@@ -0,0 +1,267 @@
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include <machine/atomic.h>
+
+#include "budget.h"
+
+void
+budget_init(struct budget *b, int nthreads)
+{
+
+	bzero(b, sizeof(*b));
+	b->nthreads = nthreads > 0 ? nthreads : 1;
+}
+
+/*
+ * Tell the workers to finish, eg when a controller is done.
+ */
+void
+budget_close(struct budget *b)
+{
+
+	atomic_store_rel_int(&b->closed, 1);
+}
+
+int
+budget_is_closed(struct budget *b)
+{
+
+	return (atomic_load_acq_int(&b->closed) != 0);
+}
+
+/*
+ * Enable a rate bucket.  It starts with a single token (none if the
+ * rate is 0) and can bank up to one 10ms tick's worth.
+ */
+void
+budget_bucket_init(struct budget_bucket *bk, u_long rate, uint64_t now_usec)
+{
+	u_long burst;
+
+	burst = rate / 100;
+	if (burst < 1)
+		burst = 1;
+	bk->rate = rate;
+	bk->burst = burst * BUDGET_TOKEN_SCALE;
+	bk->tokens = rate > 0 ? BUDGET_TOKEN_SCALE : 0;
+	bk->last_usec = now_usec;
+	bk->enabled = 1;
+}
+
+/*
+ * Credit the tokens for the time since the last refill.
+ *
+ * Only the thread that wins the CAS on last_usec credits that time,
+ * so it's never counted twice.
+ */
+static void
+budget_bucket_refill(struct budget_bucket *bk, uint64_t now_usec)
+{
+	u_long last, add, t, n, burst;
+
+	last = atomic_load_acq_long(&bk->last_usec);
+	if (now_usec < last + BUDGET_REFILL_MIN_USEC)
+		return;
+	if (! atomic_cmpset_long(&bk->last_usec, last, now_usec))
+		return;
+
+	/* usec * tokens/sec == tokens * 1e6, ie scaled tokens */
+	add = (now_usec - last) * atomic_load_acq_long(&bk->rate);
+	burst = atomic_load_acq_long(&bk->burst);
+	do {
+		t = atomic_load_acq_long(&bk->tokens);
+		n = t + add;
+		if (n > burst || n < t)
+			n = burst;
+		if (n <= t)
+			return;
+	} while (! atomic_cmpset_long(&bk->tokens, t, n));
+}
+
+/*
+ * Change the rate, crediting the time so far at the old rate.
+ *
+ * Any thread may call this; if several race with the same rate the
+ * result is the same.
+ */
+void
+budget_bucket_set_rate(struct budget_bucket *bk, u_long rate,
+    uint64_t now_usec)
+{
+	u_long burst, t;
+
+	if (atomic_load_acq_long(&bk->rate) == rate)
+		return;
+	budget_bucket_refill(bk, now_usec);
+
+	burst = rate / 100;
+	if (burst < 1)
+		burst = 1;
+	atomic_store_rel_long(&bk->rate, rate);
+	atomic_store_rel_long(&bk->burst, burst * BUDGET_TOKEN_SCALE);
+	do {
+		t = atomic_load_acq_long(&bk->tokens);
+		if (t <= burst * BUDGET_TOKEN_SCALE)
+			break;
+	} while (! atomic_cmpset_long(&bk->tokens, t,
+	    burst * BUDGET_TOKEN_SCALE));
+}
+
+/*
+ * Take up to 'want' whole tokens; returns how many were taken.
+ */
+u_long
+budget_bucket_take(struct budget_bucket *bk, u_long want, uint64_t now_usec)
+{
+	u_long t, have, n;
+
+	budget_bucket_refill(bk, now_usec);
+	do {
+		t = atomic_load_acq_long(&bk->tokens);
+		have = t / BUDGET_TOKEN_SCALE;
+		if (have == 0)
+			return (0);
+		n = MIN(want, have);
+	} while (! atomic_cmpset_long(&bk->tokens, t,
+	    t - n * BUDGET_TOKEN_SCALE));
+
+	return (n);
+}
+
+/*
+ * How long until the next whole token is due, at the current rate.
+ */
+int64_t
+budget_bucket_wait_usec(struct budget_bucket *bk)
+{
+	u_long t, rate;
+
+	t = atomic_load_acq_long(&bk->tokens);
+	if (t >= BUDGET_TOKEN_SCALE)
+		return (0);
+	rate = atomic_load_acq_long(&bk->rate);
+	if (rate == 0)
+		return (INT64_MAX);
+	return ((int64_t) ((BUDGET_TOKEN_SCALE - t) / rate) + 1);
+}
+
+/*
+ * How many tokens a thread should draw at once: about a
+ * millisecond of its share of the rate.
+ */
+u_long
+budget_bucket_batch(const struct budget *b, const struct budget_bucket *bk)
+{
+	u_long n;
+
+	n = bk->rate / 1000 / b->nthreads;
+	return (n < 1 ? 1 : n);
+}
+
+void
+budget_count_init(struct budget_count *c, u_long n)
+{
+
+	c->left = n;
+	c->enabled = 1;
+}
+
+/*
+ * Draw up to 'want' from a count.  Batches are limited to a share
+ * of what's left so the last few are spread across threads rather
+ * than stranded in one thread's batch.
+ */
+u_long
+budget_count_take(struct budget *b, struct budget_count *c, u_long want)
+{
+	u_long l, n, share;
+
+	do {
+		l = atomic_load_acq_long(&c->left);
+		if (l == 0)
+			return (0);
+		share = l / (2 * b->nthreads);
+		if (share < 1)
+			share = 1;
+		n = MIN(want, share);
+	} while (! atomic_cmpset_long(&c->left, l, l - n));
+
+	return (n);
+}
+
+/*
+ * Give back an unused part of a batch.
+ */
+void
+budget_count_return(struct budget_count *c, u_long n)
+{
+
+	if (n > 0)
+		atomic_add_long(&c->left, n);
+}
+
+int
+budget_count_exhausted(struct budget_count *c)
+{
+
+	return (c->enabled && atomic_load_acq_long(&c->left) == 0);
+}
+
+/*
+ * Take a connection slot; returns 1 on success, 0 if they're all
+ * in use.
+ */
+int
+budget_slot_take(struct budget_slots *s)
+{
+
+	if (atomic_fetchadd_long(&s->used, 1) >= atomic_load_acq_long(&s->max)) {
+		atomic_subtract_long(&s->used, 1);
+		return (0);
+	}
+	return (1);
+}
+
+void
+budget_slot_release(struct budget_slots *s)
+{
+
+	atomic_subtract_long(&s->used, 1);
+}
+
+/*
+ * Change the connection limit.  Lowering it doesn't close anything;
+ * connections over the limit are closed as their requests finish
+ * (see budget_slot_shed().)
+ */
+void
+budget_slots_set_max(struct budget_slots *s, u_long max)
+{
+
+	atomic_store_rel_long(&s->max, max);
+}
+
+/*
+ * If more slots are in use than the limit allows, give one back;
+ * returns 1 if the caller's slot was given back and its connection
+ * should close (without calling budget_slot_release()), else 0.
+ *
+ * Each success takes one off 'used', so only the surplus closes
+ * rather than every connection that checks while over the limit.
+ */
+int
+budget_slot_shed(struct budget_slots *s)
+{
+	u_long u;
+
+	do {
+		u = atomic_load_acq_long(&s->used);
+		if (u <= atomic_load_acq_long(&s->max))
+			return (0);
+	} while (! atomic_cmpset_long(&s->used, u, u - 1));
+
+	return (1);
+}
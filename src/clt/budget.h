@@ -0,0 +1,84 @@
+#ifndef	__BUDGET_H__
+#define	__BUDGET_H__
+
+/*
+ * A global, lock-free budget shared by all worker threads.
+ *
+ * Rather than splitting rates and counts 1/n per thread (so a slow
+ * thread drags the total down, and remainders get lost), threads
+ * draw from shared pools in small batches.  A thread with spare
+ * capacity simply draws more.
+ *
+ * + Rate buckets are token buckets in fixed point.  Whichever thread
+ *   notices enough time has passed wins a CAS on the refill
+ *   timestamp and credits the elapsed time's tokens.
+ * + Counts (total requests/connections) are drawn down; batches
+ *   shrink as the pool empties so the totals are hit exactly.
+ * + Connection slots cap the number of concurrently open
+ *   connections across all threads.
+ *
+ * Each part lives on its own cache line.
+ */
+
+/* Fixed point scale for bucket tokens: 1 token == 1e6 units */
+#define	BUDGET_TOKEN_SCALE	1000000UL
+
+/* Don't bother refilling more often than this */
+#define	BUDGET_REFILL_MIN_USEC	50
+
+/* How many requests/connections a thread draws from a count at once */
+#define	BUDGET_COUNT_BATCH	32
+
+struct budget_bucket {
+	volatile u_long tokens;
+	volatile u_long last_usec;
+	volatile u_long rate;		/* tokens/sec */
+	volatile u_long burst;		/* scaled */
+	int enabled;
+} __aligned(CACHE_LINE_SIZE);
+
+struct budget_count {
+	volatile u_long left;
+	int enabled;
+} __aligned(CACHE_LINE_SIZE);
+
+struct budget_slots {
+	volatile u_long used;
+	volatile u_long max;
+} __aligned(CACHE_LINE_SIZE);
+
+struct budget {
+	struct budget_bucket req_rate;
+	struct budget_bucket conn_rate;
+	struct budget_count req_count;
+	struct budget_count conn_count;
+	struct budget_slots conn_slots;
+	int nthreads;
+
+	/* Set to have every worker finish RUNNING */
+	volatile u_int closed;
+};
+
+extern	void budget_init(struct budget *b, int nthreads);
+extern	void budget_close(struct budget *b);
+extern	int budget_is_closed(struct budget *b);
+extern	void budget_bucket_init(struct budget_bucket *bk, u_long rate,
+	    uint64_t now_usec);
+extern	void budget_bucket_set_rate(struct budget_bucket *bk, u_long rate,
+	    uint64_t now_usec);
+extern	u_long budget_bucket_take(struct budget_bucket *bk, u_long want,
+	    uint64_t now_usec);
+extern	int64_t budget_bucket_wait_usec(struct budget_bucket *bk);
+extern	u_long budget_bucket_batch(const struct budget *b,
+	    const struct budget_bucket *bk);
+extern	void budget_count_init(struct budget_count *c, u_long n);
+extern	u_long budget_count_take(struct budget *b, struct budget_count *c,
+	    u_long want);
+extern	void budget_count_return(struct budget_count *c, u_long n);
+extern	int budget_count_exhausted(struct budget_count *c);
+extern	int budget_slot_take(struct budget_slots *s);
+extern	void budget_slot_release(struct budget_slots *s);
+extern	void budget_slots_set_max(struct budget_slots *s, u_long max);
+extern	int budget_slot_shed(struct budget_slots *s);
+
+#endif	/* __BUDGET_H__ */
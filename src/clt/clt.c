@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <err.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -13,18 +15,30 @@
 #include <sys/param.h>
 #include <sys/cpuset.h>
 #include <sys/socket.h>
+#include <sys/queue.h>
 
 #include <netinet/in.h>
 
+#include <event2/util.h>
 #include <event2/bufferevent.h>
 
+#include <openssl/ssl.h>
+
 #include <evhtp.h>
 
 #include "debug.h"
+#include "alloc_stats.h"
+#include "usdt.h"
 
+#include "hist.h"
 #include "mgr_stats.h"
+#include "seqlock.h"
 #include "thr.h"
+#include "tw.h"
+#include "src_bind.h"
+#include "req_body.h"
 #include "clt.h"
+#include "clt_tls.h"
 
 const char *
 clt_notify_to_str(clt_notify_cmd_t ct)
@@ -55,6 +69,33 @@ clt_notify_to_str(clt_notify_cmd_t ct)
 	}
 }
 
+const char *
+clt_err_to_str(clt_err_t err)
+{
+	switch (err) {
+	case CLT_ERR_NONE:
+		return "none";
+	case CLT_ERR_CONNECT_REFUSED:
+		return "connect_refused";
+	case CLT_ERR_CONNECT_TIMEOUT:
+		return "connect_timeout";
+	case CLT_ERR_CONNECT:
+		return "connect";
+	case CLT_ERR_RESET_HEADERS:
+		return "reset_headers";
+	case CLT_ERR_RESET_BODY:
+		return "reset_body";
+	case CLT_ERR_TIMEOUT:
+		return "timeout";
+	case CLT_ERR_PARSE:
+		return "parse";
+	case CLT_ERR_ABORTED:
+		return "aborted";
+	default:
+		return "<unknown>";
+	}
+}
+
 static void
 clt_call_notify(struct client_req *req, clt_notify_cmd_t ct, int data)
 {
@@ -63,22 +104,31 @@ clt_call_notify(struct client_req *req, clt_notify_cmd_t ct, int data)
 		req->cb.cb(req, ct, data, req->cb.cbdata);
 }
 
+static void clt_conn_release(struct client_req *r);
+
+/*
+ * Note activity on the request; this just pushes out the idle
+ * deadline on the timer wheel.
+ */
 static void
 clt_conn_timeout_rearm(struct client_req *r)
 {
-	struct timeval tv;
 
-	tv.tv_sec = 5;
-	tv.tv_usec = 0;
+	tw_ent_touch(r->thr->t_tw, &r->tw_ent);
+}
+
+static void
+clt_conn_timeout_start(struct client_req *r)
+{
 
-	evtimer_add(r->ev_timeout, &tv);
+	tw_ent_start(r->thr->t_tw, &r->tw_ent);
 }
 
 static void
 clt_conn_timeout_stop(struct client_req *r)
 {
 
-	evtimer_del(r->ev_timeout);
+	tw_ent_stop(r->thr->t_tw, &r->tw_ent);
 }
 
 /*
@@ -111,6 +161,10 @@ clt_conn_destroy(struct client_req *req)
 	/* free the request; disconnect hooks */
 	if (req->req) {
 		evhtp_unset_all_hooks(&req->req->hooks);
+
+		/* We're closing it; it hasn't failed */
+		if (req->req_err == CLT_ERR_NONE)
+			req->req_err = CLT_ERR_ABORTED;
 	}
 
 	/*
@@ -133,22 +187,12 @@ clt_conn_destroy(struct client_req *req)
 		evhtp_request_free(req->req);
 	}
 
+	if (req->thr->t_tls != NULL)
+		clt_tls_conn_fini(req->thr->t_tls, req);
 	if (req->con)
 		evhtp_connection_free(req->con);
 
-	if (req->ev_timeout) {
-		evtimer_del(req->ev_timeout);
-		event_free(req->ev_timeout);
-	}
-
-	if (req->host_ip)
-		free(req->host_ip);
-	if (req->host_hdr)
-		free(req->host_hdr);
-	if (req->uri)
-		free(req->uri);
-
-	free(req);
+	clt_conn_release(req);
 }
 
 /*
@@ -168,12 +212,27 @@ clt_req_destroy(struct client_req *req)
 		evhtp_request_free(req->req);
 		req->req = NULL;
 	}
+}
 
-	/* This is per request */
-	if (req->uri)
-		free(req->uri);
-	req->uri = NULL;
+/*
+ * Classify a failed request.  A failed connect is whatever the
+ * event hook saw; otherwise it's down to how far the response got.
+ */
+static clt_err_t
+clt_req_err_type(struct client_req *r, evhtp_connection_t *conn,
+    short events)
+{
 
+	if (r->conn_err != CLT_ERR_NONE)
+		return (r->conn_err);
+	if (conn != NULL && conn->parser != NULL &&
+	    htparser_get_error(conn->parser) != htparse_error_none)
+		return (CLT_ERR_PARSE);
+	if (events & BEV_EVENT_TIMEOUT)
+		return (CLT_ERR_TIMEOUT);
+	if (r->resp_started)
+		return (CLT_ERR_RESET_BODY);
+	return (CLT_ERR_RESET_HEADERS);
 }
 
 /*
@@ -186,8 +245,11 @@ static evhtp_res
 clt_upstream_conn_fini(evhtp_connection_t *conn, void *arg)
 {
 	struct client_req *r = arg;
+	int ap;
 
 	debug_printf("%s: %p: called\n", __func__, r);
+	USDT_PROBE1(httpclt, conn_fini, r);
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_TEARDOWN);
 
 	/*
 	 * XXX for now - assume evhtp is going away; so free any
@@ -201,14 +263,28 @@ clt_upstream_conn_fini(evhtp_connection_t *conn, void *arg)
 	if (r->req) {
 		/* We don't want the req hooks either */
 		evhtp_unset_all_hooks(&r->req->hooks);
+
+		/*
+		 * libevhtp frees the connection without calling the
+		 * error hook on a parse error, and if the request was
+		 * otherwise in flight it's gone too; fail it here.
+		 */
+		if (r->req_err == CLT_ERR_NONE) {
+			r->req_err = clt_req_err_type(r, conn, 0);
+			clt_call_notify(r, CLT_NOTIFY_REQUEST_DONE_ERROR,
+			    r->req_err);
+		}
 	}
 	r->con = NULL;
 	r->req = NULL;
+	if (r->thr->t_tls != NULL)
+		clt_tls_conn_fini(r->thr->t_tls, r);
 
 	clt_conn_timeout_rearm(r);
 
 	clt_call_notify(r, CLT_NOTIFY_CONN_CLOSING, 0);
 
+	ALLOC_PHASE_EXIT(ap);
 	return (EVHTP_RES_OK);
 }
 
@@ -237,9 +313,12 @@ clt_upstream_chunk_done(evhtp_request_t * upstream_req, void * arg)
 {
 	struct client_req *r = arg;
 	size_t len;
+	int ap;
 
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_RESPONSE);
 	len = evbuffer_get_length(r->req->buffer_in);
 	clt_conn_timeout_rearm(r);
+	USDT_PROBE2(httpclt, chunk_done, r, len);
 
 	debug_printf("%s: %p: called\n", __func__, r);
 	debug_printf("%s: %p: req->buffer_in len=%lu\n",
@@ -250,6 +329,7 @@ clt_upstream_chunk_done(evhtp_request_t * upstream_req, void * arg)
 	/* Here's where we consume the incoming data from the input buffer */
 	evbuffer_drain(r->req->buffer_in, len);
 
+	ALLOC_PHASE_EXIT(ap);
 	return EVHTP_RES_OK;
 }
 
@@ -273,6 +353,14 @@ clt_upstream_error(evhtp_request_t * req, evhtp_error_flags errtype, void * arg)
 	struct client_req *r = arg;
 
 	debug_printf("%s: %p: called\n", __func__, r);
+	USDT_PROBE2(httpclt, req_error, r, errtype);
+
+	if (r->req_err != CLT_ERR_NONE) {
+		clt_conn_timeout_stop(r);
+		return (EVHTP_RES_OK);
+	}
+	r->req_err = clt_req_err_type(r, r->con, errtype);
+	debug_printf("%s: %p: %s\n", __func__, r, clt_err_to_str(r->req_err));
 
 	/*
 	 * We can't destroy the request here;
@@ -283,9 +371,9 @@ clt_upstream_error(evhtp_request_t * req, evhtp_error_flags errtype, void * arg)
 	 * is freed.
 	 */
 	if (errtype & BEV_EVENT_TIMEOUT)
-		clt_call_notify(r, CLT_NOTIFY_REQUEST_TIMEOUT, 0);
+		clt_call_notify(r, CLT_NOTIFY_REQUEST_TIMEOUT, r->req_err);
 	else
-		clt_call_notify(r, CLT_NOTIFY_REQUEST_DONE_ERROR, 0);
+		clt_call_notify(r, CLT_NOTIFY_REQUEST_DONE_ERROR, r->req_err);
 	clt_conn_timeout_stop(r);
 
 	return (EVHTP_RES_OK);
@@ -302,10 +390,58 @@ clt_upstream_headers_start(evhtp_request_t * upstream_req, void *arg)
 	 */
 	debug_printf("%s: %p: status=%d\n", __func__,
 	    r, evhtp_request_status(upstream_req));
+	USDT_PROBE2(httpclt, headers_start, r,
+	    evhtp_request_status(upstream_req));
+	r->resp_started = 1;
 	clt_conn_timeout_rearm(r);
 	return (EVHTP_RES_OK);
 }
 
+/*
+ * All the response headers are in.
+ *
+ * libevhtp doesn't say how long the header block was, so count it
+ * from the parsed headers: the status line, "Name: value\r\n" per
+ * header and the blank line.  The status line's reason phrase isn't
+ * kept, so it isn't counted.
+ */
+static evhtp_res
+clt_upstream_headers(evhtp_request_t * upstream_req, evhtp_headers_t *hdrs,
+    void *arg)
+{
+	struct client_req *r = arg;
+	evhtp_header_t *h;
+	uint64_t len;
+
+	len = sizeof("HTTP/1.1 200 \r\n") - 1 + 2;
+	TAILQ_FOREACH(h, hdrs, next)
+		len += h->klen + h->vlen + 4;
+	r->resp_hdr_bytes += len;
+	r->thr->t_mstats->resp_hdr_bytes += len;
+	clt_conn_timeout_rearm(r);
+	return (EVHTP_RES_OK);
+}
+
+/*
+ * A piece of the response body has been parsed, chunked or not.
+ *
+ * Count it now rather than when the request finishes, so a long
+ * response shows up in the interval it arrived in.  It's left in
+ * buffer_in for the chunk/request completion paths to consume.
+ */
+static evhtp_res
+clt_upstream_read(evhtp_request_t * upstream_req, struct evbuffer *buf,
+    void *arg)
+{
+	struct client_req *r = arg;
+	size_t len;
+
+	len = evbuffer_get_length(buf);
+	r->resp_body_bytes += len;
+	r->thr->t_mstats->resp_body_bytes += len;
+	return (EVHTP_RES_OK);
+}
+
 /*
  * Callback: finished - error and non-error
  */
@@ -334,46 +470,172 @@ clt_upstream_fini(evhtp_request_t * upstream_req, void * arg)
 }
 
 static void
-clt_conn_timeout(evutil_socket_t sock, short which, void *arg)
+clt_conn_timeout(struct tw_ent *e, void *arg)
 {
 	struct client_req *r = arg;
 
 	/* Timeout; signify upper layers its time to close things */
-	clt_call_notify(r, CLT_NOTIFY_REQUEST_TIMEOUT, 0);
+	USDT_PROBE1(httpclt, req_timeout, r);
+	if (r->con == NULL || ! r->con->connected)
+		r->req_err = CLT_ERR_CONNECT_TIMEOUT;
+	else
+		r->req_err = CLT_ERR_TIMEOUT;
+	clt_call_notify(r, CLT_NOTIFY_REQUEST_TIMEOUT, r->req_err);
+}
+
+/*
+ * Why a connect failed.  A pending SO_ERROR on the socket is taken
+ * first, as nothing in between can clobber it.  Usually libevent has
+ * already consumed it finishing the connect and set it as the socket
+ * error, so fall back to EVUTIL_SOCKET_ERROR() for that.
+ */
+static int
+clt_conn_sock_error(evhtp_connection_t *conn)
+{
+	evutil_socket_t fd;
+	socklen_t len;
+	int err;
+
+	fd = conn->bev != NULL ? bufferevent_getfd(conn->bev) : -1;
+	err = 0;
+	len = sizeof(err);
+	if (fd >= 0 &&
+	    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+	    err != 0)
+		return (err);
+	return (EVUTIL_SOCKET_ERROR());
+}
+
+/*
+ * Connection events.  This runs before libevhtp's own handling
+ * (which clears con->connected), so it's where a failed connect
+ * can be told apart from a close.
+ */
+static evhtp_res
+clt_upstream_conn_event(evhtp_connection_t *conn, short events, void *arg)
+{
+	struct client_req *r = arg;
+
+	if (events & BEV_EVENT_CONNECTED) {
+		USDT_PROBE1(httpclt, conn_established, r);
+		return (EVHTP_RES_OK);
+	}
+	if (conn->connected || r->conn_err != CLT_ERR_NONE)
+		return (EVHTP_RES_OK);
+
+	if (events & BEV_EVENT_TIMEOUT)
+		r->conn_err = CLT_ERR_CONNECT_TIMEOUT;
+	else if (clt_conn_sock_error(conn) == ECONNREFUSED)
+		r->conn_err = CLT_ERR_CONNECT_REFUSED;
+	else
+		r->conn_err = CLT_ERR_CONNECT;
+
+	/* A pending request reports it via the error hook instead */
+	if (r->req == NULL)
+		clt_call_notify(r, CLT_NOTIFY_CONNECT_ERROR, r->conn_err);
+	return (EVHTP_RES_OK);
+}
+
+/*
+ * Grab a client_req from the per-thread pool, or allocate a new one
+ * if the pool is empty.
+ */
+static struct client_req *
+clt_conn_alloc(struct clt_thr *thr)
+{
+	struct client_req *r;
+
+	r = TAILQ_FIRST(&thr->t_req_pool);
+	if (r != NULL) {
+		TAILQ_REMOVE(&thr->t_req_pool, r, pool_node);
+		thr->t_req_pool_count--;
+		return (r);
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		warn("%s: calloc", __func__);
+		return (NULL);
+	}
+	r->thr = thr;
+	tw_ent_init(&r->tw_ent, clt_conn_timeout, r);
+
+	return (r);
+}
+
+/*
+ * Return a client_req to the per-thread pool.
+ *
+ * The connection and request must already be gone.
+ */
+static void
+clt_conn_release(struct client_req *r)
+{
+	struct clt_thr *thr = r->thr;
+
+	tw_ent_stop(thr->t_tw, &r->tw_ent);
+	bzero(r, sizeof(*r));
+	r->thr = thr;
+	tw_ent_init(&r->tw_ent, clt_conn_timeout, r);
+
+	/* LIFO, so the most recently used (cache-warm) entry goes next */
+	TAILQ_INSERT_HEAD(&thr->t_req_pool, r, pool_node);
+	thr->t_req_pool_count++;
+}
+
+/*
+ * Free everything in the per-thread client_req pool.
+ *
+ * Must be called before the thread event base is freed.
+ */
+void
+clt_conn_pool_drain(struct clt_thr *thr)
+{
+	struct client_req *r;
+
+	while ((r = TAILQ_FIRST(&thr->t_req_pool)) != NULL) {
+		TAILQ_REMOVE(&thr->t_req_pool, r, pool_node);
+		thr->t_req_pool_count--;
+		free(r);
+	}
 }
 
 /*
  * Create a connection to the given host/port.
  *
  * This doesn't create a HTTP request - just the TCP connection.
+ *
+ * host_ip and tmpl are owned by the caller and must remain valid
+ * for the lifetime of the connection.
+ *
+ * If src is non-NULL then the socket is bound to it before connecting.
  */
 struct client_req *
 clt_conn_create(struct clt_thr *thr, clt_notify_cb *cb, void *cbdata,
-    const char *host_ip, const char *host_hdr, int port)
+    const char *host_ip, const struct sockaddr_in *src,
+    const struct clt_req_tmpl *tmpl, int port, int dst_idx)
 {
 	struct client_req *r;
 	struct timeval tv;
 
-	r = calloc(1, sizeof(*r));
-	if (r == NULL) {
-		warn("%s: calloc", __func__);
+	r = clt_conn_alloc(thr);
+	if (r == NULL)
 		goto error;
-	}
 
-	r->host_ip = strdup(host_ip);
-	if (r->host_ip == NULL) {
-		warn("%s: strdup\n", __func__);
-		goto error;
-	}
-	r->host_hdr = strdup(host_ip);
-	if (r->host_hdr == NULL) {
-		warn("%s: strdup\n", __func__);
-		goto error;
-	}
+	r->host_ip = host_ip;
+	r->tmpl = tmpl;
 	r->port = port;
+	r->dst_idx = dst_idx;
 	r->thr = thr;
-	r->uri = NULL;	/* No URI yet */
-	r->con = evhtp_connection_new(thr->t_evbase, r->host_ip, r->port);
+	r->conn_err = CLT_ERR_NONE;
+	src_bind_set(src);
+	if (thr->t_tls != NULL)
+		r->con = evhtp_connection_ssl_new(thr->t_evbase, r->host_ip,
+		    r->port, thr->t_tls->ctx);
+	else
+		r->con = evhtp_connection_new(thr->t_evbase, r->host_ip,
+		    r->port);
+	src_bind_set(NULL);
 	r->cb.cb = cb;
 	r->cb.cbdata = cbdata;
 	if (r->con == NULL) {
@@ -381,40 +643,52 @@ clt_conn_create(struct clt_thr *thr, clt_notify_cb *cb, void *cbdata,
 		goto error;
 	}
 
+	if (thr->t_tls != NULL &&
+	    clt_tls_conn_setup(thr->t_tls, r->con->ssl, r) != 0) {
+		debug_printf("%s: thr=%p: TLS setup failed\n", __func__, thr);
+		goto error;
+	}
+
 	evhtp_set_hook(&r->con->hooks, evhtp_hook_on_connection_fini,
 	    clt_upstream_conn_fini, r);
 
-	/* 5 second timeout on requests */
-	tv.tv_sec = 5;
-	tv.tv_usec = 0;
-	evhtp_connection_set_timeouts(r->con, &tv, &tv);
+	/* Socket read/write timeouts follow the request idle timeout */
+	if (thr->t_tw->idle_msec > 0) {
+		tv.tv_sec = thr->t_tw->idle_msec / 1000;
+		tv.tv_usec = (thr->t_tw->idle_msec % 1000) * 1000;
+		evhtp_connection_set_timeouts(r->con, &tv, &tv);
+	}
 
-	/* And start our own timer */
-	r->ev_timeout = evtimer_new(thr->t_evbase,
-	    clt_conn_timeout,
-	    r);
+	evhtp_set_hook(&r->con->hooks, evhtp_hook_on_event,
+	    (evhtp_hook) clt_upstream_conn_event, r);
+	USDT_PROBE3(httpclt, conn_create, r, r->host_ip, r->port);
 
 	debug_printf("%s: %p: called; con=%p\n", __func__, r, r->con);
 	return (r);
 
 error:
-	if (r && r->host_ip)
-		free(r->host_ip);
-	if (r && r->host_hdr)
-		free(r->host_hdr);
-	if (r && r->uri)
-		free(r->uri);
 	if (r && r->con)
 		evhtp_connection_free(r->con);
-	if (r && r->ev_timeout) {
-		evtimer_del(r->ev_timeout);
-		event_free(r->ev_timeout);
-	}
 	if (r != NULL)
-		free(r);
+		clt_conn_release(r);
 	return (NULL);
 }
 
+/*
+ * Has the connection come up - and for TLS, finished its handshake -
+ * so a request can go straight out?
+ */
+int
+clt_conn_is_established(const struct client_req *r)
+{
+
+	if (r->con == NULL || ! r->con->connected)
+		return (0);
+	if (r->thr->t_tls != NULL && r->tls_hs_state != CLT_TLS_HS_DONE)
+		return (0);
+	return (1);
+}
+
 /*
  * Transaction completed - notify upper layers
  *
@@ -428,8 +702,11 @@ static void
 clt_req_cb(evhtp_request_t *r, void *arg)
 {
 	struct client_req *req = arg;
+	int ap;
 
 	debug_printf("%s: %p: called\n", __func__, req);
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_RESPONSE);
+	USDT_PROBE2(httpclt, req_done, req, evhtp_request_status(r));
 
 	/* XXX TODO: hook? */
 	clt_call_notify(req, CLT_NOTIFY_REQUEST_DONE_OK, 
@@ -439,10 +716,153 @@ clt_req_cb(evhtp_request_t *r, void *arg)
 //	req->req = NULL;
 	req->con->request = NULL;
 	clt_req_destroy(req);
+	ALLOC_PHASE_EXIT(ap);
+}
+
+/*
+ * Build the pre-serialised header block for requests to a given
+ * host.  hdrs is a list of "Name: value" strings added after the
+ * stock headers.
+ */
+int
+clt_req_tmpl_init(struct clt_req_tmpl *t, const char *host_hdr,
+    int keepalive, char * const *hdrs, int nhdrs)
+{
+	struct evbuffer *evb;
+	int i;
+
+	bzero(t, sizeof(*t));
+
+	evb = evbuffer_new();
+	if (evb == NULL) {
+		warn("%s: evbuffer_new", __func__);
+		return (-1);
+	}
+
+	evbuffer_add_printf(evb, "Host: %s\r\n", host_hdr);
+	evbuffer_add_printf(evb, "User-Agent: client\r\n");
+	evbuffer_add_printf(evb, "Connection: %s\r\n",
+	    keepalive ? "keep-alive" : "close");
+	for (i = 0; i < nhdrs; i++)
+		evbuffer_add_printf(evb, "%s\r\n", hdrs[i]);
+
+	t->len = evbuffer_get_length(evb);
+	t->buf = malloc(t->len);
+	if (t->buf == NULL) {
+		warn("%s: malloc", __func__);
+		evbuffer_free(evb);
+		return (-1);
+	}
+	evbuffer_remove(evb, t->buf, t->len);
+	evbuffer_free(evb);
+
+	t->is_keepalive = keepalive;
+
+	return (0);
+}
+
+void
+clt_req_tmpl_free(struct clt_req_tmpl *t)
+{
+
+	if (t->buf != NULL)
+		free(t->buf);
+	t->buf = NULL;
+	t->len = 0;
+}
+
+/*
+ * Append the request body to the output buffer.
+ *
+ * The body data is only ever added by reference to the shared body
+ * buffer, which is referenced repeatedly if the body is longer than
+ * it; only the chunk framing is copied.
+ */
+static int
+clt_req_send_body(struct evbuffer *obuf, const struct clt_req_params *p)
+{
+	const struct req_body *b = p->body;
+	size_t left, ofs, n;
+
+	ofs = 0;
+	for (left = p->body_len; left > 0; left -= n) {
+		n = MIN(left, b->len - ofs);
+		if (p->body_chunked) {
+			n = MIN(n, REQ_BODY_CHUNK_SIZE);
+			if (evbuffer_add_printf(obuf, "%zx\r\n", n) < 0)
+				return (-1);
+		}
+		if (evbuffer_add_reference(obuf, b->buf + ofs, n,
+		    NULL, NULL) < 0)
+			return (-1);
+		if (p->body_chunked && evbuffer_add(obuf, "\r\n", 2) < 0)
+			return (-1);
+		ofs += n;
+		if (ofs == b->len)
+			ofs = 0;
+	}
+
+	if (p->body_chunked && evbuffer_add(obuf, "0\r\n\r\n", 5) < 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Write the request out.
+ *
+ * This is what evhtp_make_request() does, except the headers come from
+ * the pre-serialised template rather than from allocating and walking
+ * headers_out each time.  The template is small, so it's copied into
+ * the output buffer rather than added by reference (which would
+ * allocate an evbuffer chain per request.)
+ */
+static int
+clt_req_send(struct client_req *req, const struct clt_req_params *p)
+{
+	struct evbuffer *obuf;
+	size_t olen;
+
+	obuf = bufferevent_get_output(req->con->bev);
+	olen = evbuffer_get_length(obuf);
+
+	req->req->conn = req->con;
+	req->req->method = p->method;
+	req->con->request = req->req;
+
+	if (evbuffer_add_printf(obuf, "%s %s HTTP/1.1\r\n",
+	    htparser_get_methodstr_m(p->method), p->uri) < 0)
+		return (-1);
+	if (evbuffer_add(obuf, req->tmpl->buf, req->tmpl->len) < 0)
+		return (-1);
+	if (p->hdr_len > 0 &&
+	    evbuffer_add(obuf, p->hdr_buf, p->hdr_len) < 0)
+		return (-1);
+
+	/* Body framing */
+	if (p->body != NULL && p->body_chunked) {
+		if (evbuffer_add_printf(obuf,
+		    "Transfer-Encoding: chunked\r\n") < 0)
+			return (-1);
+	} else if (p->body != NULL ||
+	    p->method == htp_method_POST || p->method == htp_method_PUT) {
+		if (evbuffer_add_printf(obuf, "Content-Length: %zu\r\n",
+		    p->body != NULL ? p->body_len : 0) < 0)
+			return (-1);
+	}
+
+	if (evbuffer_add(obuf, "\r\n", 2) < 0)
+		return (-1);
+
+	if (p->body != NULL && clt_req_send_body(obuf, p) < 0)
+		return (-1);
+
+	req->req_bytes = evbuffer_get_length(obuf) - olen;
+	return (0);
 }
 
 int
-clt_req_create(struct client_req *req, const char *uri, int keepalive)
+clt_req_create(struct client_req *req, const struct clt_req_params *p)
 {
 
 	/* Only do this if there's no outstanding request */
@@ -461,12 +881,6 @@ clt_req_create(struct client_req *req, const char *uri, int keepalive)
 		return (-1);
 	}
 
-	req->uri = strdup(uri);
-	if (req->uri == NULL) {
-		warn("%s: strdup", __func__);
-		return (-1);
-	}
-
 	req->req = evhtp_request_new(clt_req_cb, req);
 	if (req->req == NULL) {
 		fprintf(stderr, "%s: %p: failed to create request\n",
@@ -475,21 +889,14 @@ clt_req_create(struct client_req *req, const char *uri, int keepalive)
 		return (-1);
 	}
 
-	/* Force non-keepalive for now */
-	req->is_keepalive = keepalive;
+	/* Keepalive is baked into the template */
+	req->is_keepalive = req->tmpl->is_keepalive;
 
-	/* Add headers */
-	evhtp_headers_add_header(req->req->headers_out,
-	    evhtp_header_new("Host", req->host_hdr, 0, 0));
-	evhtp_headers_add_header(req->req->headers_out,
-	    evhtp_header_new("User-Agent", "client", 0, 0));
-
-	if (req->is_keepalive)
-		evhtp_headers_add_header(req->req->headers_out,
-		    evhtp_header_new("Connection", "keep-alive", 0, 0));
-	else
-		evhtp_headers_add_header(req->req->headers_out,
-		    evhtp_header_new("Connection", "close", 0, 0));
+	req->req_bytes = 0;
+	req->resp_hdr_bytes = 0;
+	req->resp_body_bytes = 0;
+	req->resp_started = 0;
+	req->req_err = CLT_ERR_NONE;
 
 	/* Hooks */
 	evhtp_set_hook(&req->req->hooks, evhtp_hook_on_error,
@@ -504,10 +911,45 @@ clt_req_create(struct client_req *req, const char *uri, int keepalive)
 	    clt_upstream_chunks_done, req);
 	evhtp_set_hook(&req->req->hooks, evhtp_hook_on_headers_start,
 	    clt_upstream_headers_start, req);
+	evhtp_set_hook(&req->req->hooks, evhtp_hook_on_headers,
+	    clt_upstream_headers, req);
+	evhtp_set_hook(&req->req->hooks, evhtp_hook_on_read,
+	    clt_upstream_read, req);
+
+	/* Start the request timeout; the hooks keep it alive */
+	clt_conn_timeout_start(req);
 
 	/* Start request */
-	evhtp_make_request(req->con, req->req, htp_method_GET, req->uri);
+	if (clt_req_send(req, p) < 0) {
+		fprintf(stderr, "%s: %p: failed to send request\n",
+		    __func__,
+		    req);
+		clt_conn_timeout_stop(req);
+		evhtp_unset_all_hooks(&req->req->hooks);
+		req->con->request = NULL;
+		evhtp_request_free(req->req);
+		req->req = NULL;
+		return (-1);
+	}
 
+	USDT_PROBE3(httpclt, req_create, req, p->method, p->uri);
 	debug_printf("%s: %p: done!\n", __func__, req);
 	return (0);
 }
+
+/*
+ * Parse a HTTP method name (eg "POST".)
+ */
+int
+clt_method_parse(const char *str, htp_method *m)
+{
+	int i;
+
+	for (i = 0; i < htp_method_UNKNOWN; i++) {
+		if (strcasecmp(str, htparser_get_methodstr_m(i)) == 0) {
+			*m = i;
+			return (0);
+		}
+	}
+	return (-1);
+}
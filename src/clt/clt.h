@@ -16,10 +16,48 @@ typedef enum {
 	CLT_NOTIFY_REQ_DESTROYING,
 } clt_notify_cmd_t;
 
+/*
+ * Why a connection or request failed; passed as the data for
+ * CLT_NOTIFY_CONNECT_ERROR, CLT_NOTIFY_REQUEST_DONE_ERROR and
+ * CLT_NOTIFY_REQUEST_TIMEOUT.
+ */
+typedef enum {
+	CLT_ERR_NONE,
+	CLT_ERR_CONNECT_REFUSED,
+	CLT_ERR_CONNECT_TIMEOUT,
+	CLT_ERR_CONNECT,		/* any other connect/TLS failure */
+	CLT_ERR_RESET_HEADERS,		/* closed before the response headers */
+	CLT_ERR_RESET_BODY,		/* closed during the response body */
+	CLT_ERR_TIMEOUT,		/* our request/idle timeout */
+	CLT_ERR_PARSE,			/* unparseable response */
+	CLT_ERR_ABORTED,		/* closed by us; not reported */
+} clt_err_t;
+
+typedef enum {
+	CLT_TLS_HS_NONE,
+	CLT_TLS_HS_STARTED,
+	CLT_TLS_HS_DONE,
+	CLT_TLS_HS_FAILED,
+} clt_tls_hs_state_t;
+
 typedef int clt_notify_cb(struct client_req *r, clt_notify_cmd_t ct,
     int data,
     void *cbdata);
 
+/*
+ * A pre-serialised block of request headers.
+ *
+ * Everything after the request line is identical for every request
+ * to a given destination, so it's built once (Host, User-Agent,
+ * Connection and any custom headers) and appended to the connection
+ * output buffer as-is for each request.
+ */
+struct clt_req_tmpl {
+	char *buf;
+	size_t len;
+	int is_keepalive;
+};
+
 /*
  * A client request will have a connection (con) to an IP address, and then
  * one or more outstanding HTTP requests.
@@ -31,27 +69,55 @@ struct client_req {
 	evhtp_connection_t *con;
 	evhtp_request_t *req;
 	struct clt_thr *thr;
-	struct event *ev_timeout;
 
-	/* Connection details */
-	char *host_ip;
-	char *host_hdr;
+	/* Idle/total request timeout */
+	struct tw_ent tw_ent;
+
+	/* Entry on the per-thread free pool */
+	TAILQ_ENTRY(client_req) pool_node;
+
+	/* Connection details; owned by the caller */
+	const char *host_ip;
 	int port;
 
-	/* Request URI */
-	char *uri;
+	/* Caller's destination index; picks the TLS session to resume */
+	int dst_idx;
+
+	/* TLS handshake tracking */
+	clt_tls_hs_state_t tls_hs_state;
+	uint64_t tls_hs_start;
+
+	/* Pre-serialised request headers; owned by the caller */
+	const struct clt_req_tmpl *tmpl;
 
 	/* Keepalive this request? */
 	int is_keepalive;
 
+	/*
+	 * Error tracking: why the connect failed, if it did; whether
+	 * the current response has started; and whether the current
+	 * request has failed, so it's only reported once.
+	 */
+	clt_err_t conn_err;
+	int resp_started;
+	clt_err_t req_err;
+
 	/*
 	 * How many requests to issue before this client
 	 * request is torn down.
 	 */
 	int nreq;
 
-	/* How much data was read */
-	size_t cur_read_ptr;
+	/*
+	 * Bytes for the current request: written (request line,
+	 * headers and body, as framed) and read (response headers and
+	 * body.)  The read bytes are also credited to the thread's
+	 * stats as they arrive; the write bytes once the request is
+	 * sent.
+	 */
+	uint64_t req_bytes;
+	uint64_t resp_hdr_bytes;
+	uint64_t resp_body_bytes;
 
 	struct {
 		clt_notify_cb *cb;
@@ -67,14 +133,42 @@ struct client_req {
 #endif
 };
 
+/*
+ * The per-request parts of a request.
+ */
+struct clt_req_params {
+	htp_method method;
+	const char *uri;
+
+	/* Extra pre-serialised "Name: value\r\n" lines, or NULL */
+	const char *hdr_buf;
+	size_t hdr_len;
+
+	/*
+	 * Request body, sent by reference to the shared body buffer;
+	 * body == NULL for no body.
+	 */
+	const struct req_body *body;
+	size_t body_len;
+	int body_chunked;
+};
+
 extern	void clt_conn_destroy(struct client_req *req);
 extern	void clt_req_destroy(struct client_req *req);
 extern	struct client_req * clt_conn_create(struct clt_thr *thr,
 	    clt_notify_cb *cb,
 	    void *cbdata,
-	    const char *host_ip, const char *host_hdr, int port);
-extern	int clt_req_create(struct client_req *req, const char *uri,
-	    int keepalive);
+	    const char *host_ip, const struct sockaddr_in *src,
+	    const struct clt_req_tmpl *tmpl, int port, int dst_idx);
+extern	int clt_conn_is_established(const struct client_req *r);
+extern	int clt_req_create(struct client_req *req,
+	    const struct clt_req_params *p);
+extern	int clt_req_tmpl_init(struct clt_req_tmpl *t, const char *host_hdr,
+	    int keepalive, char * const *hdrs, int nhdrs);
+extern	void clt_req_tmpl_free(struct clt_req_tmpl *t);
 extern	const char * clt_notify_to_str(clt_notify_cmd_t ct);
+extern	const char * clt_err_to_str(clt_err_t err);
+extern	void clt_conn_pool_drain(struct clt_thr *thr);
+extern	int clt_method_parse(const char *str, htp_method *m);
 
 #endif
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+
+#include <netinet/in.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include <evhtp.h>
+
+#include "debug.h"
+#include "hist.h"
+#include "mgr_stats.h"
+#include "seqlock.h"
+#include "thr.h"
+#include "tw.h"
+#include "mtime.h"
+#include "clt.h"
+#include "clt_tls.h"
+#include "usdt.h"
+
+/* SSL ex_data slot pointing back at the owning client_req */
+static int clt_tls_ex_idx = -1;
+static pthread_once_t clt_tls_once = PTHREAD_ONCE_INIT;
+
+static void
+clt_tls_init_once(void)
+{
+
+	clt_tls_ex_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+/*
+ * Track handshake start/finish for latency and full vs resumed
+ * accounting.
+ *
+ * TLS 1.3 can report further handshake start/done pairs for
+ * post-handshake messages (eg session tickets), so only the first
+ * completed handshake on a connection is counted.
+ */
+static void
+clt_tls_info_cb(const SSL *ssl, int where, int ret)
+{
+	struct client_req *req;
+	struct clt_tls *t;
+
+	req = SSL_get_ex_data(ssl, clt_tls_ex_idx);
+	if (req == NULL || req->thr == NULL || req->thr->t_tls == NULL)
+		return;
+	t = req->thr->t_tls;
+
+	if ((where & SSL_CB_HANDSHAKE_START) &&
+	    req->tls_hs_state == CLT_TLS_HS_NONE) {
+		req->tls_hs_state = CLT_TLS_HS_STARTED;
+		req->tls_hs_start = mtime_now_usec();
+	} else if ((where & SSL_CB_HANDSHAKE_DONE) &&
+	    req->tls_hs_state == CLT_TLS_HS_STARTED) {
+		req->tls_hs_state = CLT_TLS_HS_DONE;
+		if (SSL_session_reused((SSL *) ssl))
+			t->stats->tls_hs_resumed++;
+		else
+			t->stats->tls_hs_full++;
+		hist_add(&t->stats->tls_hs_usec,
+		    mtime_now_usec() - req->tls_hs_start);
+		USDT_PROBE2(httpclt, tls_handshake_done, req,
+		    SSL_session_reused((SSL *) ssl));
+	} else if ((where & SSL_CB_ALERT) && (ret >> 8) == SSL3_AL_FATAL &&
+	    req->tls_hs_state == CLT_TLS_HS_STARTED) {
+		/* A fatal alert, sent or received, ends the handshake */
+		req->tls_hs_state = CLT_TLS_HS_FAILED;
+		t->stats->tls_hs_err++;
+	} else if ((where & SSL_CB_EXIT) && ret == 0 &&
+	    req->tls_hs_state == CLT_TLS_HS_STARTED) {
+		req->tls_hs_state = CLT_TLS_HS_FAILED;
+		t->stats->tls_hs_err++;
+	}
+}
+
+/*
+ * The connection is going away.  A handshake that's still in
+ * progress failed without an alert - most often a TCP reset - so
+ * count it here.
+ */
+void
+clt_tls_conn_fini(struct clt_tls *t, struct client_req *req)
+{
+
+	if (req->tls_hs_state != CLT_TLS_HS_STARTED)
+		return;
+	req->tls_hs_state = CLT_TLS_HS_FAILED;
+	t->stats->tls_hs_err++;
+}
+
+/*
+ * A new session (or TLS 1.3 ticket) has arrived; keep it as the
+ * session to resume for this destination.
+ */
+static int
+clt_tls_new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	struct client_req *req;
+	struct clt_tls *t;
+
+	req = SSL_get_ex_data(ssl, clt_tls_ex_idx);
+	if (req == NULL || req->thr == NULL || req->thr->t_tls == NULL)
+		return (0);
+	t = req->thr->t_tls;
+	if (req->dst_idx < 0 || req->dst_idx >= CLT_TLS_SESS_MAX)
+		return (0);
+
+	if (t->sess[req->dst_idx] != NULL)
+		SSL_SESSION_free(t->sess[req->dst_idx]);
+	t->sess[req->dst_idx] = sess;
+
+	/* We keep the reference */
+	return (1);
+}
+
+/*
+ * Convert "h2,http/1.1" into the ALPN wire format.
+ */
+static int
+clt_tls_set_alpn(SSL_CTX *ctx, const char *alpn)
+{
+	unsigned char buf[256];
+	const char *p, *e;
+	size_t n = 0, len;
+
+	for (p = alpn; *p != '\0'; p = (*e == '\0') ? e : e + 1) {
+		e = strchr(p, ',');
+		if (e == NULL)
+			e = p + strlen(p);
+		len = e - p;
+		if (len == 0 || len > 255 || n + len + 1 > sizeof(buf))
+			return (-1);
+		buf[n++] = len;
+		memcpy(buf + n, p, len);
+		n += len;
+	}
+	if (n == 0)
+		return (-1);
+
+	/* Note: returns 0 on success */
+	if (SSL_CTX_set_alpn_protos(ctx, buf, n) != 0)
+		return (-1);
+	return (0);
+}
+
+struct clt_tls *
+clt_tls_new(const struct clt_tls_cfg *cfg, struct mgr_stats *stats)
+{
+	struct clt_tls *t;
+
+	(void) pthread_once(&clt_tls_once, clt_tls_init_once);
+	if (clt_tls_ex_idx < 0) {
+		fprintf(stderr, "%s: SSL_get_ex_new_index failed\n", __func__);
+		return (NULL);
+	}
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL) {
+		warn("%s: calloc", __func__);
+		return (NULL);
+	}
+	t->stats = stats;
+	t->session_reuse = cfg->session_reuse;
+	t->sni = cfg->sni;
+
+	t->ctx = SSL_CTX_new(SSLv23_client_method());
+	if (t->ctx == NULL) {
+		fprintf(stderr, "%s: SSL_CTX_new failed\n", __func__);
+		goto error;
+	}
+
+	/* It's a load generator; don't verify the server */
+	SSL_CTX_set_verify(t->ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_info_callback(t->ctx, clt_tls_info_cb);
+
+	if (! cfg->tickets)
+		SSL_CTX_set_options(t->ctx, SSL_OP_NO_TICKET);
+
+	/*
+	 * Client side session caching; sessions are kept by us via
+	 * the new session callback rather than in the SSL_CTX.
+	 */
+	if (cfg->session_reuse) {
+		SSL_CTX_set_session_cache_mode(t->ctx,
+		    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(t->ctx, clt_tls_new_session_cb);
+	} else {
+		SSL_CTX_set_session_cache_mode(t->ctx, SSL_SESS_CACHE_OFF);
+	}
+
+	if (cfg->ciphers != NULL) {
+		/*
+		 * The same list is offered for both; either may
+		 * reject it as long as the other accepts it.
+		 */
+		int ok = SSL_CTX_set_cipher_list(t->ctx, cfg->ciphers);
+#ifdef	TLS1_3_VERSION
+		ok |= SSL_CTX_set_ciphersuites(t->ctx, cfg->ciphers);
+#endif
+		if (! ok) {
+			fprintf(stderr, "%s: invalid cipher list (%s)\n",
+			    __func__, cfg->ciphers);
+			goto error;
+		}
+	}
+
+	if (cfg->alpn != NULL && clt_tls_set_alpn(t->ctx, cfg->alpn) != 0) {
+		fprintf(stderr, "%s: invalid ALPN list (%s)\n",
+		    __func__, cfg->alpn);
+		goto error;
+	}
+
+	return (t);
+
+error:
+	clt_tls_free(t);
+	return (NULL);
+}
+
+void
+clt_tls_free(struct clt_tls *t)
+{
+	int i;
+
+	if (t == NULL)
+		return;
+	for (i = 0; i < CLT_TLS_SESS_MAX; i++) {
+		if (t->sess[i] != NULL)
+			SSL_SESSION_free(t->sess[i]);
+	}
+	if (t->ctx != NULL)
+		SSL_CTX_free(t->ctx);
+	free(t);
+}
+
+/*
+ * Set up a new client SSL before its handshake starts: attach the
+ * owning request, SNI and any cached session for the destination.
+ *
+ * evhtp_connection_ssl_new() only starts the handshake once the
+ * TCP connect completes from the event loop, so this is early
+ * enough.
+ */
+int
+clt_tls_conn_setup(struct clt_tls *t, SSL *ssl, struct client_req *req)
+{
+
+	req->tls_hs_state = CLT_TLS_HS_NONE;
+	req->tls_hs_start = 0;
+	if (SSL_set_ex_data(ssl, clt_tls_ex_idx, req) != 1)
+		return (-1);
+
+	if (t->sni != NULL)
+		(void) SSL_set_tlsext_host_name(ssl, t->sni);
+
+	if (t->session_reuse && req->dst_idx >= 0 &&
+	    req->dst_idx < CLT_TLS_SESS_MAX &&
+	    t->sess[req->dst_idx] != NULL) {
+		if (SSL_set_session(ssl, t->sess[req->dst_idx]) != 1)
+			return (-1);
+	}
+
+	return (0);
+}
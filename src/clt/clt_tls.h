@@ -0,0 +1,51 @@
+#ifndef	__CLT_TLS_H__
+#define	__CLT_TLS_H__
+
+/*
+ * Per-thread client TLS state.
+ *
+ * Each worker thread gets its own SSL_CTX, so the session cache
+ * and handshake accounting need no locking.  The session cache is
+ * a single most-recent session per destination slot, which is what
+ * a real client talking to a handful of servers would hold.
+ */
+/* One per destination; matches CFG_IPV4_ARRAY_MAX */
+#define	CLT_TLS_SESS_MAX	16
+
+struct clt_tls_cfg {
+	/* Resume sessions from the per-thread cache? */
+	int session_reuse;
+
+	/* Allow session tickets (else session-id resumption only) */
+	int tickets;
+
+	/* Cipher list / TLS 1.3 ciphersuites; NULL for the default */
+	const char *ciphers;
+
+	/* Comma separated ALPN protocol list; NULL for none */
+	const char *alpn;
+
+	/* SNI hostname; NULL for none */
+	const char *sni;
+};
+
+struct clt_tls {
+	SSL_CTX *ctx;
+	int session_reuse;
+	const char *sni;
+
+	/* Most recent session per destination */
+	SSL_SESSION *sess[CLT_TLS_SESS_MAX];
+
+	/* Handshake counters and latency go here */
+	struct mgr_stats *stats;
+};
+
+extern	struct clt_tls * clt_tls_new(const struct clt_tls_cfg *cfg,
+	    struct mgr_stats *stats);
+extern	void clt_tls_free(struct clt_tls *t);
+extern	int clt_tls_conn_setup(struct clt_tls *t, SSL *ssl,
+	    struct client_req *req);
+extern	void clt_tls_conn_fini(struct clt_tls *t, struct client_req *req);
+
+#endif	/* __CLT_TLS_H__ */
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "rng.h"
+#include "dist.h"
+
+struct dist_type_map {
+	const char *name;
+	dist_type_t type;
+	int nargs_min;
+	int nargs_max;
+};
+
+static const struct dist_type_map dist_types[] = {
+	{ "const", DIST_CONST, 1, 1 },
+	{ "uniform", DIST_UNIFORM, 2, 2 },
+	{ "exp", DIST_EXP, 1, 2 },
+	{ "lognormal", DIST_LOGNORMAL, 2, 3 },
+	{ "pareto", DIST_PARETO, 2, 3 },
+	{ NULL, 0, 0, 0 }
+};
+
+/*
+ * Parse a number with an optional k/m/g suffix.
+ */
+static int
+dist_parse_num(const char *s, size_t len, double *v)
+{
+	char buf[64];
+	char *ep;
+	double d;
+
+	if (len == 0 || len >= sizeof(buf))
+		return (-1);
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+
+	d = strtod(buf, &ep);
+	switch (*ep) {
+	case 'k':
+	case 'K':
+		d *= 1024.0;
+		ep++;
+		break;
+	case 'm':
+	case 'M':
+		d *= 1024.0 * 1024.0;
+		ep++;
+		break;
+	case 'g':
+	case 'G':
+		d *= 1024.0 * 1024.0 * 1024.0;
+		ep++;
+		break;
+	default:
+		break;
+	}
+	if (ep == buf || *ep != '\0' || d < 0.0)
+		return (-1);
+	*v = d;
+	return (0);
+}
+
+const char *
+dist_type_str(dist_type_t type)
+{
+	int i;
+
+	for (i = 0; dist_types[i].name != NULL; i++) {
+		if (dist_types[i].type == type)
+			return (dist_types[i].name);
+	}
+	return ("unknown");
+}
+
+int
+dist_parse(struct dist *d, const char *str)
+{
+	const struct dist_type_map *tm;
+	const char *p, *e;
+	double args[3];
+	int i, n;
+
+	bzero(d, sizeof(*d));
+	d->max = UINT64_MAX;
+
+	/* A bare number is a constant */
+	p = strchr(str, ':');
+	if (p == NULL) {
+		if (dist_parse_num(str, strlen(str), &d->a) != 0)
+			return (-1);
+		d->type = DIST_CONST;
+		return (0);
+	}
+
+	for (i = 0; dist_types[i].name != NULL; i++) {
+		if (strlen(dist_types[i].name) == (size_t) (p - str) &&
+		    strncasecmp(dist_types[i].name, str, p - str) == 0)
+			break;
+	}
+	tm = &dist_types[i];
+	if (tm->name == NULL)
+		return (-1);
+
+	/* Comma separated arguments */
+	n = 0;
+	for (p = p + 1; ; p = e + 1) {
+		e = strchr(p, ',');
+		if (e == NULL)
+			e = p + strlen(p);
+		if (n >= tm->nargs_max)
+			return (-1);
+		if (dist_parse_num(p, e - p, &args[n]) != 0)
+			return (-1);
+		n++;
+		if (*e == '\0')
+			break;
+	}
+	if (n < tm->nargs_min)
+		return (-1);
+
+	d->type = tm->type;
+	d->a = args[0];
+	if (n > 1)
+		d->b = args[1];
+
+	switch (d->type) {
+	case DIST_UNIFORM:
+		if (d->b < d->a)
+			return (-1);
+		break;
+	case DIST_EXP:
+		if (n > 1)
+			d->max = (uint64_t) args[1];
+		break;
+	case DIST_LOGNORMAL:
+	case DIST_PARETO:
+		if (d->b <= 0.0)
+			return (-1);
+		if (n > 2)
+			d->max = (uint64_t) args[2];
+		break;
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+/*
+ * Standard normal deviate via Box-Muller; the second value is
+ * thrown away rather than cached to keep struct dist read-only.
+ */
+static double
+dist_normal(struct rng *r)
+{
+	double u1, u2;
+
+	do {
+		u1 = rng_double(r);
+	} while (u1 <= 0.0);
+	u2 = rng_double(r);
+
+	return (sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+}
+
+uint64_t
+dist_sample(const struct dist *d, struct rng *r)
+{
+	double v, u;
+	uint64_t range;
+
+	switch (d->type) {
+	case DIST_CONST:
+		return ((uint64_t) d->a);
+	case DIST_UNIFORM:
+		range = (uint64_t) d->b - (uint64_t) d->a + 1;
+		if (range == 0)
+			return (rng_next(r));
+		return ((uint64_t) d->a + rng_next(r) % range);
+	case DIST_EXP:
+		do {
+			u = rng_double(r);
+		} while (u <= 0.0);
+		v = -d->a * log(u);
+		break;
+	case DIST_LOGNORMAL:
+		/* a is the median, b the log-space standard deviation */
+		v = d->a * exp(d->b * dist_normal(r));
+		break;
+	case DIST_PARETO:
+		do {
+			u = rng_double(r);
+		} while (u <= 0.0);
+		v = d->a / pow(u, 1.0 / d->b);
+		break;
+	default:
+		return (0);
+	}
+
+	if (v >= (double) d->max)
+		return (d->max);
+	return ((uint64_t) v);
+}
@@ -0,0 +1,36 @@
+#ifndef	__DIST_H__
+#define	__DIST_H__
+
+/*
+ * A parsed random distribution, sampled with the per-thread PRNG.
+ *
+ * The textual form is "<type>:<args>", eg "lognormal:16k,2.0";
+ * a bare number is a constant.  Numbers accept k/m/g suffixes
+ * (powers of 1024.)
+ *
+ * + const:n
+ * + uniform:lo,hi		- integers in [lo, hi]
+ * + exp:mean[,max]
+ * + lognormal:median,sigma[,max]
+ * + pareto:min,alpha[,max]
+ */
+typedef enum {
+	DIST_CONST,
+	DIST_UNIFORM,
+	DIST_EXP,
+	DIST_LOGNORMAL,
+	DIST_PARETO,
+} dist_type_t;
+
+struct dist {
+	dist_type_t type;
+	double a;
+	double b;
+	uint64_t max;
+};
+
+extern	int dist_parse(struct dist *d, const char *str);
+extern	uint64_t dist_sample(const struct dist *d, struct rng *r);
+extern	const char *dist_type_str(dist_type_t type);
+
+#endif	/* __DIST_H__ */
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "hist.h"
+#include "mgr_stats.h"
+#include "findmax.h"
+
+/*
+ * Parse a time with a us, ms (default) or s suffix.
+ */
+int
+findmax_parse_usec(const char *str, uint64_t *usec)
+{
+	char *ep;
+	double d;
+
+	d = strtod(str, &ep);
+	if (ep == str || d <= 0.0)
+		return (-1);
+	if (strcmp(ep, "us") == 0)
+		;
+	else if (strcmp(ep, "ms") == 0 || *ep == '\0')
+		d *= 1000.0;
+	else if (strcmp(ep, "s") == 0)
+		d *= 1000000.0;
+	else
+		return (-1);
+	*usec = (uint64_t) d;
+	return (*usec > 0 ? 0 : -1);
+}
+
+int
+findmax_init(struct findmax *fm, double start_rate, uint64_t slo_p99_usec,
+    uint64_t window_usec, uint64_t now_usec)
+{
+
+	bzero(fm, sizeof(*fm));
+	fm->base = calloc(1, sizeof(*fm->base));
+	fm->diff = calloc(1, sizeof(*fm->diff));
+	if (fm->base == NULL || fm->diff == NULL) {
+		warn("%s: calloc", __func__);
+		findmax_free(fm);
+		return (-1);
+	}
+	fm->slo_p99_usec = slo_p99_usec;
+	fm->window_usec = window_usec;
+	fm->state = FINDMAX_STATE_GROW;
+	fm->rate = start_rate;
+	fm->probe_start_usec = now_usec;
+	return (0);
+}
+
+void
+findmax_free(struct findmax *fm)
+{
+
+	free(fm->base);
+	free(fm->diff);
+	fm->base = NULL;
+	fm->diff = NULL;
+}
+
+/*
+ * Score the probe that just finished.
+ */
+static void
+findmax_probe_finish(struct findmax *fm, uint64_t now_usec,
+    const struct mgr_stats *stats)
+{
+	struct findmax_probe *pr = &fm->probes[fm->nprobes++];
+	const struct mgr_stats *d = fm->diff;
+	uint64_t done, errs;
+	double secs;
+
+	mgr_stats_diff(fm->base, stats, fm->diff);
+	secs = (double) (now_usec - fm->measure_start_usec) / 1000000.0;
+	done = d->req_count_ok + d->req_count_err + d->req_count_timeout;
+	errs = d->req_count_err + d->req_count_timeout + d->req_count_create_err;
+
+	pr->rate = fm->rate;
+	pr->achieved = secs > 0.0 ? (double) done / secs : 0.0;
+	pr->err_pct = (done + d->req_count_create_err) > 0 ?
+	    100.0 * (double) errs /
+	    (double) (done + d->req_count_create_err) : 0.0;
+	pr->p50 = hist_percentile(&d->req_latency_usec, 50.0);
+	pr->p90 = hist_percentile(&d->req_latency_usec, 90.0);
+	pr->p99 = hist_percentile(&d->req_latency_usec, 99.0);
+	pr->p999 = hist_percentile(&d->req_latency_usec, 99.9);
+	pr->pass = done > 0 &&
+	    pr->p99 <= fm->slo_p99_usec &&
+	    pr->err_pct <= FINDMAX_MAX_ERR_PCT &&
+	    pr->achieved >= pr->rate * FINDMAX_MIN_ACHIEVED_PCT / 100.0;
+
+	printf("find-max: probe %d: rate=%.0f/sec, achieved=%.1f/sec, "
+	    "p99=%llu usec, errors=%.2f%%: %s\n",
+	    fm->nprobes, pr->rate, pr->achieved,
+	    (unsigned long long) pr->p99, pr->err_pct,
+	    pr->pass ? "pass" : "FAIL");
+}
+
+/*
+ * Pick the next rate to probe; returns -1 once the search is done.
+ */
+static int
+findmax_next(struct findmax *fm)
+{
+	const struct findmax_probe *pr = &fm->probes[fm->nprobes - 1];
+
+	if (pr->pass) {
+		if (pr->rate > fm->lo)
+			fm->lo = pr->rate;
+	} else {
+		if (fm->hi == 0.0 || pr->rate < fm->hi)
+			fm->hi = pr->rate;
+	}
+
+	if (fm->nprobes >= FINDMAX_PROBES_MAX)
+		return (-1);
+
+	if (fm->state == FINDMAX_STATE_GROW) {
+		if (pr->pass) {
+			fm->rate *= 2.0;
+			return (0);
+		}
+		fm->state = FINDMAX_STATE_BISECT;
+	}
+
+	/* Close enough, or nothing passes even at a trickle? */
+	if (fm->hi - fm->lo <= fm->hi * FINDMAX_RESOLUTION_PCT / 100.0 ||
+	    fm->hi < 2.0)
+		return (-1);
+	fm->rate = (fm->lo + fm->hi) / 2.0;
+	return (0);
+}
+
+/*
+ * Called each stats interval with the summed worker stats.
+ *
+ * Returns 1 if the rate (fm->rate) should change, 0 if not, and -1
+ * once the search has finished.
+ */
+int
+findmax_tick(struct findmax *fm, uint64_t now_usec,
+    const struct mgr_stats *stats)
+{
+
+	if (fm->state == FINDMAX_STATE_DONE)
+		return (-1);
+
+	/* Still warming up */
+	if (now_usec < fm->probe_start_usec)
+		return (0);
+
+	/* Let the new rate settle before taking the baseline */
+	if (! fm->measuring) {
+		if (now_usec - fm->probe_start_usec < fm->window_usec / 4)
+			return (0);
+		mgr_stats_copy(stats, fm->base);
+		fm->measure_start_usec = now_usec;
+		fm->measuring = 1;
+		return (0);
+	}
+	if (now_usec - fm->probe_start_usec < fm->window_usec)
+		return (0);
+
+	findmax_probe_finish(fm, now_usec, stats);
+	if (findmax_next(fm) != 0) {
+		fm->state = FINDMAX_STATE_DONE;
+		return (-1);
+	}
+
+	fm->probe_start_usec = now_usec;
+	fm->measuring = 0;
+	return (1);
+}
+
+void
+findmax_report(const struct findmax *fm, FILE *fp)
+{
+	const struct findmax_probe *pr;
+	int i;
+
+	fprintf(fp, "find-max report (SLO: p99 <= %llu usec, errors <= %.1f%%)\n",
+	    (unsigned long long) fm->slo_p99_usec, FINDMAX_MAX_ERR_PCT);
+	fprintf(fp, "%5s %10s %10s %7s %9s %9s %9s %9s %s\n",
+	    "probe", "rate", "achieved", "err%", "p50", "p90", "p99", "p999",
+	    "result");
+	for (i = 0; i < fm->nprobes; i++) {
+		pr = &fm->probes[i];
+		fprintf(fp, "%5d %10.0f %10.1f %7.2f %9llu %9llu %9llu %9llu %s\n",
+		    i + 1, pr->rate, pr->achieved, pr->err_pct,
+		    (unsigned long long) pr->p50,
+		    (unsigned long long) pr->p90,
+		    (unsigned long long) pr->p99,
+		    (unsigned long long) pr->p999,
+		    pr->pass ? "pass" : "FAIL");
+	}
+	if (fm->lo > 0.0)
+		fprintf(fp, "find-max: highest rate within SLO: %.0f/sec\n",
+		    fm->lo);
+	else
+		fprintf(fp, "find-max: no probed rate met the SLO\n");
+}
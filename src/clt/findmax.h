@@ -0,0 +1,71 @@
+#ifndef	__FINDMAX_H__
+#define	__FINDMAX_H__
+
+/*
+ * Saturation finder: search for the highest request rate the server
+ * sustains within a p99 latency SLO.
+ *
+ * Each probe runs at one rate for a measurement window; the first
+ * quarter of the window is left for things to settle.  A probe
+ * passes if the interval p99 is within the SLO, the error rate is
+ * within FINDMAX_MAX_ERR_PCT and the achieved rate is at least
+ * FINDMAX_MIN_ACHIEVED_PCT of the target (ie, the server kept up.)
+ *
+ * The rate doubles until a probe fails, then it binary searches
+ * between the best pass and the lowest failure until they're within
+ * FINDMAX_RESOLUTION_PCT of each other.
+ *
+ * It's driven from the stats thread: findmax_tick() is handed the
+ * summed worker stats every interval and says when to change rate.
+ */
+#define	FINDMAX_PROBES_MAX		64
+#define	FINDMAX_MAX_ERR_PCT		1.0
+#define	FINDMAX_MIN_ACHIEVED_PCT	90.0
+#define	FINDMAX_RESOLUTION_PCT		2.0
+
+typedef enum {
+	FINDMAX_STATE_GROW,
+	FINDMAX_STATE_BISECT,
+	FINDMAX_STATE_DONE,
+} findmax_state_t;
+
+struct findmax_probe {
+	double rate;
+	double achieved;
+	double err_pct;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	int pass;
+};
+
+struct findmax {
+	uint64_t slo_p99_usec;
+	uint64_t window_usec;
+
+	findmax_state_t state;
+	double rate;
+	double lo;		/* best passing rate, 0 if none yet */
+	double hi;		/* lowest failing rate, 0 if none yet */
+
+	/* The current probe: when it started, and its baseline */
+	uint64_t probe_start_usec;
+	uint64_t measure_start_usec;
+	int measuring;
+	struct mgr_stats *base;
+	struct mgr_stats *diff;
+
+	struct findmax_probe probes[FINDMAX_PROBES_MAX];
+	int nprobes;
+};
+
+extern	int findmax_parse_usec(const char *str, uint64_t *usec);
+extern	int findmax_init(struct findmax *fm, double start_rate,
+	    uint64_t slo_p99_usec, uint64_t window_usec, uint64_t now_usec);
+extern	int findmax_tick(struct findmax *fm, uint64_t now_usec,
+	    const struct mgr_stats *stats);
+extern	void findmax_report(const struct findmax *fm, FILE *fp);
+extern	void findmax_free(struct findmax *fm);
+
+#endif	/* __FINDMAX_H__ */
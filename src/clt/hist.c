@@ -0,0 +1,106 @@
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+#define	HIST_SUB_COUNT		(1 << HIST_SUB_BITS)
+
+static int
+hist_bucket(uint64_t v)
+{
+	int msb, shift, b;
+
+	if (v < HIST_SUB_COUNT)
+		return ((int) v);
+
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - HIST_SUB_BITS;
+	b = ((shift + 1) << HIST_SUB_BITS) +
+	    (int) ((v >> shift) & (HIST_SUB_COUNT - 1));
+	if (b >= HIST_NBUCKETS)
+		b = HIST_NBUCKETS - 1;
+	return (b);
+}
+
+/*
+ * The largest value that lands in the given bucket.
+ */
+static uint64_t
+hist_bucket_max(int b)
+{
+	int shift;
+
+	if (b < HIST_SUB_COUNT)
+		return ((uint64_t) b);
+
+	shift = (b >> HIST_SUB_BITS) - 1;
+	return ((((uint64_t) (HIST_SUB_COUNT + (b & (HIST_SUB_COUNT - 1))) + 1)
+	    << shift) - 1);
+}
+
+void
+hist_add(struct hist *h, uint64_t v)
+{
+
+	h->b[hist_bucket(v)]++;
+	h->count++;
+	h->sum += v;
+}
+
+void
+hist_diff(const struct hist *hfrom, const struct hist *hto, struct hist *res)
+{
+	int i;
+
+	res->count = hto->count - hfrom->count;
+	res->sum = hto->sum - hfrom->sum;
+	for (i = 0; i < HIST_NBUCKETS; i++)
+		res->b[i] = hto->b[i] - hfrom->b[i];
+}
+
+void
+hist_sum(const struct hist *hfrom, struct hist *hto)
+{
+	int i;
+
+	hto->count += hfrom->count;
+	hto->sum += hfrom->sum;
+	for (i = 0; i < HIST_NBUCKETS; i++)
+		hto->b[i] += hfrom->b[i];
+}
+
+/*
+ * Return the value at the given percentile (0..100), as the upper
+ * bound of the bucket it falls in; 0 if the histogram is empty.
+ */
+uint64_t
+hist_percentile(const struct hist *h, double pct)
+{
+	uint64_t target, n = 0;
+	int i;
+
+	if (h->count == 0)
+		return (0);
+
+	target = (uint64_t) ((pct / 100.0) * (double) h->count + 0.5);
+	if (target < 1)
+		target = 1;
+	if (target > h->count)
+		target = h->count;
+
+	for (i = 0; i < HIST_NBUCKETS; i++) {
+		n += h->b[i];
+		if (n >= target)
+			return (hist_bucket_max(i));
+	}
+	return (hist_bucket_max(HIST_NBUCKETS - 1));
+}
+
+uint64_t
+hist_mean(const struct hist *h)
+{
+
+	if (h->count == 0)
+		return (0);
+	return (h->sum / h->count);
+}
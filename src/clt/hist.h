@@ -0,0 +1,32 @@
+#ifndef	__HIST_H__
+#define	__HIST_H__
+
+/*
+ * A log-linear histogram of (usually microsecond) values.
+ *
+ * Values below 2^HIST_SUB_BITS get a bucket each; above that each
+ * power of two is split into 2^HIST_SUB_BITS linear buckets, so the
+ * relative error is at most 1/2^HIST_SUB_BITS.  Values of
+ * 2^HIST_MAX_BITS or more land in the last bucket.
+ *
+ * It's a flat array of counters so it can be copied, diffed and
+ * summed like the rest of struct mgr_stats.
+ */
+#define	HIST_SUB_BITS		3
+#define	HIST_MAX_BITS		40
+#define	HIST_NBUCKETS		((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t b[HIST_NBUCKETS];
+};
+
+extern	void hist_add(struct hist *h, uint64_t v);
+extern	void hist_diff(const struct hist *hfrom, const struct hist *hto,
+	    struct hist *res);
+extern	void hist_sum(const struct hist *hfrom, struct hist *hto);
+extern	uint64_t hist_percentile(const struct hist *h, double pct);
+extern	uint64_t hist_mean(const struct hist *h);
+
+#endif	/* __HIST_H__ */
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <err.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <event2/event.h>
+#if LIBEVENT_VERSION_NUMBER >= 0x02020000
+#include <event2/watch.h>
+#endif
+
+#include "hist.h"
+#include "mgr_stats.h"
+#include "mtime.h"
+#include "loopmon.h"
+
+static uint64_t
+loopmon_thread_cpu_usec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return (0);
+	return ((uint64_t) ts.tv_sec * 1000000ULL +
+	    (uint64_t) ts.tv_nsec / 1000ULL);
+}
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02020000
+/*
+ * About to wait for events: everything since the last check was
+ * callbacks.
+ */
+static void
+loopmon_prepare_cb(struct evwatch *w,
+    const struct evwatch_prepare_cb_info *info, void *arg)
+{
+	struct loopmon *lm = arg;
+	uint64_t now;
+
+	now = mtime_now_usec();
+	if (lm->check_usec != 0)
+		lm->stats->loop_busy_usec += now - lm->check_usec;
+	lm->prepare_usec = now;
+}
+
+/*
+ * Back from waiting: count the iteration and the callbacks it's
+ * about to run.
+ */
+static void
+loopmon_check_cb(struct evwatch *w,
+    const struct evwatch_check_cb_info *info, void *arg)
+{
+	struct loopmon *lm = arg;
+	uint64_t now;
+
+	now = mtime_now_usec();
+	if (lm->prepare_usec != 0)
+		lm->stats->loop_wait_usec += now - lm->prepare_usec;
+	lm->check_usec = now;
+	lm->stats->loop_iterations++;
+	lm->stats->loop_callbacks += event_base_get_num_events(lm->base,
+	    EVENT_BASE_COUNT_ACTIVE);
+}
+#endif
+
+int
+loopmon_init(struct loopmon *lm, struct event_base *base,
+    struct mgr_stats *stats, uint64_t lag_warn_usec)
+{
+
+	bzero(lm, sizeof(*lm));
+	lm->base = base;
+	lm->stats = stats;
+	lm->lag_warn_usec = lag_warn_usec;
+	lm->cpu_usec = loopmon_thread_cpu_usec();
+	lm->wall_usec = mtime_now_usec();
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02020000
+	lm->w_prepare = evwatch_prepare_new(base, loopmon_prepare_cb, lm);
+	lm->w_check = evwatch_check_new(base, loopmon_check_cb, lm);
+	if (lm->w_prepare == NULL || lm->w_check == NULL) {
+		fprintf(stderr, "%s: evwatch_*_new failed\n", __func__);
+		loopmon_free(lm);
+		return (-1);
+	}
+	lm->have_watch = 1;
+#endif
+	return (0);
+}
+
+void
+loopmon_free(struct loopmon *lm)
+{
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02020000
+	if (lm->w_prepare != NULL)
+		evwatch_free(lm->w_prepare);
+	if (lm->w_check != NULL)
+		evwatch_free(lm->w_check);
+#endif
+	lm->w_prepare = NULL;
+	lm->w_check = NULL;
+	lm->have_watch = 0;
+}
+
+/*
+ * A pass of the event loop has finished; only counted here without
+ * the watchers.
+ */
+void
+loopmon_iteration(struct loopmon *lm)
+{
+
+	if (! lm->have_watch)
+		lm->stats->loop_iterations++;
+}
+
+/*
+ * A callback the caller can see has run; again, only counted here
+ * without the watchers.
+ */
+void
+loopmon_callback(struct loopmon *lm)
+{
+
+	if (! lm->have_watch)
+		lm->stats->loop_callbacks++;
+}
+
+/*
+ * The periodic timer has been (re)armed to fire at due_usec.
+ */
+void
+loopmon_timer_due(struct loopmon *lm, uint64_t due_usec)
+{
+
+	lm->due_usec = due_usec;
+}
+
+/*
+ * The periodic timer has fired: record how late, and without the
+ * watchers, the busy/wait split since last time.
+ */
+void
+loopmon_timer_fired(struct loopmon *lm, uint64_t now_usec)
+{
+	uint64_t lag, cpu, busy;
+
+	if (lm->due_usec != 0) {
+		lag = now_usec > lm->due_usec ? now_usec - lm->due_usec : 0;
+		hist_add(&lm->stats->loop_lag_usec, lag);
+		if (lag > lm->lag_warn_usec)
+			lm->stats->loop_lag_over++;
+	}
+
+	if (lm->have_watch)
+		return;
+	cpu = loopmon_thread_cpu_usec();
+	busy = cpu - lm->cpu_usec;
+	if (busy > now_usec - lm->wall_usec)
+		busy = now_usec - lm->wall_usec;
+	lm->stats->loop_busy_usec += busy;
+	lm->stats->loop_wait_usec += (now_usec - lm->wall_usec) - busy;
+	lm->cpu_usec = cpu;
+	lm->wall_usec = now_usec;
+}
@@ -0,0 +1,53 @@
+#ifndef	__LOOPMON_H__
+#define	__LOOPMON_H__
+
+/*
+ * Event loop health for a worker thread.
+ *
+ * A CPU bound client delays its own callbacks, and that delay ends
+ * up in the latencies it reports.  So each worker records:
+ *
+ * + how late its periodic timer fires (actual minus scheduled) - the
+ *   most direct measure of how far behind the loop is running;
+ * + time spent running callbacks versus waiting for events;
+ * + loop iterations and callbacks run.  With libevent 2.2's
+ *   prepare/check watchers these come from libevent.  Without them
+ *   (2.1) the worker runs the loop a pass at a time and counts the
+ *   passes, and callbacks are only the manager's own timer, request
+ *   and notify callbacks - libevhtp's internal socket callbacks
+ *   aren't seen, so it's a lower bound.  Busy time is then the
+ *   thread's CPU time, and the rest of the interval is waiting.
+ *
+ * Timer lag over the warning threshold counts as saturated.
+ */
+#define	LOOPMON_LAG_WARN_USEC_DEFAULT	(5 * 1000)
+
+struct loopmon {
+	struct event_base *base;
+	struct mgr_stats *stats;
+	uint64_t lag_warn_usec;
+
+	/* When the periodic timer was next due */
+	uint64_t due_usec;
+
+	/* Thread CPU time and wall clock at the last update */
+	uint64_t cpu_usec;
+	uint64_t wall_usec;
+
+	/* Prepare/check watchers, if libevent has them */
+	int have_watch;
+	void *w_prepare;
+	void *w_check;
+	uint64_t prepare_usec;
+	uint64_t check_usec;
+};
+
+extern	int loopmon_init(struct loopmon *lm, struct event_base *base,
+	    struct mgr_stats *stats, uint64_t lag_warn_usec);
+extern	void loopmon_timer_due(struct loopmon *lm, uint64_t due_usec);
+extern	void loopmon_timer_fired(struct loopmon *lm, uint64_t now_usec);
+extern	void loopmon_iteration(struct loopmon *lm);
+extern	void loopmon_callback(struct loopmon *lm);
+extern	void loopmon_free(struct loopmon *lm);
+
+#endif	/* __LOOPMON_H__ */
@@ -20,20 +20,61 @@
 
 #include <netinet/in.h>
 
+#include <openssl/ssl.h>
+
 #include <evhtp.h>
 
 #include "debug.h"
+#include "alloc_stats.h"
+#include "hist.h"
 #include "mgr_stats.h"
+#include "seqlock.h"
 #include "thr.h"
+#include "tw.h"
 #include "clt.h"
+#include "rng.h"
+#include "mtime.h"
+#include "budget.h"
+#include "profile.h"
+#include "dist.h"
+#include "uri_tmpl.h"
+#include "req_body.h"
+#include "trace.h"
 #include "mgr_config.h"
 #include "mgr.h"
+#include "stats_out.h"
+#include "findmax.h"
+#include "runctl.h"
+#include "loopmon.h"
 
 const char *malloc_conf = "junk:true";
 
 struct app {
 	struct clt_thr *th;
 	struct mgr_config cfg;
+
+	/* Shared request body buffer */
+	struct req_body body;
+
+	/* Trace being replayed, mapped once for all the workers */
+	struct trace trace;
+
+	/* Global budget the worker threads draw from */
+	struct budget budget;
+
+	/* Load profile; only used if cfg.profile points at it */
+	struct profile profile;
+
+	/* --find-max controller, run from the stats thread */
+	struct findmax fm;
+
+	/* Start barrier across the workers */
+	struct runctl runctl;
+
+	/* Time series stats export, and per-thread stats scratch */
+	struct stats_out so;
+	struct mgr_stats *thr_stats;
+	const char **thr_state;
 	unsigned int stats_thread_run;
 	pthread_t th_stats;
 	struct mgr_stats prev_stats;
@@ -51,6 +92,45 @@ mgr_config_defaults(struct mgr_config *cfg)
 	cfg->host_hdr = NULL;
 	cfg->port = -1;
 	cfg->uri = NULL;
+	cfg->trace_file = NULL;
+
+	/* GET with no body; POST if a body is configured */
+	cfg->http_method = -1;
+	cfg->body_size = NULL;
+	cfg->body_file = NULL;
+	cfg->body_chunked = 0;
+	cfg->body = NULL;
+
+	/* Cleartext by default; TLS resumes sessions with tickets */
+	cfg->tls = 0;
+	cfg->tls_session_reuse = 1;
+	cfg->tls_tickets = 1;
+	cfg->tls_ciphers = NULL;
+	cfg->tls_alpn = NULL;
+
+	/* Closed loop; open loop queues up to this many arrivals */
+	cfg->open_loop = CFG_OPEN_LOOP_NONE;
+	cfg->open_loop_backlog = 10000;
+
+	/* No stats export; once a second if enabled */
+	cfg->stats_out = NULL;
+	cfg->stats_format = STATS_OUT_FMT_CSV;
+	cfg->stats_interval_msec = 1000;
+
+	/* Fixed targets, no load profile */
+	cfg->profile = NULL;
+	cfg->profile_spec = NULL;
+
+	/* No saturation search; 5 second probes if there is */
+	cfg->find_max = 0;
+	cfg->slo_p99_usec = 0;
+	cfg->find_max_window_msec = 5000;
+
+	/* Fixed concurrency */
+	cfg->adaptive_conc = 0;
+
+	/* Plain round robin between destinations */
+	cfg->dst_policy = CFG_DST_POLICY_RR;
 
 	/* Default number of threads */
 	cfg->num_threads = 1;
@@ -58,6 +138,9 @@ mgr_config_defaults(struct mgr_config *cfg)
 	/* Default to as many requests as one can do */
 	cfg->target_request_rate = -1;
 
+	/* .. and as many new connections as one can open */
+	cfg->target_conn_rate = -1;
+
 	/* How many connections to keep open */
 	cfg->target_nconn = 128;
 
@@ -79,6 +162,10 @@ mgr_config_defaults(struct mgr_config *cfg)
 	/* Keepalive? (global for now) */
 	cfg->http_keepalive = 1;
 
+	/* Request timeouts; -1 to disable */
+	cfg->idle_timeout_msec = 5000;
+	cfg->request_timeout_msec = -1;
+
 	/*
 	 * How long to run the test for in RUNNING, before
 	 * we transition to WAITING regardless, or -1 for
@@ -86,6 +173,12 @@ mgr_config_defaults(struct mgr_config *cfg)
 	 */
 	cfg->running_period_sec = 30;
 
+	/* No warmup; count from the start */
+	cfg->warmup_period_sec = 0;
+
+	/* Warn about the client falling behind at 5ms timer lag */
+	cfg->loop_lag_warn_usec = LOOPMON_LAG_WARN_USEC_DEFAULT;
+
 	/*
 	 * How long to wait around during WAITING for connections
 	 * to finish and close
@@ -109,6 +202,34 @@ enum {
 	OPT_WAITING_PERIOD,
 	OPT_NUMBER_THREADS,
 	OPT_TARGET_REQUEST_RATE,
+	OPT_HEADER,
+	OPT_IDLE_TIMEOUT_MSEC,
+	OPT_REQUEST_TIMEOUT_MSEC,
+	OPT_SRC_IP,
+	OPT_DST_POLICY,
+	OPT_TRACE,
+	OPT_METHOD,
+	OPT_BODY_SIZE,
+	OPT_BODY_FILE,
+	OPT_BODY_CHUNKED,
+	OPT_TLS,
+	OPT_TLS_SESSION_REUSE,
+	OPT_TLS_TICKETS,
+	OPT_TLS_CIPHERS,
+	OPT_TLS_ALPN,
+	OPT_OPEN_LOOP,
+	OPT_OPEN_LOOP_BACKLOG,
+	OPT_TARGET_CONN_RATE,
+	OPT_STATS_OUT,
+	OPT_STATS_FORMAT,
+	OPT_STATS_INTERVAL_MSEC,
+	OPT_PROFILE,
+	OPT_FIND_MAX,
+	OPT_SLO_P99,
+	OPT_FIND_MAX_WINDOW_MSEC,
+	OPT_ADAPTIVE_CONCURRENCY,
+	OPT_WARMUP_PERIOD,
+	OPT_LOOP_LAG_WARN_MSEC,
 };
 
 static struct option longopts[] = {
@@ -125,8 +246,36 @@ static struct option longopts[] = {
 	{ "http-keepalive", required_argument, NULL, OPT_HTTP_KEEPALIVE },
 	{ "running-period", required_argument, NULL, OPT_RUNNING_PERIOD },
 	{ "waiting-period", required_argument, NULL, OPT_WAITING_PERIOD },
+	{ "warmup-period", required_argument, NULL, OPT_WARMUP_PERIOD },
+	{ "loop-lag-warn-msec", required_argument, NULL, OPT_LOOP_LAG_WARN_MSEC },
 	{ "number-threads", required_argument, NULL, OPT_NUMBER_THREADS },
 	{ "target-request-rate", required_argument, NULL, OPT_TARGET_REQUEST_RATE },
+	{ "target-conn-rate", required_argument, NULL, OPT_TARGET_CONN_RATE },
+	{ "header", required_argument, NULL, OPT_HEADER },
+	{ "idle-timeout-msec", required_argument, NULL, OPT_IDLE_TIMEOUT_MSEC },
+	{ "request-timeout-msec", required_argument, NULL, OPT_REQUEST_TIMEOUT_MSEC },
+	{ "src-ip", required_argument, NULL, OPT_SRC_IP },
+	{ "dst-policy", required_argument, NULL, OPT_DST_POLICY },
+	{ "trace", required_argument, NULL, OPT_TRACE },
+	{ "method", required_argument, NULL, OPT_METHOD },
+	{ "body-size", required_argument, NULL, OPT_BODY_SIZE },
+	{ "body-file", required_argument, NULL, OPT_BODY_FILE },
+	{ "body-chunked", required_argument, NULL, OPT_BODY_CHUNKED },
+	{ "tls", required_argument, NULL, OPT_TLS },
+	{ "tls-session-reuse", required_argument, NULL, OPT_TLS_SESSION_REUSE },
+	{ "tls-tickets", required_argument, NULL, OPT_TLS_TICKETS },
+	{ "tls-ciphers", required_argument, NULL, OPT_TLS_CIPHERS },
+	{ "tls-alpn", required_argument, NULL, OPT_TLS_ALPN },
+	{ "open-loop", required_argument, NULL, OPT_OPEN_LOOP },
+	{ "open-loop-backlog", required_argument, NULL, OPT_OPEN_LOOP_BACKLOG },
+	{ "stats-out", required_argument, NULL, OPT_STATS_OUT },
+	{ "stats-format", required_argument, NULL, OPT_STATS_FORMAT },
+	{ "stats-interval-msec", required_argument, NULL, OPT_STATS_INTERVAL_MSEC },
+	{ "profile", required_argument, NULL, OPT_PROFILE },
+	{ "find-max", no_argument, NULL, OPT_FIND_MAX },
+	{ "slo-p99", required_argument, NULL, OPT_SLO_P99 },
+	{ "find-max-window-msec", required_argument, NULL, OPT_FIND_MAX_WINDOW_MSEC },
+	{ "adaptive-concurrency", no_argument, NULL, OPT_ADAPTIVE_CONCURRENCY },
 	{ "help", no_argument, NULL, 'h' },
 	{ NULL, 0, NULL, 0 },
 };
@@ -138,13 +287,19 @@ usage(char *progname)
 	printf("  %s --host-ip=<host ipv4> --port=<port> --uri=<uri>\n", progname);
 	printf("\n");
 	printf("  Required options:\n");
-	printf("    host-ip: ipv4 address\n");
+	printf("    host-ip: ipv4 address, optionally with a weight (eg 10.0.0.1:3)\n");
 	printf("    port: HTTP port\n");
-	printf("    uri: URI path (eg /size)\n");
+	printf("    uri: URI path (eg /size); not needed with --trace\n");
+	printf("      may contain {seq}, {tid} or {<dist>} substitutions, eg\n");
+	printf("      /size?size={lognormal:16k,2.0,1m}&id={seq}; <dist> is one of\n");
+	printf("      <n>, uniform:lo,hi, exp:mean[,max], lognormal:median,sigma[,max],\n");
+	printf("      pareto:min,alpha[,max]\n");
 	printf("\n");
 	printf("  Optional options:\n");
-	printf("    (multiple --host-ip=<addr> can be added to randomly select between each)\n");
+	printf("    (multiple --host-ip=<addr> can be added to select between each)\n");
+	printf("    --dst-policy=<rr|random|weighted|least-outstanding|p2c; how to pick a host-ip>\n");
 	printf("    --host-hdr=<host header; defaults to ipv4 address>\n");
+	printf("    --src-ip=<local ipv4 address to connect from; may be repeated>\n");
 	printf("    --number-threads=<number of worker threads>\n");
 	printf("    --target-nconn=<target number of concurrent connections>\n");
 	printf("    --burst-conn=<how many connections to open every 10ms>\n");
@@ -155,7 +310,38 @@ usage(char *progname)
 	printf("    --http-keepalive=<1 to enable keepalive, 0 for none>\n");
 	printf("    --running-period=<how long to run in seconds, or -1 for no time period>\n");
 	printf("    --waiting-period=<how long to wait to cleanup in seconds>\n");
+	printf("    --warmup-period=<how long to apply load before counting it, in seconds>\n");
+	printf("        (warmup requests and connections still count towards\n");
+	printf("        --target-global-request-count and --target-total-nconn-count)\n");
+	printf("    --loop-lag-warn-msec=<event loop timer lag at which the client counts as saturated>\n");
 	printf( "   --target-request-rate=<how many requests/sec, or -1 for no limit>\n");
+	printf("    --target-conn-rate=<how many new connections/sec, or -1 for no limit (overrides --burst-conn)>\n");
+	printf("    --header=<\"Name: value\" extra request header; may be repeated>\n");
+	printf("    --trace=<binary trace file to replay instead of --uri>\n");
+	printf("    --method=<HTTP method; GET, or POST if a body is configured>\n");
+	printf("    --body-size=<request body size, or a distribution as for --uri; clamped to 64m>\n");
+	printf("    --body-file=<file to send as the request body>\n");
+	printf("    --body-chunked=<1 to send the body chunked, 0 for Content-Length>\n");
+	printf("    --tls=<1 to connect using TLS, 0 for cleartext>\n");
+	printf("    --tls-session-reuse=<1 to resume sessions from a per-thread cache, 0 for full handshakes>\n");
+	printf("    --tls-tickets=<1 to allow session tickets, 0 for session-id resumption only>\n");
+	printf("    --tls-ciphers=<OpenSSL cipher list/TLS 1.3 ciphersuites>\n");
+	printf("    --tls-alpn=<comma separated ALPN protocols, eg http/1.1>\n");
+	printf("    --open-loop=<none|const|poisson; issue --target-request-rate requests/sec on a schedule>\n");
+	printf("    --open-loop-backlog=<how many scheduled requests may wait for a connection>\n");
+	printf("    --idle-timeout-msec=<request idle timeout in msec, or -1 for none>\n");
+	printf("    --request-timeout-msec=<total request timeout in msec, or -1 for none>\n");
+	printf("    --stats-out=<file to write time series stats to>\n");
+	printf("    --stats-format=<csv|jsonl>\n");
+	printf("    --stats-interval-msec=<stats interval in msec; at least %d>\n",
+	    STATS_OUT_INTERVAL_MIN_MSEC);
+	printf("    --profile=<load profile, eg ramp:0-50000/60s,hold:50000/120s,step:+10000/30s*5;\n");
+	printf("               stages are ramp, hold, step and sine; replaces --running-period>\n");
+	printf("    --find-max - search for the highest request rate within --slo-p99\n");
+	printf("    --slo-p99=<p99 latency SLO, eg 20ms or 500us>\n");
+	printf("    --find-max-window-msec=<how long to run each find-max probe>\n");
+	printf("    --adaptive-concurrency - adjust connections from latency, up to --target-nconn,\n");
+	printf("               and report where throughput plateaus\n");
 	printf("    --help - this help\n");
 
 	return;
@@ -173,8 +359,146 @@ parse_opts(struct mgr_config *cfg, int argc, char *argv[])
 			return (-1);
 
 		case OPT_HOST_IP:
-			if (cfg_ipv4_array_add(&cfg->ipv4_dst, optarg) != 0) {
-				fprintf(stderr, "%s: too many ipv4_dst entries\n", __func__);
+			if (cfg_ipv4_array_add_weighted(&cfg->ipv4_dst, optarg) != 0) {
+				fprintf(stderr, "%s: invalid or too many ipv4_dst entries\n", __func__);
+				return (-1);
+			}
+			break;
+
+		case OPT_TRACE:
+			if (cfg->trace_file != NULL)
+				free(cfg->trace_file);
+			cfg->trace_file = strdup(optarg);
+			break;
+
+		case OPT_METHOD:
+		{
+			htp_method m;
+
+			if (clt_method_parse(optarg, &m) != 0) {
+				fprintf(stderr, "%s: unknown method (%s)\n",
+				    __func__, optarg);
+				return (-1);
+			}
+			cfg->http_method = m;
+			break;
+		}
+
+		case OPT_BODY_SIZE:
+			if (cfg->body_size != NULL)
+				free(cfg->body_size);
+			cfg->body_size = strdup(optarg);
+			break;
+
+		case OPT_BODY_FILE:
+			if (cfg->body_file != NULL)
+				free(cfg->body_file);
+			cfg->body_file = strdup(optarg);
+			break;
+
+		case OPT_BODY_CHUNKED:
+			cfg->body_chunked = atoi(optarg);
+			break;
+
+		case OPT_TLS:
+			cfg->tls = atoi(optarg);
+			break;
+
+		case OPT_TLS_SESSION_REUSE:
+			cfg->tls_session_reuse = atoi(optarg);
+			break;
+
+		case OPT_TLS_TICKETS:
+			cfg->tls_tickets = atoi(optarg);
+			break;
+
+		case OPT_TLS_CIPHERS:
+			if (cfg->tls_ciphers != NULL)
+				free(cfg->tls_ciphers);
+			cfg->tls_ciphers = strdup(optarg);
+			break;
+
+		case OPT_OPEN_LOOP:
+			if (cfg_open_loop_parse(optarg, &cfg->open_loop) != 0) {
+				fprintf(stderr, "%s: unknown open loop mode (%s)\n",
+				    __func__, optarg);
+				return (-1);
+			}
+			break;
+
+		case OPT_OPEN_LOOP_BACKLOG:
+			cfg->open_loop_backlog = atoi(optarg);
+			break;
+
+		case OPT_TLS_ALPN:
+			if (cfg->tls_alpn != NULL)
+				free(cfg->tls_alpn);
+			cfg->tls_alpn = strdup(optarg);
+			break;
+
+		case OPT_PROFILE:
+			if (cfg->profile_spec != NULL)
+				free(cfg->profile_spec);
+			cfg->profile_spec = strdup(optarg);
+			break;
+
+		case OPT_FIND_MAX:
+			cfg->find_max = 1;
+			break;
+
+		case OPT_ADAPTIVE_CONCURRENCY:
+			cfg->adaptive_conc = 1;
+			break;
+
+		case OPT_SLO_P99:
+			if (findmax_parse_usec(optarg, &cfg->slo_p99_usec) != 0) {
+				fprintf(stderr, "%s: invalid SLO (%s)\n",
+				    __func__, optarg);
+				return (-1);
+			}
+			break;
+
+		case OPT_FIND_MAX_WINDOW_MSEC:
+			cfg->find_max_window_msec = atoi(optarg);
+			if (cfg->find_max_window_msec < 1000) {
+				fprintf(stderr, "%s: find-max window must be at "
+				    "least 1000 msec\n", __func__);
+				return (-1);
+			}
+			break;
+
+		case OPT_STATS_OUT:
+			if (cfg->stats_out != NULL)
+				free(cfg->stats_out);
+			cfg->stats_out = strdup(optarg);
+			break;
+
+		case OPT_STATS_FORMAT:
+		{
+			stats_out_fmt_t f;
+
+			if (stats_out_fmt_parse(optarg, &f) != 0) {
+				fprintf(stderr, "%s: unknown stats format (%s)\n",
+				    __func__, optarg);
+				return (-1);
+			}
+			cfg->stats_format = f;
+			break;
+		}
+
+		case OPT_STATS_INTERVAL_MSEC:
+			cfg->stats_interval_msec = atoi(optarg);
+			if (cfg->stats_interval_msec < STATS_OUT_INTERVAL_MIN_MSEC) {
+				fprintf(stderr, "%s: stats interval must be at least "
+				    "%d msec\n", __func__, STATS_OUT_INTERVAL_MIN_MSEC);
+				return (-1);
+			}
+			break;
+
+		case OPT_DST_POLICY:
+			if (cfg_dst_policy_parse(optarg, &cfg->dst_policy) != 0) {
+				fprintf(stderr, "%s: unknown dst policy (%s)\n",
+				    __func__, optarg);
 				return (-1);
 			}
 			break;
@@ -227,6 +551,19 @@ parse_opts(struct mgr_config *cfg, int argc, char *argv[])
 			cfg->waiting_period_sec = atoi(optarg);
 			break;
 
+		case OPT_WARMUP_PERIOD:
+			cfg->warmup_period_sec = atoi(optarg);
+			break;
+
+		case OPT_LOOP_LAG_WARN_MSEC:
+			if (atoi(optarg) < 1) {
+				fprintf(stderr, "%s: loop lag threshold must be "
+				    "at least 1 msec\n", __func__);
+				return (-1);
+			}
+			cfg->loop_lag_warn_usec = (uint64_t) atoi(optarg) * 1000;
+			break;
+
 		case OPT_NUMBER_THREADS:
 			cfg->num_threads = atoi(optarg);
 			break;
@@ -235,6 +572,33 @@ parse_opts(struct mgr_config *cfg, int argc, char *argv[])
 			cfg->target_request_rate = atoi(optarg);
 			break;
 
+		case OPT_TARGET_CONN_RATE:
+			cfg->target_conn_rate = atoi(optarg);
+			break;
+
+		case OPT_HEADER:
+			if (cfg_hdr_array_add(&cfg->hdrs, optarg) != 0) {
+				fprintf(stderr, "%s: invalid header or too many headers (%s)\n",
+				    __func__, optarg);
+				return (-1);
+			}
+			break;
+
+		case OPT_IDLE_TIMEOUT_MSEC:
+			cfg->idle_timeout_msec = atoi(optarg);
+			break;
+
+		case OPT_REQUEST_TIMEOUT_MSEC:
+			cfg->request_timeout_msec = atoi(optarg);
+			break;
+
+		case OPT_SRC_IP:
+			if (cfg_ipv4_array_add(&cfg->ipv4_src, optarg) != 0) {
+				fprintf(stderr, "%s: too many ipv4_src entries\n", __func__);
+				return (-1);
+			}
+			break;
+
 		default:
 			usage(argv[0]);
 			return (-1);
@@ -243,10 +607,26 @@ parse_opts(struct mgr_config *cfg, int argc, char *argv[])
 	return (0);
 }
 
+/*
+ * Bytes over microseconds is conveniently MB/sec (10^6 bytes.)
+ */
+static double
+clt_mb_per_sec(uint64_t bytes, uint64_t usec)
+{
+
+	return ((double) bytes / (double) usec);
+}
+
+/*
+ * Print a set of stats; usec is the time they cover, for rates, or
+ * 0 to print only the counts.
+ */
 static void
-clt_mgr_stats_print(const char *prefix, const struct mgr_stats *stats)
+clt_mgr_stats_print(const char *prefix, const struct mgr_stats *stats,
+    uint64_t usec)
 {
 	struct timeval tv;
+	int i;
 
 	(void) gettimeofday(&tv, NULL);
 
@@ -266,31 +646,94 @@ clt_mgr_stats_print(const char *prefix, const struct mgr_stats *stats)
 	    (unsigned long long) stats->req_count_ok,
 	    (unsigned long long) stats->req_count_err,
 	    (unsigned long long) stats->req_count_timeout);
-	printf("200_OK: %llu, 302: %llu, Other: %llu\n",
-	    (unsigned long long) stats->req_statustype_200,
-	    (unsigned long long) stats->req_statustype_302,
-	    (unsigned long long) stats->req_statustype_other);
-}
-
-static void
-clt_mgr_stats_notify(struct clt_mgr *m, void *cbdata,
-    const struct mgr_stats *stats)
-{
-	struct clt_thr *thr = cbdata;
-	struct mgr_stats stats_diff;
-
-	/* Calculate diffs */
-	bzero(&stats_diff, sizeof(stats_diff));
-
-	pthread_mutex_lock(&thr->prev_stats_mtx);
-	mgr_stats_diff(&thr->prev_stats, stats, &stats_diff);
-
-	/* Store previous result */
-	mgr_stats_copy(stats, &thr->prev_stats);
-
-	pthread_mutex_unlock(&thr->prev_stats_mtx);
-
-	//clt_mgr_stats_print(m, &stats_diff);
+	printf("tx_bytes=%llu, body_tx=%llu, rx_hdr_bytes=%llu, "
+	    "rx_body_bytes=%llu, ",
+	    (unsigned long long) stats->req_bytes_sent,
+	    (unsigned long long) stats->req_body_bytes_sent,
+	    (unsigned long long) stats->resp_hdr_bytes,
+	    (unsigned long long) stats->resp_body_bytes);
+	if (usec > 0) {
+		printf("req/sec=%.1f, rx_MB/sec=%.2f (body %.2f), "
+		    "tx_MB/sec=%.2f, ",
+		    (double) stats->req_count * 1000000.0 / (double) usec,
+		    clt_mb_per_sec(stats->resp_hdr_bytes +
+		    stats->resp_body_bytes, usec),
+		    clt_mb_per_sec(stats->resp_body_bytes, usec),
+		    clt_mb_per_sec(stats->req_bytes_sent, usec));
+	}
+	printf("lat_usec p50=%llu p99=%llu p999=%llu, ",
+	    (unsigned long long) hist_percentile(&stats->req_latency_usec, 50.0),
+	    (unsigned long long) hist_percentile(&stats->req_latency_usec, 99.0),
+	    (unsigned long long) hist_percentile(&stats->req_latency_usec, 99.9));
+	if (stats->req_body_clamped > 0)
+		printf("body_clamped=%llu, ",
+		    (unsigned long long) stats->req_body_clamped);
+	if (stats->ol_scheduled > 0) {
+		printf("ol_scheduled=%llu, ol_backlog=%d, ol_dropped=%llu, ",
+		    (unsigned long long) stats->ol_scheduled,
+		    stats->ol_backlog,
+		    (unsigned long long) stats->ol_dropped);
+	}
+	if (stats->loop_busy_usec + stats->loop_wait_usec > 0) {
+		printf("loop_lag_usec p50=%llu p99=%llu max=%llu, "
+		    "loop_lag_over=%llu, loop_busy=%.1f%%, ",
+		    (unsigned long long) hist_percentile(&stats->loop_lag_usec, 50.0),
+		    (unsigned long long) hist_percentile(&stats->loop_lag_usec, 99.0),
+		    (unsigned long long) hist_percentile(&stats->loop_lag_usec, 100.0),
+		    (unsigned long long) stats->loop_lag_over,
+		    (double) stats->loop_busy_usec * 100.0 /
+		    (double) (stats->loop_busy_usec + stats->loop_wait_usec));
+		if (stats->loop_iterations > 0)
+			printf("loop_callbacks/iter=%.1f, ",
+			    (double) stats->loop_callbacks /
+			    (double) stats->loop_iterations);
+	}
+	if (stats->conc_limit > 0) {
+		printf("conc_limit=%d, conc_knee=%d, conc_knee_rate=%d, ",
+		    stats->conc_limit, stats->conc_knee,
+		    stats->conc_knee_rate);
+	}
+	if (stats->tls_hs_full + stats->tls_hs_resumed + stats->tls_hs_err > 0) {
+		printf("tls_full=%llu, tls_resumed=%llu, tls_err=%llu, "
+		    "tls_hs_usec p50=%llu p99=%llu, ",
+		    (unsigned long long) stats->tls_hs_full,
+		    (unsigned long long) stats->tls_hs_resumed,
+		    (unsigned long long) stats->tls_hs_err,
+		    (unsigned long long) hist_percentile(&stats->tls_hs_usec, 50.0),
+		    (unsigned long long) hist_percentile(&stats->tls_hs_usec, 99.0));
+	}
+	if (stats->err_connect_refused + stats->err_connect_timeout +
+	    stats->err_connect_other + stats->err_reset_headers +
+	    stats->err_reset_body + stats->err_timeout +
+	    stats->err_parse > 0) {
+		printf("errors: conn_refused=%llu conn_timeout=%llu "
+		    "conn_other=%llu reset_hdrs=%llu reset_body=%llu "
+		    "timeout=%llu parse=%llu, ",
+		    (unsigned long long) stats->err_connect_refused,
+		    (unsigned long long) stats->err_connect_timeout,
+		    (unsigned long long) stats->err_connect_other,
+		    (unsigned long long) stats->err_reset_headers,
+		    (unsigned long long) stats->err_reset_body,
+		    (unsigned long long) stats->err_timeout,
+		    (unsigned long long) stats->err_parse);
+	}
+	printf("1xx: %llu, 2xx: %llu, 3xx: %llu, 4xx: %llu, 5xx: %llu, "
+	    "Other: %llu",
+	    (unsigned long long) stats->req_status_class[1],
+	    (unsigned long long) stats->req_status_class[2],
+	    (unsigned long long) stats->req_status_class[3],
+	    (unsigned long long) stats->req_status_class[4],
+	    (unsigned long long) stats->req_status_class[5],
+	    (unsigned long long) stats->req_status_class[0]);
+
+	/* .. and the individual codes seen */
+	for (i = 0; i < MGR_STATS_STATUS_NUM; i++) {
+		if (stats->req_status[i] == 0)
+			continue;
+		printf(", %d: %llu", i + MGR_STATS_STATUS_MIN,
+		    (unsigned long long) stats->req_status[i]);
+	}
+	printf("\n");
 }
 
 static void *
@@ -304,36 +747,184 @@ clt_mgr_thread_run(void *arg)
 	(void) pthread_set_name_np(th->t_thr, buf);
 
 	/* Kick things off */
-	clt_mgr_start(th->t_m);
+	if (clt_mgr_start(th->t_m) != 0) {
+		fprintf(stderr, "%s: [%d] failed to start\n", __func__, th->t_tid);
+		/* Don't hold the others up at the start barrier */
+		runctl_arrive(th->t_m->cfg.runctl);
+		return (NULL);
+	}
 
 	/* Begin! */
-	event_base_loop(th->t_evbase, 0);
+	clt_mgr_run(th->t_m);
 
-	clt_mgr_stats_print(buf, &th->t_m->stats);
+	clt_mgr_stats_print(buf, &th->t_m->stats, 0);
+
+	/* Release pooled state before the event base goes away */
+	clt_mgr_free(th->t_m);
 
 	return (NULL);
 }
 
+/*
+ * Read the state and statistics each worker last published, and sum
+ * them.  The overall state is the least advanced worker's.
+ */
+static const char *
+app_stats_sum(struct app *a, struct mgr_stats *stats)
+{
+	struct mgr_stats s;
+	uint64_t gen = 0;
+	int i, state, min_state = CLT_MGR_STATE_COMPLETED;
+
+	for (i = 0; i < a->cfg.num_threads; i++) {
+		clt_thr_stats_read(&a->th[i], &state, &a->thr_stats[i]);
+		a->thr_state[i] = clt_mgr_state_str(state);
+		if (state < min_state)
+			min_state = state;
+		if (a->thr_stats[i].gen > gen)
+			gen = a->thr_stats[i].gen;
+	}
+
+	/*
+	 * Each worker resets its counters at the end of warmup on its
+	 * own timer, so a sample can land after some have and before
+	 * others.  Only count workers at the newest generation; the
+	 * rest are about to discard what they have.  That way the
+	 * total never mixes warmup and measured counts, and diffs see
+	 * the reset exactly once.
+	 */
+	bzero(stats, sizeof(*stats));
+	for (i = 0; i < a->cfg.num_threads; i++) {
+		if (a->thr_stats[i].gen == gen) {
+			mgr_stats_add(&a->thr_stats[i], stats);
+			continue;
+		}
+		/* Just the gauges */
+		mgr_stats_copy(&a->thr_stats[i], &s);
+		mgr_stats_reset(&s);
+		mgr_stats_add(&s, stats);
+	}
+	stats->gen = gen;
+	return (clt_mgr_state_str(min_state));
+}
+
+/*
+ * Tag for the active load profile stage, eg "2:step", or find-max
+ * probe; "" without either and "done" once it's finished.  Also
+ * returns the target request rate for now.
+ */
+static const char *
+app_profile_stage(struct app *a, uint64_t now, double *rate, char *buf,
+    size_t len)
+{
+	uint64_t start;
+	int i, nconn;
+
+	*rate = a->cfg.target_request_rate;
+	if (a->cfg.find_max) {
+		*rate = a->fm.rate;
+		if (a->fm.state == FINDMAX_STATE_DONE)
+			return ("done");
+		snprintf(buf, len, "probe:%d", a->fm.nprobes + 1);
+		return (buf);
+	}
+	if (a->cfg.profile == NULL)
+		return ("");
+	start = runctl_running_usec(&a->runctl);
+	i = profile_at(a->cfg.profile, start != 0 ? start : now, now, rate,
+	    &nconn);
+	if (i < 0)
+		return ("done");
+	snprintf(buf, len, "%d:%s", i,
+	    profile_stage_type_str(a->cfg.profile->stages[i].type));
+	return (buf);
+}
+
 static void *
 app_stats_thread(void *arg)
 {
 	struct app *a = arg;
 	struct mgr_stats stats, sdiff;
-	int i;
+	const char *state, *stage;
+	char stage_buf[32];
+	uint64_t now, last;
+	double rate;
+	int fm_started = 0;
 
+	last = mtime_now_usec();
 	while (atomic_load_acq_int(&a->stats_thread_run) == 1) {
-		sleep(1);
-		bzero(&stats, sizeof(stats));
-		bzero(&sdiff, sizeof(sdiff));
-		for (i = 0; i < a->cfg.num_threads; i++) {
-			pthread_mutex_lock(&a->th[i].prev_stats_mtx);
-			mgr_stats_add(&a->th[i].prev_stats, &stats);
-			pthread_mutex_unlock(&a->th[i].prev_stats_mtx);
+		usleep(a->cfg.stats_interval_msec * 1000);
+		now = mtime_now_usec();
+		state = app_stats_sum(a, &stats);
+
+		/* Step the saturation search; it may retarget the rate */
+		if (a->cfg.find_max && runctl_start_usec(&a->runctl) != 0) {
+			/* The first probe runs from when RUNNING starts */
+			if (! fm_started) {
+				a->fm.probe_start_usec =
+				    runctl_running_usec(&a->runctl);
+				fm_started = 1;
+			}
+			switch (findmax_tick(&a->fm, now, &stats)) {
+			case 1:
+				budget_bucket_set_rate(&a->budget.req_rate,
+				    (u_long) a->fm.rate, now);
+				break;
+			case -1:
+				budget_close(&a->budget);
+				break;
+			default:
+				break;
+			}
 		}
 
+		stage = app_profile_stage(a, now, &rate, stage_buf,
+		    sizeof(stage_buf));
+		stats_out_write(&a->so, now, state, stage, &stats, a->thr_state,
+		    a->thr_stats);
+
+		/* The console summary stays at about once a second */
+		if (now - last < 1000000)
+			continue;
+
+		bzero(&sdiff, sizeof(sdiff));
 		mgr_stats_diff(&a->prev_stats, &stats, &sdiff);
-		clt_mgr_stats_print("interval_total", &stats);
-		clt_mgr_stats_print("interval_diff", &sdiff);
+		clt_mgr_stats_print("interval_total", &stats, 0);
+		clt_mgr_stats_print("interval_diff", &sdiff,
+		    now > last ? now - last : 0);
+
+		if (a->cfg.profile != NULL || a->cfg.find_max)
+			printf("profile: stage=%s\n", stage);
+
+		/*
+		 * If the workers' own timers are running late, so is
+		 * everything else they do - including timestamping
+		 * responses.
+		 */
+		if (sdiff.loop_lag_over > 0) {
+			printf("WARNING: client saturated: event loop timer "
+			    "lag over %llu usec %llu times, p99 %llu usec; "
+			    "latencies include client delay\n",
+			    (unsigned long long) a->cfg.loop_lag_warn_usec,
+			    (unsigned long long) sdiff.loop_lag_over,
+			    (unsigned long long)
+			    hist_percentile(&sdiff.loop_lag_usec, 99.0));
+		}
+
+		/* sleep() isn't exact, so use the measured interval */
+		if (rate >= 0 && now > last) {
+			printf("request rate: target=%.0f/sec, achieved=%.1f/sec\n",
+			    rate,
+			    (double) sdiff.req_count * 1000000.0 /
+			    (double) (now - last));
+		}
+		if (a->cfg.target_conn_rate >= 0 && now > last) {
+			printf("connection rate: target=%d/sec, achieved=%.1f/sec\n",
+			    a->cfg.target_conn_rate,
+			    (double) sdiff.conn_count * 1000000.0 /
+			    (double) (now - last));
+		}
+		last = now;
 		mgr_stats_copy(&stats, &a->prev_stats);
 	}
 	return (NULL);
@@ -343,6 +934,8 @@ int
 main(int argc, char *argv[])
 {
 	struct app a;
+	const char *state;
+	uint64_t now, run_usec;
 	int i;
 
 
@@ -360,21 +953,126 @@ main(int argc, char *argv[])
 
 	/* Minimum config: host, port, ip */
 	if (cfg_ipv4_array_nentries(&a.cfg.ipv4_dst) == 0 ||
-	    a.cfg.uri == NULL ||
+	    (a.cfg.uri == NULL && a.cfg.trace_file == NULL) ||
 	    a.cfg.port == -1) {
 		usage(argv[0]);
 		exit(128);
 	}
 
+	/* Catch URI template errors now rather than in every worker */
+	if (uri_tmpl_is_template(a.cfg.uri)) {
+		struct uri_tmpl t;
+
+		if (uri_tmpl_compile(&t, a.cfg.uri, 0) != 0)
+			exit(128);
+		uri_tmpl_free(&t);
+	}
+
+	/*
+	 * Build the request body buffer once; the workers all send
+	 * from it by reference.
+	 */
+	if (a.cfg.body_size != NULL) {
+		struct dist d;
+		double max;
+
+		if (dist_parse(&d, a.cfg.body_size) != 0) {
+			fprintf(stderr, "%s: invalid body size (%s)\n",
+			    __func__, a.cfg.body_size);
+			exit(128);
+		}
+		if (d.type == DIST_CONST || d.type == DIST_UNIFORM)
+			max = d.type == DIST_CONST ? d.a : d.b;
+		else
+			max = (double) d.max;
+		if (max > (double) REQ_BODY_SIZE_MAX)
+			fprintf(stderr, "%s: body sizes over %d bytes will be "
+			    "clamped (%s)\n", __func__, REQ_BODY_SIZE_MAX,
+			    a.cfg.body_size);
+	}
+	if (a.cfg.body_file != NULL) {
+		if (req_body_init_file(&a.body, a.cfg.body_file) != 0)
+			exit(128);
+		a.cfg.body = &a.body;
+	} else if (a.cfg.body_size != NULL) {
+		if (req_body_init_fill(&a.body, REQ_BODY_FILL_SIZE) != 0)
+			exit(128);
+		a.cfg.body = &a.body;
+	}
+	/* Map the trace read-only; the workers all replay from it */
+	if (a.cfg.trace_file != NULL) {
+		if (trace_open(&a.trace, a.cfg.trace_file) != 0)
+			exit(128);
+		a.cfg.trace = &a.trace;
+	}
+
+	if (a.cfg.http_method == -1)
+		a.cfg.http_method =
+		    a.cfg.body != NULL ? htp_method_POST : htp_method_GET;
+
+	if (a.cfg.tls) {
+		SSL_library_init();
+		SSL_load_error_strings();
+	}
+
+	/*
+	 * A load profile sets the rate and connection count over time,
+	 * and runs for as long as it lasts.
+	 */
+	if (a.cfg.profile_spec != NULL) {
+		if (profile_parse(&a.profile, a.cfg.profile_spec,
+		    a.cfg.target_request_rate > 0 ? a.cfg.target_request_rate : 0,
+		    a.cfg.target_nconn) != 0)
+			exit(128);
+		a.cfg.profile = &a.profile;
+		a.cfg.running_period_sec =
+		    (a.profile.dur_usec + 999999) / 1000000;
+	}
+
+	/*
+	 * Searching for the maximum rate starts from the target rate
+	 * (or 100/sec) and runs until the search is done.
+	 */
+	if (a.cfg.find_max) {
+		if (a.cfg.slo_p99_usec == 0 || a.cfg.profile != NULL) {
+			fprintf(stderr, "%s: --find-max needs --slo-p99, and "
+			    "can't be used with --profile\n", __func__);
+			exit(128);
+		}
+		if (findmax_init(&a.fm,
+		    a.cfg.target_request_rate > 0 ? a.cfg.target_request_rate : 100,
+		    a.cfg.slo_p99_usec,
+		    (uint64_t) a.cfg.find_max_window_msec * 1000,
+		    mtime_now_usec()) != 0)
+			exit(127);
+		a.cfg.running_period_sec = -1;
+	}
+
+	if (a.cfg.open_loop != CFG_OPEN_LOOP_NONE && a.cfg.profile == NULL &&
+	    ! a.cfg.find_max &&
+	    a.cfg.target_request_rate < a.cfg.num_threads) {
+		fprintf(stderr, "%s: --open-loop needs --target-request-rate "
+		    "of at least one per thread\n", __func__);
+		exit(128);
+	}
+
 	signal(SIGPIPE, sighdl_pipe);
 
 	evthread_use_pthreads();
 
-	/* Allocate worker thread state */
-	a.th = calloc(a.cfg.num_threads, sizeof(struct clt_thr));
-	if (a.th == NULL) {
-		err(127, "%s: calloc", __func__);
+	/*
+	 * Allocate worker thread state; it's cache line aligned so
+	 * the published stats don't share lines between workers.
+	 */
+	if (posix_memalign((void **) &a.th, CACHE_LINE_SIZE,
+	    a.cfg.num_threads * sizeof(struct clt_thr)) != 0) {
+		err(127, "%s: posix_memalign", __func__);
 	}
+	bzero(a.th, a.cfg.num_threads * sizeof(struct clt_thr));
+	a.thr_stats = calloc(a.cfg.num_threads, sizeof(*a.thr_stats));
+	a.thr_state = calloc(a.cfg.num_threads, sizeof(*a.thr_state));
+	if (a.thr_stats == NULL || a.thr_state == NULL)
+		err(127, "%s: calloc", __func__);
 
 	/* Setup initial workers with local configuration */
 	for (i = 0; i < a.cfg.num_threads; i++) {
@@ -385,23 +1083,70 @@ main(int argc, char *argv[])
 			err(127, "%s: calloc", __func__);
 
 		/* Setup each client */
-		clt_mgr_setup(a.th[i].t_m, &a.th[i], clt_mgr_stats_notify, &a.th[i]);
+		clt_mgr_setup(a.th[i].t_m, &a.th[i]);
 	}
 
 	/*
-	 * Ok, for now let's cheap out and just allocate 1/i
-	 * of the various configuration parameters to each.
-	 * worker thread.
-	 *
-	 * Why's this a bad idea? If one CPU falls a bit behind,
-	 * then the target request rate may not really be
-	 * exactly what we're after.  Ie, we can't shift
-	 * load between worker threads if we need to.
-	 *
-	 * But, ENOTIME, etc.
+	 * The connection limit, request/connection rates and the
+	 * global counts go into a budget shared by all the workers
+	 * rather than being split 1/n between them.  That way if one
+	 * CPU falls a bit behind the others pick up the slack, and
+	 * the totals come out exactly as configured.
+	 */
+	budget_init(&a.budget, a.cfg.num_threads);
+
+	/*
+	 * The workers start together once they've all opened their
+	 * connections; the load profile and find-max run from when
+	 * RUNNING starts, read from runctl by whoever needs it.
+	 */
+	runctl_init(&a.runctl, a.cfg.num_threads,
+	    a.cfg.warmup_period_sec > 0 ?
+	    (uint64_t) a.cfg.warmup_period_sec * 1000000 : 0);
+	a.cfg.runctl = &a.runctl;
+	a.budget.conn_slots.max = a.cfg.target_nconn > 0 ? a.cfg.target_nconn : 0;
+	if (a.cfg.target_request_rate >= 0 &&
+	    a.cfg.open_loop == CFG_OPEN_LOOP_NONE)
+		budget_bucket_init(&a.budget.req_rate, a.cfg.target_request_rate,
+		    mtime_now_usec());
+
+	/* .. or from the start of the load profile; the workers follow it */
+	if (a.cfg.profile != NULL) {
+		double rate;
+		int nconn;
+
+		now = mtime_now_usec();
+		(void) profile_at(&a.profile, now, now, &rate, &nconn);
+		a.budget.conn_slots.max = nconn > 0 ? nconn : 0;
+		budget_bucket_init(&a.budget.req_rate, (u_long) rate,
+		    mtime_now_usec());
+	}
+
+	/* .. or the find-max controller's, retargeted as it goes */
+	if (a.cfg.find_max) {
+		a.fm.probe_start_usec = mtime_now_usec();
+		budget_bucket_init(&a.budget.req_rate, (u_long) a.fm.rate,
+		    mtime_now_usec());
+	}
+	if (a.cfg.target_conn_rate >= 0)
+		budget_bucket_init(&a.budget.conn_rate, a.cfg.target_conn_rate,
+		    mtime_now_usec());
+	if (a.cfg.target_global_request_count > 0)
+		budget_count_init(&a.budget.req_count,
+		    a.cfg.target_global_request_count);
+	if (a.cfg.target_total_nconn_count > 0)
+		budget_count_init(&a.budget.conn_count,
+		    a.cfg.target_total_nconn_count);
+	a.cfg.budget = &a.budget;
+
+	/*
+	 * Each worker still gets its share of the rest; remainders go
+	 * to the first few.
 	 */
 	for (i = 0; i < a.cfg.num_threads; i++) {
-		mgr_config_copy_thread(&a.cfg, &a.th[i].t_m->cfg, a.cfg.num_threads);
+		if (mgr_config_copy_thread(&a.cfg, &a.th[i].t_m->cfg,
+		    a.cfg.num_threads, i) != 0)
+			err(127, "%s: mgr_config_copy_thread", __func__);
 	}
 
 	/* Now, start each thread */
@@ -410,6 +1155,11 @@ main(int argc, char *argv[])
 			err(127, "%s: pthread_create", __func__);
 	}
 
+	if (a.cfg.stats_out != NULL &&
+	    stats_out_open(&a.so, a.cfg.stats_out, a.cfg.stats_format,
+	    a.cfg.num_threads, mtime_now_usec()) != 0)
+		exit(127);
+
 	/* Stats printing thread! */
 	atomic_store_rel_int(&a.stats_thread_run, 1);
 	if (pthread_create(&a.th_stats, NULL, app_stats_thread, &a) != 0)
@@ -424,13 +1174,44 @@ main(int argc, char *argv[])
 	a.stats_thread_run = 0;
 	(void) pthread_join(a.th_stats, NULL);
 
-	/* Completed total! */
-	clt_mgr_stats_print("run_total", &a.prev_stats);
+	/* Completed total! Each worker published its final stats */
+	now = mtime_now_usec();
+	state = app_stats_sum(&a, &a.prev_stats);
+	stats_out_write(&a.so, now, state,
+	    (a.cfg.profile != NULL || a.cfg.find_max) ? "done" : "",
+	    &a.prev_stats, a.thr_state, a.thr_stats);
+	stats_out_close(&a.so);
+
+	/*
+	 * Rates are over everything after warmup, including the
+	 * WAITING drain.
+	 */
+	run_usec = runctl_running_usec(&a.runctl);
+	run_usec = (run_usec != 0 && now > run_usec) ? now - run_usec : 0;
+	clt_mgr_stats_print("run_total", &a.prev_stats, run_usec);
+	ALLOC_REPORT(stdout, "httpclt");
+	if (a.cfg.find_max) {
+		findmax_report(&a.fm, stdout);
+		findmax_free(&a.fm);
+	}
+
+	/*
+	 * Each worker found its own knee against its share of the
+	 * load, so the total is the sum.
+	 */
+	if (a.cfg.adaptive_conc) {
+		printf("adaptive concurrency: knee=%d connections, "
+		    "%d req/sec (limit at finish %d)\n",
+		    a.prev_stats.conc_knee, a.prev_stats.conc_knee_rate,
+		    a.prev_stats.conc_limit);
+	}
 
 	/* Free event bases */
 	for (i = 0; i < a.cfg.num_threads; i++) {
 		clt_thr_free(&a.th[i]);
 	}
+	req_body_free(&a.body);
+	trace_close(&a.trace);
 
 	/* Done! */
 
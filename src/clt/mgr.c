@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -17,13 +18,31 @@
 
 #include <netinet/in.h>
 
+#include <openssl/ssl.h>
+
 #include <evhtp.h>
 
 #include "debug.h"
-
+#include "alloc_stats.h"
+#include "hist.h"
 #include "mgr_stats.h"
+#include "seqlock.h"
 #include "thr.h"
+#include "tw.h"
+#include "src_bind.h"
+#include "rng.h"
+#include "mtime.h"
+#include "budget.h"
+#include "profile.h"
+#include "aconc.h"
+#include "runctl.h"
+#include "loopmon.h"
+#include "trace.h"
+#include "dist.h"
+#include "uri_tmpl.h"
+#include "req_body.h"
 #include "clt.h"
+#include "clt_tls.h"
 #include "mgr_config.h"
 #include "mgr.h"
 
@@ -43,13 +62,8 @@
  */
 #define	REQRATE_INT		100
 
-/*
- * The multiplier to use for the fixed-rate math going
- * on in the request rate pacer.
- */
-#define	REQRATE_FIXED_MULT	1000
-
 static struct clt_mgr_conn * clt_mgr_conn_create(struct clt_mgr *mgr);
+static void clt_mgr_conn_release(struct clt_mgr_conn *c);
 
 const char *
 clt_mgr_state_str(clt_mgr_state_t state)
@@ -60,6 +74,8 @@ clt_mgr_state_str(clt_mgr_state_t state)
 		return "NONE";
 	case CLT_MGR_STATE_INIT:
 		return "INIT";
+	case CLT_MGR_STATE_WARMUP:
+		return "WARMUP";
 	case CLT_MGR_STATE_RUNNING:
 		return "RUNNING";
 	case CLT_MGR_STATE_WAITING:
@@ -89,89 +105,252 @@ clt_mgr_state_change(struct clt_mgr *mgr, clt_mgr_state_t new_state)
 	mgr->mgr_state = new_state;
 }
 
-static void
-clt_mgr_reqrate_pacer_update(struct clt_mgr *m)
+/*
+ * WARMUP applies the same load as RUNNING; it just isn't counted.
+ */
+static int
+clt_mgr_state_loading(const struct clt_mgr *m)
 {
-	int t;
 
-	debug_printf("%s: cur=%d\n", __func__, m->request_count_cur);
+	return (m->mgr_state == CLT_MGR_STATE_WARMUP ||
+	    m->mgr_state == CLT_MGR_STATE_RUNNING);
+}
 
-	m->request_count_target = 0;
+/*
+ * Request and connection rates, the global request/connection
+ * counts and the connection limit are all drawn from the budget
+ * shared by every thread (see budget.h), a batch at a time.
+ */
+static int
+clt_mgr_reqrate_paced(const struct clt_mgr *m)
+{
 
-	/*
-	 * XXX This assumes we run exactly on REQRATE_INT; this
-	 * may not actually be the case.
-	 */
-	m->request_rate_error -= m->request_count_cur * REQRATE_FIXED_MULT;
-	m->request_rate_error += (m->cfg.target_request_rate * REQRATE_FIXED_MULT) / REQRATE_INT;
+	/* Open loop paces arrivals itself */
+	return (m->cfg.budget->req_rate.enabled &&
+	    m->cfg.open_loop == CFG_OPEN_LOOP_NONE);
+}
+
+static int
+clt_mgr_connrate_paced(const struct clt_mgr *m)
+{
 
-	/* Clamp err at sane values */
-	t = (m->cfg.target_request_rate * REQRATE_FIXED_MULT) / REQRATE_INT;
-	if (m->request_rate_error > t)
-		m->request_rate_error = t;
-	else if (m->request_rate_error < -t)
-		m->request_rate_error = -t;
+	return (m->cfg.budget->conn_rate.enabled);
+}
 
-	/* Set new target for the next interval */
-	m->request_count_target = (m->cfg.target_request_rate / REQRATE_INT)
-	    + (m->request_rate_error / REQRATE_FIXED_MULT);
+/*
+ * Take one token from a rate bucket, via the thread's cache.
+ */
+static int
+clt_mgr_budget_token_get(struct clt_mgr *m, struct budget_bucket *bk,
+    u_long *cache)
+{
 
-	debug_printf("%s: cur=%d, target=%d, error=%d, interval target=%d\n",
-	    __func__,
-	    m->request_count_cur,
-	    m->cfg.target_request_rate,
-	    m->request_rate_error,
-	    m->request_count_target);
+	if (*cache == 0)
+		*cache = budget_bucket_take(bk,
+		    budget_bucket_batch(m->cfg.budget, bk), mtime_now_usec());
+	if (*cache == 0)
+		return (0);
+	(*cache)--;
+	return (1);
+}
 
+/*
+ * .. and one from a count.
+ */
+static int
+clt_mgr_budget_count_get(struct clt_mgr *m, struct budget_count *bc,
+    u_long *cache)
+{
 
-	m->request_count_cur = 0;
+	if (! bc->enabled)
+		return (1);
+	if (*cache == 0)
+		*cache = budget_count_take(m->cfg.budget, bc,
+		    BUDGET_COUNT_BATCH);
+	if (*cache == 0)
+		return (0);
+	(*cache)--;
+	return (1);
 }
 
 static int
-clt_mgr_reqrate_pacer_check(struct clt_mgr *m)
+clt_mgr_req_token_get(struct clt_mgr *m)
 {
 
-	if (m->cfg.target_request_rate < 0)
+	if (! clt_mgr_reqrate_paced(m))
 		return (1);
+	return (clt_mgr_budget_token_get(m, &m->cfg.budget->req_rate,
+	    &m->bud_req_tokens));
+}
 
-#if 0
-	debug_printf("%s: cur=%d, target=%d\n", __func__, m->request_count_cur, m->request_count_target);
-#endif
-	if (m->request_count_cur >= m->request_count_target)
-		return (0);
+static int
+clt_mgr_conn_token_get(struct clt_mgr *m)
+{
 
-	return (1);
+	if (! clt_mgr_connrate_paced(m))
+		return (1);
+	return (clt_mgr_budget_token_get(m, &m->cfg.budget->conn_rate,
+	    &m->bud_conn_tokens));
+}
+
+static int
+clt_mgr_req_count_get(struct clt_mgr *m)
+{
+
+	return (clt_mgr_budget_count_get(m, &m->cfg.budget->req_count,
+	    &m->bud_req_count));
 }
 
+static int
+clt_mgr_conn_count_get(struct clt_mgr *m)
+{
+
+	return (clt_mgr_budget_count_get(m, &m->cfg.budget->conn_count,
+	    &m->bud_conn_count));
+}
+
+/*
+ * Is a global count used up, including this thread's share of it?
+ */
+static int
+clt_mgr_budget_count_done(struct budget_count *bc, u_long cache)
+{
+
+	return (cache == 0 && budget_count_exhausted(bc));
+}
+
+/*
+ * Hand back this thread's unused counts once it stops issuing.
+ */
 static void
-clt_mgr_reqrate_pacer_inc(struct clt_mgr *m)
+clt_mgr_budget_return(struct clt_mgr *m)
 {
 
-	if (m->cfg.target_request_rate < 0)
+	budget_count_return(&m->cfg.budget->req_count, m->bud_req_count);
+	m->bud_req_count = 0;
+	budget_count_return(&m->cfg.budget->conn_count, m->bud_conn_count);
+	m->bud_conn_count = 0;
+}
+
+/*
+ * Arm a timer for when the bucket's next token is due.
+ *
+ * It's rechecked at least every periodic tick, as other threads may
+ * take the token first.
+ */
+static void
+clt_mgr_token_schedule(event_t *ev, struct budget_bucket *bk)
+{
+	struct timeval tv;
+	int64_t usec;
+
+	if (evtimer_pending(ev, NULL))
 		return;
+	usec = budget_bucket_wait_usec(bk);
+	if (usec < BUDGET_REFILL_MIN_USEC)
+		usec = BUDGET_REFILL_MIN_USEC;
+	if (usec > PERIODIC_TIMEREV_USEC)
+		usec = PERIODIC_TIMEREV_USEC;
+	tv.tv_sec = 0;
+	tv.tv_usec = usec;
+	evtimer_add(ev, &tv);
+}
 
-	m->request_count_cur++;
+/*
+ * Count a manager callback in the event loop stats; see loopmon.h.
+ */
+static void
+clt_mgr_loop_callback(struct clt_mgr *m)
+{
+
+	if (m->loopmon != NULL)
+		loopmon_callback(m->loopmon);
 }
 
 static void
 mgr_statustype_update(struct clt_mgr *mgr, int status)
 {
 
-	switch (status) {
-	case 200:
-		mgr->stats.req_statustype_200++;
+	if (status < MGR_STATS_STATUS_MIN || status > MGR_STATS_STATUS_MAX) {
+		mgr->stats.req_status_class[0]++;
+		return;
+	}
+	mgr->stats.req_status_class[status / 100]++;
+	mgr->stats.req_status[status - MGR_STATS_STATUS_MIN]++;
+}
+
+static void
+mgr_errtype_update(struct clt_mgr *mgr, clt_err_t err)
+{
+
+	switch (err) {
+	case CLT_ERR_CONNECT_REFUSED:
+		mgr->stats.err_connect_refused++;
+		break;
+	case CLT_ERR_CONNECT_TIMEOUT:
+		mgr->stats.err_connect_timeout++;
+		break;
+	case CLT_ERR_CONNECT:
+		mgr->stats.err_connect_other++;
+		break;
+	case CLT_ERR_RESET_HEADERS:
+		mgr->stats.err_reset_headers++;
+		break;
+	case CLT_ERR_RESET_BODY:
+		mgr->stats.err_reset_body++;
 		break;
-	case 302:
-		mgr->stats.req_statustype_302++;
+	case CLT_ERR_TIMEOUT:
+		mgr->stats.err_timeout++;
+		break;
+	case CLT_ERR_PARSE:
+		mgr->stats.err_parse++;
 		break;
 	default:
-		mgr->stats.req_statustype_other++;
 		break;
 	}
 }
 
+/*
+ * Record how long the current request took, from when it was sent
+ * (or scheduled, for open loop.)
+ */
+static void
+clt_mgr_conn_latency_update(struct clt_mgr_conn *c)
+{
+
+	if (c->req_start_usec == 0)
+		return;
+	hist_add(&c->mgr->stats.req_latency_usec,
+	    mtime_now_usec() - c->req_start_usec);
+	c->req_start_usec = 0;
+}
+
+/*
+ * Track the per-destination outstanding request count, used by the
+ * least-outstanding and power-of-two-choices destination policies.
+ */
+static void
+clt_mgr_conn_inflight_start(struct clt_mgr_conn *c)
+{
+
+	if (c->req_inflight)
+		return;
+	c->req_inflight = 1;
+	cfg_ipv4_array_inflight_inc(&c->mgr->cfg.ipv4_dst, c->dst_idx);
+}
+
+static void
+clt_mgr_conn_inflight_done(struct clt_mgr_conn *c)
+{
+
+	if (! c->req_inflight)
+		return;
+	c->req_inflight = 0;
+	cfg_ipv4_array_inflight_dec(&c->mgr->cfg.ipv4_dst, c->dst_idx);
+}
+
 static int
-clt_mgr_conn_start_http_req(struct clt_mgr_conn *c, int msec)
+clt_mgr_conn_start_http_req(struct clt_mgr_conn *c, int64_t usec)
 {
 	struct timeval tv;
 
@@ -179,17 +358,79 @@ clt_mgr_conn_start_http_req(struct clt_mgr_conn *c, int msec)
 
 	c->pending_http_req = 1;
 
-	if (msec <= 0) {
+	if (usec <= 0) {
 		event_add(c->ev_new_http_req, NULL);
 		event_active(c->ev_new_http_req, 0, 0);
 	} else {
-		tv.tv_sec = msec / 1000;
-		tv.tv_usec = (msec % 1000) * 1000;
+		tv.tv_sec = usec / 1000000;
+		tv.tv_usec = usec % 1000000;
 		event_add(c->ev_new_http_req, &tv);
 	}
 	return (0);
 }
 
+/*
+ * Return the next trace record for this thread.
+ *
+ * Each thread walks its own stride of the trace (records tid,
+ * tid + nthreads, ...) and wraps around at the end.
+ */
+static const struct trace_rec *
+clt_mgr_trace_next(struct clt_mgr *m)
+{
+	const struct trace_rec *r;
+
+	r = trace_get(m->trace, m->trace_cur);
+	m->trace_cur += m->trace_stride;
+	if (m->trace_cur >= m->trace->nrecords)
+		m->trace_cur = m->trace_first;
+	return (r);
+}
+
+static htp_method
+clt_mgr_trace_method(uint8_t method)
+{
+
+	switch (method) {
+	case TRACE_METHOD_HEAD:
+		return (htp_method_HEAD);
+	case TRACE_METHOD_POST:
+		return (htp_method_POST);
+	case TRACE_METHOD_PUT:
+		return (htp_method_PUT);
+	case TRACE_METHOD_DELETE:
+		return (htp_method_DELETE);
+	case TRACE_METHOD_OPTIONS:
+		return (htp_method_OPTIONS);
+	case TRACE_METHOD_GET:
+	default:
+		return (htp_method_GET);
+	}
+}
+
+/*
+ * Pick the next request for this connection and schedule it.
+ *
+ * For trace replay the record is chosen now, so its inter-arrival
+ * time (if it has one) is used as the delay before it's issued
+ * instead of the configured per-request wait.
+ */
+static int
+clt_mgr_conn_schedule_http_req(struct clt_mgr_conn *c)
+{
+	struct clt_mgr *m = c->mgr;
+	int64_t usec;
+
+	usec = (int64_t) c->wait_time_pre_http_req_msec * 1000;
+	if (m->trace != NULL) {
+		c->trace_rec = clt_mgr_trace_next(m);
+		if (c->trace_rec->iat_usec > 0)
+			usec = c->trace_rec->iat_usec;
+	}
+
+	return (clt_mgr_conn_start_http_req(c, usec));
+}
+
 static int
 clt_mgr_conn_cancel_http_req(struct clt_mgr_conn *c)
 {
@@ -207,6 +448,8 @@ clt_mgr_conn_destroy(struct clt_mgr_conn *c)
 	debug_printf("%s: %p: called; scheduling destroy\n",
 	    __func__,
 	    c);
+	if (! c->is_dead)
+		c->mgr->nconn_closing ++;
 	c->is_dead = 1;
 	event_add(c->ev_conn_destroy, NULL);
 	event_active(c->ev_conn_destroy, 0, 0);
@@ -228,7 +471,7 @@ clt_mgr_conn_check_create_http_request(struct clt_mgr_conn *c)
 	 * if we're != RUNNING.
 	 */
 	if ((c->target_request_count <= 0) &&
-	    (c->mgr->mgr_state != CLT_MGR_STATE_RUNNING))
+	    ! clt_mgr_state_loading(c->mgr))
 		return(0);
 
 	/* Non-keepalive? Don't issue a second one */
@@ -239,21 +482,20 @@ clt_mgr_conn_check_create_http_request(struct clt_mgr_conn *c)
 	    (c->cur_req_count >= c->target_request_count))
 		return (0);
 
-	return (1);
-}
-
-/*
- * Check if the connection manager has hit its limits and we're allowed
- * to create a new HTTP request.
- *
- * Returns 1 if we are, 0 otherwise.
- */
-static int
-clt_mgr_check_create_http_request(struct clt_mgr *mgr)
-{
-
-	if ((mgr->cfg.target_global_request_count > 0) &&
-	    mgr->stats.req_count >= mgr->cfg.target_global_request_count)
+	/* Over a lowered connection limit? Close this one */
+	if (budget_slot_shed(&c->mgr->cfg.budget->conn_slots)) {
+		c->slot_shed = 1;
+		return (0);
+	}
+	/*
+	 * .. or the adaptive limit.  Compare the connections that are
+	 * staying open: the callers destroy the connection straight
+	 * away, so the ones already closing in this loop pass are
+	 * counted and only the surplus closes.
+	 */
+	if (c->mgr->aconc != NULL &&
+	    c->mgr->stats.nconn - c->mgr->nconn_closing >
+	    c->mgr->aconc->limit)
 		return (0);
 
 	return (1);
@@ -271,13 +513,15 @@ clt_mgr_check_create_conn(struct clt_mgr *mgr)
 
 	/* Only create connections in INIT/WAITING phases */
 
-	if (mgr->mgr_state != CLT_MGR_STATE_RUNNING &&
+	if (! clt_mgr_state_loading(mgr) &&
 	    mgr->mgr_state != CLT_MGR_STATE_INIT)
 		return(0);
-	if ((mgr->cfg.target_total_nconn_count > 0) &&
-	    mgr->stats.conn_count >= mgr->cfg.target_total_nconn_count)
+	if (clt_mgr_budget_count_done(&mgr->cfg.budget->conn_count,
+	    mgr->bud_conn_count))
 		return (0);
-	if (mgr->stats.nconn >= mgr->cfg.target_nconn)
+
+	/* .. and the adaptive concurrency limit, if any */
+	if (mgr->aconc != NULL && mgr->stats.nconn >= mgr->aconc->limit)
 		return (0);
 
 	return (1);
@@ -297,28 +541,276 @@ clt_mgr_check_finished(struct clt_mgr *mgr)
 
 	/* XXX TODO: need a timeout based config option */
 
-	/* number of total requests */
-	if ((mgr->cfg.target_global_request_count > 0) &&
-	    mgr->stats.req_count >= mgr->cfg.target_global_request_count)
-		return (1);
-	if ((mgr->cfg.target_total_nconn_count > 0) &&
-	    mgr->stats.conn_count >= mgr->cfg.target_total_nconn_count)
-		return (1);
+	/* Told to finish, eg by the --find-max controller */
+	if (budget_is_closed(mgr->cfg.budget))
+		return (1);
+
+	/*
+	 * number of total requests/connections, across all threads;
+	 * any this thread has drawn are issued first.
+	 */
+	if (clt_mgr_budget_count_done(&mgr->cfg.budget->req_count,
+	    mgr->bud_req_count))
+		return (1);
+	if (clt_mgr_budget_count_done(&mgr->cfg.budget->conn_count,
+	    mgr->bud_conn_count))
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Check if the http clients are completed and no open connections
+ * exist.
+ */
+static int
+clt_mgr_check_waiting_finished(struct clt_mgr *mgr)
+{
+
+	if (mgr->stats.nconn == 0)
+		return (1);
+	return (0);
+}
+
+/*
+ * Park a connection with nothing to send yet on the idle list.
+ */
+static void
+clt_mgr_conn_idle(struct clt_mgr_conn *c)
+{
+
+	if (c->on_idle)
+		return;
+	TAILQ_INSERT_TAIL(&c->mgr->idle_list, c, idle_node);
+	c->on_idle = 1;
+}
+
+static void
+clt_mgr_conn_unidle(struct clt_mgr_conn *c)
+{
+
+	if (! c->on_idle)
+		return;
+	TAILQ_REMOVE(&c->mgr->idle_list, c, idle_node);
+	c->on_idle = 0;
+}
+
+/*
+ * Close the idle connections; called when RUNNING ends.
+ */
+static void
+clt_mgr_idle_stop(struct clt_mgr *m)
+{
+	struct clt_mgr_conn *c;
+
+	while ((c = TAILQ_FIRST(&m->idle_list)) != NULL) {
+		clt_mgr_conn_unidle(c);
+		clt_mgr_conn_destroy(c);
+	}
+}
+
+/*
+ * Closed loop: the connection has a rate token, so take a request
+ * from the global count and schedule it.
+ *
+ * Returns -1 if the count is used up.
+ */
+static int
+clt_mgr_conn_token_ready(struct clt_mgr_conn *c)
+{
+
+	if (! clt_mgr_req_count_get(c->mgr))
+		return (-1);
+	return (clt_mgr_conn_schedule_http_req(c));
+}
+
+/*
+ * Closed loop: a connection is free for its next request.  If the
+ * rate budget is out of tokens it waits on the idle list until the
+ * token timer hands it one.
+ *
+ * Returns -1 if there are no more requests to issue.
+ */
+static int
+clt_mgr_conn_next_http_req(struct clt_mgr_conn *c)
+{
+	struct clt_mgr *m = c->mgr;
+
+	if (clt_mgr_req_token_get(m))
+		return (clt_mgr_conn_token_ready(c));
+
+	clt_mgr_conn_idle(c);
+	clt_mgr_token_schedule(m->t_tok_timerev, &m->cfg.budget->req_rate);
+	return (0);
+}
+
+/*
+ * The next request token is due; hand tokens to waiting connections
+ * in order.
+ */
+static void
+clt_mgr_tok_timer(evutil_socket_t sock, short which, void *arg)
+{
+	struct clt_mgr *m = arg;
+	struct clt_mgr_conn *c;
+
+	clt_mgr_loop_callback(m);
+	if (! clt_mgr_state_loading(m))
+		return;
+
+	while ((c = TAILQ_FIRST(&m->idle_list)) != NULL &&
+	    clt_mgr_req_token_get(m)) {
+		clt_mgr_conn_unidle(c);
+		if (clt_mgr_conn_token_ready(c) != 0)
+			clt_mgr_conn_destroy(c);
+	}
+
+	if (! TAILQ_EMPTY(&m->idle_list))
+		clt_mgr_token_schedule(m->t_tok_timerev,
+		    &m->cfg.budget->req_rate);
+}
+
+/*
+ * Open loop arrivals.
+ *
+ * An arrival timer schedules requests at ol_rate - this thread's
+ * share of target_request_rate, or of the load profile - (evenly
+ * spaced, or with exponential inter-arrival times for a Poisson
+ * process) whether or not earlier requests have completed.
+ * Each arrival's scheduled time is queued in a bounded ring until a
+ * connection is free to send it; connections with nothing to send
+ * wait on the idle list.  Latency is measured from the scheduled
+ * time, so a stalled server shows up as latency rather than as the
+ * client quietly slowing down.
+ */
+static double
+clt_mgr_ol_iat_usec(struct clt_mgr *m)
+{
+	double mean, u;
+
+	mean = 1000000.0 / m->ol_rate;
+	if (m->cfg.open_loop != CFG_OPEN_LOOP_POISSON)
+		return (mean);
+
+	do {
+		u = rng_double(&m->rng);
+	} while (u <= 0.0);
+	return (-mean * log(u));
+}
+
+static void
+clt_mgr_ol_enqueue(struct clt_mgr *m, uint64_t usec)
+{
+	int i;
+
+	m->stats.ol_scheduled++;
+	if (m->stats.ol_backlog >= m->ol_ring_size) {
+		m->stats.ol_dropped++;
+		return;
+	}
+	i = (m->ol_ring_head + m->stats.ol_backlog) % m->ol_ring_size;
+	m->ol_ring[i] = usec;
+	m->stats.ol_backlog++;
+}
+
+static uint64_t
+clt_mgr_ol_dequeue(struct clt_mgr *m)
+{
+	uint64_t usec;
+
+	usec = m->ol_ring[m->ol_ring_head];
+	m->ol_ring_head = (m->ol_ring_head + 1) % m->ol_ring_size;
+	m->stats.ol_backlog--;
+	return (usec);
+}
+
+static void
+clt_mgr_ol_dispatch(struct clt_mgr_conn *c)
+{
+	struct clt_mgr *m = c->mgr;
+
+	c->ol_intended_usec = clt_mgr_ol_dequeue(m);
+	if (m->trace != NULL)
+		c->trace_rec = clt_mgr_trace_next(m);
+	clt_mgr_conn_start_http_req(c, 0);
+}
+
+/*
+ * A connection is free to send a request: send the oldest queued
+ * arrival, or wait on the idle list for the next one.
+ */
+static void
+clt_mgr_ol_conn_ready(struct clt_mgr_conn *c)
+{
+	struct clt_mgr *m = c->mgr;
+
+	if (m->stats.ol_backlog > 0 && clt_mgr_req_count_get(m)) {
+		clt_mgr_ol_dispatch(c);
+		return;
+	}
+	clt_mgr_conn_idle(c);
+}
+
+static void
+clt_mgr_ol_schedule(struct clt_mgr *m, uint64_t now)
+{
+	struct timeval tv;
+	uint64_t usec = 0;
+
+	if (m->ol_next_usec > (double) now)
+		usec = (uint64_t) (m->ol_next_usec - (double) now);
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+	evtimer_add(m->t_ol_timerev, &tv);
+}
+
+static void
+clt_mgr_ol_timer(evutil_socket_t sock, short which, void *arg)
+{
+	struct clt_mgr *m = arg;
+	struct clt_mgr_conn *c;
+	uint64_t now;
+
+	clt_mgr_loop_callback(m);
+	if (! clt_mgr_state_loading(m))
+		return;
+
+	/*
+	 * Queue every arrival that's now due.  If this timer ran late
+	 * they keep their original scheduled times.
+	 */
+	now = mtime_now_usec();
+	if (m->ol_rate <= 0.0) {
+		/* No arrivals for now; check again next tick */
+		m->ol_next_usec = (double) (now + PERIODIC_TIMEREV_USEC);
+	}
+	while (m->ol_next_usec <= (double) now) {
+		clt_mgr_ol_enqueue(m, (uint64_t) m->ol_next_usec);
+		m->ol_next_usec += clt_mgr_ol_iat_usec(m);
+	}
+
+	/* Hand them to idle connections */
+	while (m->stats.ol_backlog > 0 &&
+	    (c = TAILQ_FIRST(&m->idle_list)) != NULL &&
+	    clt_mgr_req_count_get(m)) {
+		clt_mgr_conn_unidle(c);
+		clt_mgr_ol_dispatch(c);
+	}
 
-	return (0);
+	clt_mgr_ol_schedule(m, now);
 }
 
 /*
- * Check if the http clients are completed and no open connections
- * exist.
+ * Stop arrivals; called when RUNNING ends.  Anything still in the
+ * backlog is never sent.
  */
-static int
-clt_mgr_check_waiting_finished(struct clt_mgr *mgr)
+static void
+clt_mgr_ol_stop(struct clt_mgr *m)
 {
 
-	if (mgr->stats.nconn == 0)
-		return (1);
-	return (0);
+	evtimer_del(m->t_ol_timerev);
+	m->stats.ol_backlog = 0;
+	m->ol_ring_head = 0;
 }
 
 static int
@@ -329,11 +821,36 @@ clt_mgr_conn_try_create(struct clt_mgr *m)
 	/* break if we hit our global connection limit */
 	if (! clt_mgr_check_create_conn(m))
 		return (-1);
-	if (! clt_mgr_reqrate_pacer_check(m))
+
+	/*
+	 * Don't open more connections while the ones we have are
+	 * waiting for request tokens.
+	 */
+	if (clt_mgr_reqrate_paced(m) && ! TAILQ_EMPTY(&m->idle_list))
+		return (-1);
+
+	if (! budget_slot_take(&m->cfg.budget->conn_slots))
+		return (-1);
+
+	/* Out of connection tokens? Try again when the next is due */
+	if (! clt_mgr_conn_token_get(m)) {
+		budget_slot_release(&m->cfg.budget->conn_slots);
+		clt_mgr_token_schedule(m->t_conn_timerev,
+		    &m->cfg.budget->conn_rate);
+		return (-1);
+	}
+
+	if (! clt_mgr_conn_count_get(m)) {
+		budget_slot_release(&m->cfg.budget->conn_slots);
 		return (-1);
+	}
+
 	c = clt_mgr_conn_create(m);
 	if (c == NULL) {
 		m->stats.nconn_create_failed++;
+		budget_slot_release(&m->cfg.budget->conn_slots);
+		if (m->cfg.budget->conn_count.enabled)
+			m->bud_conn_count++;
 		/*
 		 * For now break out; let's only handle one
 		 * failure per clock tick to minimize damage.
@@ -342,9 +859,20 @@ clt_mgr_conn_try_create(struct clt_mgr *m)
 	}
 	m->stats.nconn ++;
 	c->mgr->stats.conn_count++;
+
+	/* Prewarming: just hold the connection open until the start */
+	if (m->mgr_state == CLT_MGR_STATE_INIT)
+		return (0);
+
+	/* Open loop: wait for (or take) a scheduled arrival */
+	if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE) {
+		clt_mgr_ol_conn_ready(c);
+		return (0);
+	}
+
 	/* Kick start a HTTP request */
-	clt_mgr_reqrate_pacer_inc(m);
-	clt_mgr_conn_start_http_req(c, c->wait_time_pre_http_req_msec);
+	if (clt_mgr_conn_next_http_req(c) != 0)
+		clt_mgr_conn_destroy(c);
 
 	return (0);
 }
@@ -356,6 +884,10 @@ clt_mgr_conn_notify_cb(struct client_req *r, clt_notify_cmd_t what,
 	struct clt_mgr_conn *c = cbdata;
 	struct clt_mgr *m = c->mgr;
 
+	/* REQ_DESTROYING is always nested in another notification */
+	if (what != CLT_NOTIFY_REQ_DESTROYING)
+		clt_mgr_loop_callback(m);
+
 #if 1
 	debug_printf("%s: %p: called, r=%p; what=%d (%s)\n",
 	    __func__,
@@ -371,27 +903,44 @@ clt_mgr_conn_notify_cb(struct client_req *r, clt_notify_cmd_t what,
 	 * path in clt.c can run and completely free the request.
 	 */
 	if (what == CLT_NOTIFY_REQUEST_DONE_OK) {
+		ALLOC_REQUEST_DONE();
 		c->mgr->stats.req_count_ok++;
 		mgr_statustype_update(c->mgr, data);
+		clt_mgr_conn_latency_update(c);
 	} else if (what == CLT_NOTIFY_REQUEST_DONE_ERROR) {
+		ALLOC_REQUEST_DONE();
 		c->mgr->stats.req_count_err++;
+		mgr_errtype_update(c->mgr, data);
+		clt_mgr_conn_latency_update(c);
 	} else if (what == CLT_NOTIFY_REQUEST_TIMEOUT) {
 		c->mgr->stats.req_count_timeout++;
+		mgr_errtype_update(c->mgr, data);
+		clt_mgr_conn_latency_update(c);
 		/* For now, just close and don't issue an immediate new request */
 		clt_mgr_conn_cancel_http_req(c);
 		clt_mgr_conn_destroy(c);
 	} else if (what == CLT_NOTIFY_REQ_DESTROYING) {
-		if (clt_mgr_conn_check_create_http_request(c) &&
-		    clt_mgr_check_create_http_request(c->mgr) &&
-		    clt_mgr_reqrate_pacer_check(c->mgr)) {
-			clt_mgr_reqrate_pacer_inc(c->mgr);
-			clt_mgr_conn_start_http_req(c,
-			    c->wait_time_pre_http_req_msec);
-		} else {
+		clt_mgr_conn_inflight_done(c);
+		if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE) {
+			if (clt_mgr_conn_check_create_http_request(c))
+				clt_mgr_ol_conn_ready(c);
+			else
+				clt_mgr_conn_destroy(c);
+			return (0);
+		}
+		/*
+		 * If the budget is out of request tokens the connection
+		 * stays open, idle, until one comes due.
+		 */
+		if (! clt_mgr_conn_check_create_http_request(c) ||
+		    clt_mgr_conn_next_http_req(c) != 0) {
 			clt_mgr_conn_destroy(c);
 			/* Close connection */
 		}
 		return (0);
+	} else if (what == CLT_NOTIFY_CONNECT_ERROR) {
+		/* Only sent with no request pending; CONN_CLOSING follows */
+		mgr_errtype_update(c->mgr, data);
 	} else if (what == CLT_NOTIFY_CONN_CLOSING) {
 		/* For now we tear down the owner client too */
 		/*
@@ -399,20 +948,21 @@ clt_mgr_conn_notify_cb(struct client_req *r, clt_notify_cmd_t what,
 		 * connections, or open multiple clients itself.
 		 */
 		clt_mgr_conn_cancel_http_req(c);
+		clt_mgr_conn_unidle(c);
 		clt_mgr_conn_destroy(c);
 
 		/*
-		 * XXX TODO:
-		 *
-		 * We don't know whether it was a failure to connect
-		 * or a failure after we've sent the HTTP request;
-		 * sigh.
+		 * This counts every close.  Why it closed was already
+		 * counted: clt_req_err_type() classifies the failure
+		 * and it's counted by mgr_errtype_update() via
+		 * DONE_ERROR, or CONNECT_ERROR above when no request
+		 * was pending.
 		 */
 		c->mgr->stats.conn_closing_count ++;
 
 		/*
 		 * Check if we have enough connections available in
-		 * the connection pacer for this period and if so,
+		 * the connection budget for this period and if so,
 		 * fire off another connection.
 		 *
 		 * .. the burst rate doesn't count here, as it
@@ -440,6 +990,9 @@ finish:
 static void
 _clt_mgr_conn_destroy(struct clt_mgr_conn *c)
 {
+	int ap;
+
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_TEARDOWN);
 
 	/* Delete pending events */
 	event_del(c->ev_new_http_req);
@@ -448,19 +1001,20 @@ _clt_mgr_conn_destroy(struct clt_mgr_conn *c)
 	/* Clean up the HTTP request state and connection itself */
 	if (c->req)
 		clt_conn_destroy(c->req);
-
-	/* Free event */
-	event_free(c->ev_new_http_req);
-	event_free(c->ev_conn_destroy);
+	clt_mgr_conn_inflight_done(c);
+	clt_mgr_conn_unidle(c);
 
 	/* Parent count */
 	/* XXX call back to owner instead? */
 	c->mgr->stats.nconn --;
+	c->mgr->nconn_closing --;
+	if (! c->slot_shed)
+		budget_slot_release(&c->mgr->cfg.budget->conn_slots);
 	TAILQ_REMOVE(&c->mgr->mgr_conn_list, c, node);
 
-
-	/* Free connection */
-	free(c);
+	/* Back to the pool */
+	clt_mgr_conn_release(c);
+	ALLOC_PHASE_EXIT(ap);
 }
 
 static void
@@ -468,6 +1022,7 @@ clt_mgr_conn_destroy_event(evutil_socket_t sock, short which, void *arg)
 {
 	struct clt_mgr_conn *c = arg;
 
+	clt_mgr_loop_callback(c->mgr);
 	debug_printf("%s: %p: called; destroying\n", __func__, c);
 
 	/*
@@ -481,33 +1036,94 @@ static void
 clt_mgr_conn_http_req_event(evutil_socket_t sock, short which, void *arg)
 {
 	struct clt_mgr_conn *c = arg;
+	const struct trace_rec *tr = c->trace_rec;
+	struct clt_req_params p;
+	int rv, ap;
+
+	clt_mgr_loop_callback(c->mgr);
 
 	/* XXX TODO: If a HTTP request is pending, warn */
 	if (c->req->req != NULL) {
 		printf("%s: %p: req in progress?\n", __func__, c);
 	}
 
+	if (tr != NULL) {
+		p.method = clt_mgr_trace_method(tr->method);
+		p.uri = trace_rec_uri(tr);
+		p.hdr_buf = trace_rec_hdrs(tr);
+		p.hdr_len = tr->hdr_len;
+		p.body = NULL;
+		p.body_len = 0;
+		p.body_chunked = 0;
+	} else {
+		p.method = c->mgr->cfg.http_method;
+		if (c->mgr->uri_tmpl != NULL)
+			p.uri = uri_tmpl_expand(c->mgr->uri_tmpl, &c->mgr->rng);
+		else
+			p.uri = c->mgr->cfg.uri;
+		p.hdr_buf = NULL;
+		p.hdr_len = 0;
+		p.body = c->mgr->cfg.body;
+		p.body_chunked = c->mgr->cfg.body_chunked;
+		if (p.body == NULL)
+			p.body_len = 0;
+		else if (c->mgr->body_size != NULL) {
+			p.body_len = dist_sample(c->mgr->body_size, &c->mgr->rng);
+			if (p.body_len > REQ_BODY_SIZE_MAX) {
+				p.body_len = REQ_BODY_SIZE_MAX;
+				c->mgr->stats.req_body_clamped++;
+			}
+		} else
+			p.body_len = p.body->len;
+	}
+
 	/* Issue a new HTTP request */
 	c->pending_http_req = 0;
-	if (clt_req_create(c->req, c->mgr->cfg.uri, c->mgr->cfg.http_keepalive) < 0) {
+	c->trace_rec = NULL;
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_REQUEST);
+	rv = clt_req_create(c->req, &p);
+	ALLOC_PHASE_EXIT(ap);
+	if (rv < 0) {
 		printf("%s: %p: failed to create HTTP connection\n",
 		    __func__,
 		    c);
 
 		/* XXX TODO should kick off some notification about this? */
 		c->mgr->stats.req_count_create_err++;
+		c->ol_intended_usec = 0;
 		return;
 	}
 
 	c->cur_req_count++;
 	c->mgr->stats.req_count++;
+	c->mgr->stats.req_body_bytes_sent += p.body_len;
+	c->mgr->stats.req_bytes_sent += c->req->req_bytes;
+	if (c->ol_intended_usec != 0)
+		c->req_start_usec = c->ol_intended_usec;
+	else
+		c->req_start_usec = mtime_now_usec();
+	c->ol_intended_usec = 0;
+	clt_mgr_conn_inflight_start(c);
 }
 
+/*
+ * Grab a clt_mgr_conn from the manager pool, or allocate a new one
+ * (and its events) if the pool is empty.
+ *
+ * The events are created with the clt_mgr_conn as their argument,
+ * so pooled entries keep them across reuse.
+ */
 static struct clt_mgr_conn *
-clt_mgr_conn_create(struct clt_mgr *mgr)
+clt_mgr_conn_alloc(struct clt_mgr *mgr)
 {
 	struct clt_mgr_conn *c;
-	const char *addr = NULL, *host = NULL;
+
+	c = TAILQ_FIRST(&mgr->mgr_conn_pool);
+	if (c != NULL) {
+		TAILQ_REMOVE(&mgr->mgr_conn_pool, c, node);
+		mgr->mgr_conn_pool_count--;
+		return (c);
+	}
 
 	c = calloc(1, sizeof(*c));
 	if (c == NULL) {
@@ -515,21 +1131,6 @@ clt_mgr_conn_create(struct clt_mgr *mgr)
 		return (NULL);
 	}
 	c->mgr = mgr;
-
-	/* Select an ipv4 address */
-	addr = cfg_ipv4_array_get_next(&mgr->cfg.ipv4_dst);
-
-	/* cfg.host_hdr == NULL? Then make it == addr */
-	if (mgr->cfg.host_hdr == NULL)
-		host = addr;
-	else
-		host = mgr->cfg.host_hdr;
-
-	c->req = clt_conn_create(mgr->thr, clt_mgr_conn_notify_cb,
-	    c,
-	    addr,
-	    host,
-	    mgr->cfg.port);
 	c->ev_new_http_req = event_new(mgr->thr->t_evbase,
 	    -1,
 	    0,
@@ -540,9 +1141,92 @@ clt_mgr_conn_create(struct clt_mgr *mgr)
 	    0,
 	    clt_mgr_conn_destroy_event,
 	    c);
+	if (c->ev_new_http_req == NULL || c->ev_conn_destroy == NULL) {
+		warnx("%s: event_new failed", __func__);
+		if (c->ev_new_http_req != NULL)
+			event_free(c->ev_new_http_req);
+		if (c->ev_conn_destroy != NULL)
+			event_free(c->ev_conn_destroy);
+		free(c);
+		return (NULL);
+	}
+
+	return (c);
+}
+
+/*
+ * Return a clt_mgr_conn to the manager pool.
+ *
+ * It must not be on the active connection list.
+ */
+static void
+clt_mgr_conn_release(struct clt_mgr_conn *c)
+{
+	struct clt_mgr *mgr = c->mgr;
+	event_t *ev_req = c->ev_new_http_req;
+	event_t *ev_destroy = c->ev_conn_destroy;
+
+	event_del(ev_req);
+	event_del(ev_destroy);
+
+	bzero(c, sizeof(*c));
+	c->mgr = mgr;
+	c->ev_new_http_req = ev_req;
+	c->ev_conn_destroy = ev_destroy;
+
+	TAILQ_INSERT_HEAD(&mgr->mgr_conn_pool, c, node);
+	mgr->mgr_conn_pool_count++;
+}
+
+static void
+clt_mgr_conn_pool_drain(struct clt_mgr *mgr)
+{
+	struct clt_mgr_conn *c;
+
+	while ((c = TAILQ_FIRST(&mgr->mgr_conn_pool)) != NULL) {
+		TAILQ_REMOVE(&mgr->mgr_conn_pool, c, node);
+		mgr->mgr_conn_pool_count--;
+		event_free(c->ev_new_http_req);
+		event_free(c->ev_conn_destroy);
+		free(c);
+	}
+}
+
+static struct clt_mgr_conn *
+clt_mgr_conn_create(struct clt_mgr *mgr)
+{
+	struct clt_mgr_conn *c;
+	const struct sockaddr_in *src = NULL;
+	const char *addr = NULL;
+	int i, ap;
+
+	c = clt_mgr_conn_alloc(mgr);
+	if (c == NULL)
+		return (NULL);
+
+	/* Select an ipv4 address */
+	i = cfg_ipv4_array_select(&mgr->cfg.ipv4_dst, mgr->cfg.dst_policy,
+	    &mgr->rng);
+	addr = mgr->cfg.ipv4_dst.ipv4[i];
+	c->dst_idx = i;
+
+	/* .. and a source address, round-robin, if we have any */
+	if (cfg_ipv4_array_nentries(&mgr->cfg.ipv4_src) > 0)
+		src = &mgr->src_sin[cfg_ipv4_array_get_next_idx(&mgr->cfg.ipv4_src)];
+
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_CONNECT);
+	c->req = clt_conn_create(mgr->thr, clt_mgr_conn_notify_cb,
+	    c,
+	    addr,
+	    src,
+	    &mgr->req_tmpl[i],
+	    mgr->cfg.port,
+	    i);
+	ALLOC_PHASE_EXIT(ap);
 	if (c->req == NULL) {
 		debug_printf("%s: clt_conn_create: failed\n", __func__);
-		goto error;
+		clt_mgr_conn_release(c);
+		return (NULL);
 	}
 	c->target_request_count = mgr->cfg.target_request_count;
 	c->wait_time_pre_http_req_msec = mgr->cfg.wait_time_pre_http_req_msec;
@@ -550,17 +1234,6 @@ clt_mgr_conn_create(struct clt_mgr *mgr)
 	TAILQ_INSERT_TAIL(&mgr->mgr_conn_list, c, node);
 
 	return (c);
-
-error:
-	if (c->req != NULL)
-		clt_conn_destroy(c->req);
-	if (c->ev_new_http_req != NULL)
-		event_free(c->ev_new_http_req);
-	if (c->ev_conn_destroy != NULL)
-		event_free(c->ev_conn_destroy);
-	if (c != NULL)
-		free(c);
-	return (NULL);
 }
 
 static void
@@ -604,7 +1277,17 @@ clt_mgr_state_set_waiting(struct clt_mgr *m)
 
 	clt_mgr_state_change(m, CLT_MGR_STATE_WAITING);
 	clt_mgr_waiting_schedule(m);
+	evtimer_del(m->t_start_timerev);
+	evtimer_del(m->t_warmup_timerev);
 	evtimer_del(m->t_running_timerev);
+	evtimer_del(m->t_conn_timerev);
+	evtimer_del(m->t_tok_timerev);
+	if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE)
+		clt_mgr_ol_stop(m);
+	clt_mgr_idle_stop(m);
+
+	/* Let the other threads use what we drew but won't issue */
+	clt_mgr_budget_return(m);
 }
 
 static void
@@ -620,26 +1303,74 @@ clt_mgr_set_running_timer(struct clt_mgr *m)
 
 }
 
+/*
+ * Follow the load profile: set the global request rate and the
+ * connection limit for now.  Every worker does this each tick; they
+ * all work out the same values.
+ *
+ * The rate may also be changed from outside (eg by --find-max); open
+ * loop workers then take their share of whatever it is now.
+ */
+static void
+clt_mgr_profile_update(struct clt_mgr *m)
+{
+	struct budget *b = m->cfg.budget;
+	uint64_t now, start;
+	double rate;
+	int nconn;
+
+	if (m->cfg.profile != NULL) {
+		now = mtime_now_usec();
+		/* The profile runs from RUNNING; hold at its start till then */
+		start = runctl_running_usec(m->cfg.runctl);
+		(void) profile_at(m->cfg.profile, start != 0 ? start : now,
+		    now, &rate, &nconn);
+		budget_bucket_set_rate(&b->req_rate, (u_long) rate, now);
+		budget_slots_set_max(&b->conn_slots, nconn > 0 ? nconn : 0);
+	}
+
+	if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE && b->req_rate.enabled)
+		m->ol_rate = (double) b->req_rate.rate /
+		    (double) m->cfg.num_threads;
+}
+
+/*
+ * Let the adaptive concurrency limiter see this tick's latency and
+ * completions; connections over a lowered limit close as their
+ * current request finishes.
+ */
+static void
+clt_mgr_aconc_update(struct clt_mgr *m)
+{
+	double rate;
+
+	if (m->aconc == NULL)
+		return;
+	m->stats.conc_limit = aconc_update(m->aconc, mtime_now_usec(),
+	    &m->stats.req_latency_usec,
+	    m->stats.req_count_ok + m->stats.req_count_err);
+	m->stats.conc_knee = aconc_knee(m->aconc, &rate);
+	m->stats.conc_knee_rate = (int) rate;
+}
+
 static void
 clt_mgr_timer_state_running(struct clt_mgr *m)
 {
-	int i, j;
+	int j;
 	struct clt_thr *th = m->thr;
 	struct clt_mgr_conn *c;
 
+	clt_mgr_profile_update(m);
+	clt_mgr_aconc_update(m);
+
 	/*
-	 * Update the request rate pacer, which'll limit how many requests
-	 * we get to issue this burst.
+	 * Open more connections while there are free slots in the
+	 * global budget, up to burst_conn per tick - unless there's
+	 * a connection rate, which then sets the pace.
 	 */
-	if (m->cfg.target_request_rate > 0)
-		clt_mgr_reqrate_pacer_update(m);
-
-	/* XXX TODO: update connection rate pacer */
-
-	for (i = m->stats.nconn, j = 0;
-	    (i < m->cfg.target_nconn &&
-	    j <= m->cfg.burst_conn);
-	    i++, j++) {
+	for (j = 0;
+	    (j <= m->cfg.burst_conn || clt_mgr_connrate_paced(m));
+	    j++) {
 		if (clt_mgr_conn_try_create(m) < 0)
 			break;
 	}
@@ -737,30 +1468,146 @@ clt_mgr_cleanup_timer(evutil_socket_t sock, short which, void *arg)
 	clt_mgr_state_change(m, CLT_MGR_STATE_CLEANUP_WAITING);
 }
 
+/*
+ * The next connection token is due; open as many connections as
+ * are allowed.
+ */
 static void
-clt_mgr_running_timer(evutil_socket_t sock, short which, void *arg)
+clt_mgr_conn_timer(evutil_socket_t sock, short which, void *arg)
 {
 	struct clt_mgr *m = arg;
 
-	/* Timer has fired; so time to force a state to WAITING */
-	clt_mgr_state_set_waiting(m);
+	clt_mgr_loop_callback(m);
+	if (! clt_mgr_state_loading(m))
+		return;
+	while (clt_mgr_conn_try_create(m) == 0)
+		;
 }
 
+/*
+ * Warmup is over: start counting from here.  Every thread's timer
+ * is set for the same absolute time, so they all switch together.
+ */
 static void
-clt_mgr_stat_timer(evutil_socket_t sock, short which, void *arg)
+clt_mgr_warmup_timer(evutil_socket_t sock, short which, void *arg)
 {
 	struct clt_mgr *m = arg;
+
+	if (m->mgr_state != CLT_MGR_STATE_WARMUP)
+		return;
+
+	mgr_stats_reset(&m->stats);
+	if (m->aconc != NULL)
+		aconc_reset(m->aconc, mtime_now_usec());
+
+	clt_mgr_set_running_timer(m);
+	clt_mgr_state_change(m, CLT_MGR_STATE_RUNNING);
+	clt_thr_stats_publish(m->thr, m->mgr_state, &m->stats);
+}
+
+/*
+ * Open this thread's share of the connections, as fast as they're
+ * allowed, and arrive at the start barrier once they're all up.
+ * Then wait for the common start time.
+ */
+static void
+clt_mgr_timer_state_init(struct clt_mgr *m)
+{
+	struct clt_mgr_conn *c;
 	struct timeval tv;
+	uint64_t now, start;
+
+	now = mtime_now_usec();
+	if (! m->init_ready) {
+		while (m->cfg.target_nconn > 0 &&
+		    m->stats.nconn < m->cfg.target_nconn) {
+			if (clt_mgr_conn_try_create(m) < 0)
+				break;
+		}
 
-	m->stats_cb(m, m->stats_cb_data, &m->stats);
+		TAILQ_FOREACH(c, &m->mgr_conn_list, node) {
+			if (! c->is_dead && ! clt_conn_is_established(c->req))
+				break;
+		}
+		if (c != NULL &&
+		    now - m->init_start_usec < RUNCTL_PREWARM_TIMEOUT_USEC)
+			return;
+		if (c != NULL)
+			printf("%s: [%d] timed out waiting for connections\n",
+			    __func__, m->thr->t_tid);
+
+		printf("%s: [%d] %d connections open, ready\n",
+		    __func__, m->thr->t_tid, m->stats.nconn);
+		m->init_ready = 1;
+		runctl_arrive(m->cfg.runctl);
+	}
 
-	/* Don't add the timer again if we've hit COMPLETED */
-	if (m->mgr_state == CLT_MGR_STATE_COMPLETED)
+	if (evtimer_pending(m->t_start_timerev, NULL))
+		return;
+	start = runctl_start_usec(m->cfg.runctl);
+	if (start == 0)
 		return;
-
 	tv.tv_sec = 0;
-	tv.tv_usec = 250000;
-	evtimer_add(m->t_stat_timerev, &tv);
+	tv.tv_usec = 0;
+	if (start > now) {
+		tv.tv_sec = (start - now) / 1000000;
+		tv.tv_usec = (start - now) % 1000000;
+	}
+	evtimer_add(m->t_start_timerev, &tv);
+}
+
+/*
+ * Everyone is ready; start the load, warming up first until the
+ * common running time if there's a warmup period.
+ */
+static void
+clt_mgr_start_timer(evutil_socket_t sock, short which, void *arg)
+{
+	struct clt_mgr *m = arg;
+	struct clt_mgr_conn *c, *cn;
+	struct timeval tv;
+	uint64_t now, running;
+
+	if (m->mgr_state != CLT_MGR_STATE_INIT)
+		return;
+
+	now = mtime_now_usec();
+	running = runctl_running_usec(m->cfg.runctl);
+	if (running > now) {
+		tv.tv_sec = (running - now) / 1000000;
+		tv.tv_usec = (running - now) % 1000000;
+		evtimer_add(m->t_warmup_timerev, &tv);
+		clt_mgr_state_change(m, CLT_MGR_STATE_WARMUP);
+	} else {
+		clt_mgr_set_running_timer(m);
+		clt_mgr_state_change(m, CLT_MGR_STATE_RUNNING);
+	}
+	clt_mgr_profile_update(m);
+
+	/* Put the prewarmed connections to work */
+	TAILQ_FOREACH_SAFE(c, &m->mgr_conn_list, node, cn) {
+		if (c->is_dead)
+			continue;
+		if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE)
+			clt_mgr_ol_conn_ready(c);
+		else if (clt_mgr_conn_next_http_req(c) != 0)
+			clt_mgr_conn_destroy(c);
+	}
+
+	/* First open loop arrival is now */
+	if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE) {
+		m->ol_next_usec = (double) now;
+		clt_mgr_ol_schedule(m, now);
+	}
+}
+
+static void
+clt_mgr_running_timer(evutil_socket_t sock, short which, void *arg)
+{
+	struct clt_mgr *m = arg;
+
+	/* Timer has fired; so time to force a state to WAITING */
+	clt_mgr_state_set_waiting(m);
 }
 
 static void
@@ -769,8 +1616,23 @@ clt_mgr_timer(evutil_socket_t sock, short which, void *arg)
 	int i, j;
 	struct clt_mgr *m = arg;
 	struct timeval tv;
+	uint64_t now;
+
+	/*
+	 * How late are we?  libevent times the next firing from
+	 * (about) when this iteration's callbacks began, so take the
+	 * time now rather than at evtimer_add().
+	 */
+	now = mtime_now_usec();
+	clt_mgr_loop_callback(m);
+	if (m->loopmon != NULL)
+		loopmon_timer_fired(m->loopmon, now);
 
 	switch (m->mgr_state) {
+	case CLT_MGR_STATE_INIT:
+		clt_mgr_timer_state_init(m);
+		break;
+	case CLT_MGR_STATE_WARMUP:
 	case CLT_MGR_STATE_RUNNING:
 		clt_mgr_timer_state_running(m);
 		break;
@@ -791,6 +1653,9 @@ clt_mgr_timer(evutil_socket_t sock, short which, void *arg)
 		    clt_mgr_state_str(m->mgr_state));
 	}
 
+	/* Publish stats for the stats thread; this includes the final set */
+	clt_thr_stats_publish(m->thr, m->mgr_state, &m->stats);
+
 	/* Nope, don't add the timer again if we've hit COMPLETED */
 	if (m->mgr_state == CLT_MGR_STATE_COMPLETED)
 		return;
@@ -798,24 +1663,62 @@ clt_mgr_timer(evutil_socket_t sock, short which, void *arg)
 	tv.tv_sec = PERIODIC_TIMEREV_SEC;
 	tv.tv_usec = PERIODIC_TIMEREV_USEC;
 	evtimer_add(m->t_timerev, &tv);
+	if (m->loopmon != NULL)
+		loopmon_timer_due(m->loopmon, now +
+		    PERIODIC_TIMEREV_SEC * 1000000 + PERIODIC_TIMEREV_USEC);
 }
 
 int
-clt_mgr_setup(struct clt_mgr *m, struct clt_thr *th,
-    clt_thr_stats_notify_cb *scb, void *cbdata)
+clt_mgr_setup(struct clt_mgr *m, struct clt_thr *th)
 {
 	m->thr = th;
+	th->t_mstats = &m->stats;
+
+	/* Seed differently per thread and per run */
+	rng_seed(&m->rng, mtime_now_usec() ^ ((uint64_t) th->t_tid << 32));
 
 	/* Tracking list! */
 	TAILQ_INIT(&m->mgr_conn_list);
+	TAILQ_INIT(&m->mgr_conn_pool);
+	TAILQ_INIT(&m->idle_list);
 
 	m->t_timerev = evtimer_new(th->t_evbase, clt_mgr_timer, m);
-	m->t_stat_timerev = evtimer_new(th->t_evbase, clt_mgr_stat_timer, m);
 	m->t_wait_timerev = evtimer_new(th->t_evbase, clt_mgr_waiting_timer, m);
 	m->t_cleanup_timerev = evtimer_new(th->t_evbase, clt_mgr_cleanup_timer, m);
 	m->t_running_timerev = evtimer_new(th->t_evbase, clt_mgr_running_timer, m);
-	m->stats_cb = scb;
-	m->stats_cb_data = cbdata;
+	m->t_warmup_timerev = evtimer_new(th->t_evbase, clt_mgr_warmup_timer, m);
+	m->t_start_timerev = evtimer_new(th->t_evbase, clt_mgr_start_timer, m);
+	m->t_ol_timerev = evtimer_new(th->t_evbase, clt_mgr_ol_timer, m);
+	m->t_conn_timerev = evtimer_new(th->t_evbase, clt_mgr_conn_timer, m);
+	m->t_tok_timerev = evtimer_new(th->t_evbase, clt_mgr_tok_timer, m);
+
+	return (0);
+}
+
+/*
+ * Build the per-destination request header templates.
+ *
+ * This is done once at start rather than per request.
+ */
+static int
+clt_mgr_req_tmpl_setup(struct clt_mgr *m)
+{
+	const char *host;
+	int i;
+
+	for (i = 0; i < cfg_ipv4_array_nentries(&m->cfg.ipv4_dst); i++) {
+		/* cfg.host_hdr == NULL? Then make it == addr */
+		if (m->cfg.host_hdr == NULL)
+			host = m->cfg.ipv4_dst.ipv4[i];
+		else
+			host = m->cfg.host_hdr;
+
+		if (clt_req_tmpl_init(&m->req_tmpl[i], host,
+		    m->cfg.http_keepalive,
+		    m->cfg.hdrs.hdr,
+		    m->cfg.hdrs.n) != 0)
+			return (-1);
+	}
 
 	return (0);
 }
@@ -824,23 +1727,195 @@ int
 clt_mgr_start(struct clt_mgr *m)
 {
 	struct timeval tv;
+	int i;
 
-	/* Set running timer */
-	clt_mgr_set_running_timer(m);
+	if (clt_mgr_req_tmpl_setup(m) != 0)
+		return (-1);
 
-	/* Bump to running */
-	clt_mgr_state_change(m, CLT_MGR_STATE_RUNNING);
+	for (i = 0; i < cfg_ipv4_array_nentries(&m->cfg.ipv4_src); i++) {
+		if (src_bind_parse(&m->src_sin[i], m->cfg.ipv4_src.ipv4[i]) != 0) {
+			fprintf(stderr, "%s: invalid source address (%s)\n",
+			    __func__, m->cfg.ipv4_src.ipv4[i]);
+			return (-1);
+		}
+	}
+
+	tw_set_timeouts(m->thr->t_tw, m->cfg.idle_timeout_msec,
+	    m->cfg.request_timeout_msec);
+
+	/* The trace is mapped once in main(); each thread has a stride */
+	if (m->cfg.trace != NULL) {
+		m->trace = m->cfg.trace;
+		m->trace_stride = m->cfg.num_threads > 0 ? m->cfg.num_threads : 1;
+		m->trace_first = m->thr->t_tid % m->trace->nrecords;
+		m->trace_cur = m->trace_first;
+	}
+
+	/* Compile the URI template once, rather than per request */
+	if (m->trace == NULL && uri_tmpl_is_template(m->cfg.uri)) {
+		m->uri_tmpl = calloc(1, sizeof(*m->uri_tmpl));
+		if (m->uri_tmpl == NULL) {
+			warn("%s: calloc", __func__);
+			return (-1);
+		}
+		if (uri_tmpl_compile(m->uri_tmpl, m->cfg.uri,
+		    m->thr->t_tid) != 0) {
+			free(m->uri_tmpl);
+			m->uri_tmpl = NULL;
+			return (-1);
+		}
+	}
+
+	/* Per-thread TLS context and session cache */
+	if (m->cfg.tls) {
+		struct clt_tls_cfg tc;
+
+		bzero(&tc, sizeof(tc));
+		tc.session_reuse = m->cfg.tls_session_reuse;
+		tc.tickets = m->cfg.tls_tickets;
+		tc.ciphers = m->cfg.tls_ciphers;
+		tc.alpn = m->cfg.tls_alpn;
+		tc.sni = m->cfg.host_hdr;
+		m->thr->t_tls = clt_tls_new(&tc, &m->stats);
+		if (m->thr->t_tls == NULL)
+			return (-1);
+	}
+
+	/* Open loop arrival backlog */
+	if (m->cfg.open_loop != CFG_OPEN_LOOP_NONE) {
+		if (m->cfg.target_request_rate <= 0 && m->cfg.profile == NULL) {
+			fprintf(stderr, "%s: open loop needs a request rate\n",
+			    __func__);
+			return (-1);
+		}
+		m->ol_rate = m->cfg.target_request_rate;
+		m->ol_ring_size = m->cfg.open_loop_backlog;
+		m->ol_ring = calloc(m->ol_ring_size, sizeof(*m->ol_ring));
+		if (m->ol_ring == NULL) {
+			warn("%s: calloc", __func__);
+			return (-1);
+		}
+	}
+
+	/* Body size distribution; validated in main() */
+	if (m->cfg.body != NULL && m->cfg.body_size != NULL) {
+		m->body_size = calloc(1, sizeof(*m->body_size));
+		if (m->body_size == NULL) {
+			warn("%s: calloc", __func__);
+			return (-1);
+		}
+		if (dist_parse(m->body_size, m->cfg.body_size) != 0)
+			return (-1);
+	}
+
+	/* Adaptive concurrency; target_nconn is the most it'll go to */
+	if (m->cfg.adaptive_conc) {
+		m->aconc = calloc(1, sizeof(*m->aconc));
+		if (m->aconc == NULL) {
+			warn("%s: calloc", __func__);
+			return (-1);
+		}
+		if (aconc_init(m->aconc, m->cfg.target_nconn,
+		    mtime_now_usec()) != 0) {
+			free(m->aconc);
+			m->aconc = NULL;
+			return (-1);
+		}
+		m->stats.conc_limit = m->aconc->limit;
+	}
+
+	/* Start from the beginning of the load profile, if any */
+	clt_mgr_profile_update(m);
+
+	/*
+	 * Prewarm connections in INIT; the load starts once every
+	 * thread is ready (see runctl.h.)
+	 */
+	m->init_start_usec = mtime_now_usec();
+	clt_mgr_state_change(m, CLT_MGR_STATE_INIT);
+
+	/* Event loop health */
+	m->loopmon = calloc(1, sizeof(*m->loopmon));
+	if (m->loopmon == NULL) {
+		warn("%s: calloc", __func__);
+		return (-1);
+	}
+	if (loopmon_init(m->loopmon, m->thr->t_evbase, &m->stats,
+	    m->cfg.loop_lag_warn_usec) != 0) {
+		free(m->loopmon);
+		m->loopmon = NULL;
+		return (-1);
+	}
 
 	/* Start things */
 	tv.tv_sec = PERIODIC_TIMEREV_SEC;
 	tv.tv_usec = PERIODIC_TIMEREV_USEC;
 	evtimer_add(m->t_timerev, &tv);
-
-	tv.tv_sec = 1;
-	tv.tv_usec = 0;
-	evtimer_add(m->t_stat_timerev, &tv);
+	loopmon_timer_due(m->loopmon, mtime_now_usec() +
+	    PERIODIC_TIMEREV_SEC * 1000000 + PERIODIC_TIMEREV_USEC);
 
 	return (0);
 }
 
+/*
+ * Run the thread event loop until no events remain.
+ *
+ * The loop is run a pass at a time so loopmon can count iterations
+ * where libevent has no watchers to do it for us.
+ */
+void
+clt_mgr_run(struct clt_mgr *m)
+{
+
+	while (event_base_loop(m->thr->t_evbase, EVLOOP_ONCE) == 0) {
+		if (m->loopmon != NULL)
+			loopmon_iteration(m->loopmon);
+	}
+}
 
+/*
+ * Free the manager resources that hang off the thread event base.
+ *
+ * Called once the thread event loop has finished.
+ */
+void
+clt_mgr_free(struct clt_mgr *m)
+{
+	int i;
+
+	clt_mgr_conn_pool_drain(m);
+	for (i = 0; i < CFG_IPV4_ARRAY_MAX; i++)
+		clt_req_tmpl_free(&m->req_tmpl[i]);
+	m->trace = NULL;
+	if (m->uri_tmpl != NULL) {
+		uri_tmpl_free(m->uri_tmpl);
+		free(m->uri_tmpl);
+		m->uri_tmpl = NULL;
+	}
+	free(m->body_size);
+	m->body_size = NULL;
+	free(m->ol_ring);
+	m->ol_ring = NULL;
+	if (m->aconc != NULL) {
+		aconc_free(m->aconc);
+		free(m->aconc);
+		m->aconc = NULL;
+	}
+	if (m->loopmon != NULL) {
+		loopmon_free(m->loopmon);
+		free(m->loopmon);
+		m->loopmon = NULL;
+	}
+	clt_tls_free(m->thr->t_tls);
+	m->thr->t_tls = NULL;
+
+	event_free(m->t_timerev);
+	event_free(m->t_wait_timerev);
+	event_free(m->t_cleanup_timerev);
+	event_free(m->t_running_timerev);
+	event_free(m->t_warmup_timerev);
+	event_free(m->t_start_timerev);
+	event_free(m->t_ol_timerev);
+	event_free(m->t_conn_timerev);
+	event_free(m->t_tok_timerev);
+}
@@ -4,6 +4,7 @@
 typedef enum {
 	CLT_MGR_STATE_NONE,
 	CLT_MGR_STATE_INIT,
+	CLT_MGR_STATE_WARMUP,
 	CLT_MGR_STATE_RUNNING,
 	CLT_MGR_STATE_WAITING,
 	CLT_MGR_STATE_CLEANUP,
@@ -13,11 +14,8 @@ typedef enum {
 
 struct clt_mgr_conn;
 struct clt_mgr;
-
-typedef	void clt_thr_stats_notify_cb(struct clt_mgr *mgr,
-	    void *arg,
-	    const struct mgr_stats *stats);
-
+struct aconc;
+struct loopmon;
 
 /*
  * This is the instance of a client manager.
@@ -31,11 +29,23 @@ struct clt_mgr {
 	/* List of http connection s*/
 	TAILQ_HEAD(, clt_mgr_conn) mgr_conn_list;
 
+	/* Free pool of connections; they're on one list or the other */
+	TAILQ_HEAD(, clt_mgr_conn) mgr_conn_pool;
+	int mgr_conn_pool_count;
+
 	/* Periodic event */
 	event_t  *t_timerev;
 
-	/* Statistics timer event */
-	event_t  *t_stat_timerev;
+	/*
+	 * INIT: when prewarming started, whether we've arrived at the
+	 * start barrier, and the timer for the common start time.
+	 */
+	uint64_t init_start_usec;
+	int init_ready;
+	event_t *t_start_timerev;
+
+	/* WARMUP timer event; fires when RUNNING should start */
+	event_t *t_warmup_timerev;
 
 	/* RUNNING timer event */
 	event_t *t_running_timerev;
@@ -49,14 +59,69 @@ struct clt_mgr {
 	/* Configuration */
 	struct mgr_config cfg;
 
-	/* Stats notify cb */
-	clt_thr_stats_notify_cb *stats_cb;
-	void *stats_cb_data;
-
-	/* Request rate pacing */
-	int request_rate_error;
-	int request_count_cur;
-	int request_count_target;
+	/* Per-thread PRNG */
+	struct rng rng;
+
+	/* Trace replay; NULL if we're not replaying a trace */
+	const struct trace *trace;
+	uint64_t trace_cur;
+	uint64_t trace_first;
+	uint64_t trace_stride;
+
+	/* Compiled --uri template; NULL if the URI is fixed */
+	struct uri_tmpl *uri_tmpl;
+
+	/* Request body size distribution; NULL to send the whole buffer */
+	struct dist *body_size;
+
+	/* Pre-serialised request headers, one per destination */
+	struct clt_req_tmpl req_tmpl[CFG_IPV4_ARRAY_MAX];
+
+	/* Parsed source addresses, one per cfg.ipv4_src entry */
+	struct sockaddr_in src_sin[CFG_IPV4_ARRAY_MAX];
+
+	/*
+	 * Open loop arrivals: this thread's arrival rate, the next
+	 * scheduled arrival time and a ring of scheduled-but-unsent
+	 * arrival times.
+	 */
+	event_t *t_ol_timerev;
+	double ol_rate;
+	double ol_next_usec;
+	uint64_t *ol_ring;
+	int ol_ring_size;
+	int ol_ring_head;
+
+	/*
+	 * Connections idle waiting for an open loop arrival or, for
+	 * closed loop, a request rate token.
+	 */
+	TAILQ_HEAD(, clt_mgr_conn) idle_list;
+
+	/*
+	 * What this thread has drawn from the global budget but not
+	 * yet used.
+	 */
+	u_long bud_req_tokens;
+	u_long bud_conn_tokens;
+	u_long bud_req_count;
+	u_long bud_conn_count;
+
+	/* Timers to retry when the next request/connection token is due */
+	event_t *t_tok_timerev;
+	event_t *t_conn_timerev;
+
+	/* Adaptive concurrency limiter, or NULL for a fixed target_nconn */
+	struct aconc *aconc;
+
+	/*
+	 * Connections marked dead but not yet torn down; stats.nconn
+	 * only drops once the deferred destroy runs.
+	 */
+	int nconn_closing;
+
+	/* Event loop health */
+	struct loopmon *loopmon;
 
 	/* statistics */
 	struct mgr_stats stats;
@@ -69,7 +134,7 @@ struct clt_mgr {
 struct clt_mgr_conn {
 	struct clt_mgr *mgr;
 
-	/* Entry on the manager list */
+	/* Entry on the manager list, or the manager free pool */
 	TAILQ_ENTRY(clt_mgr_conn) node;
 
 	/* Is this shutting down? */
@@ -87,20 +152,45 @@ struct clt_mgr_conn {
 	/* The actual connection/request */
 	struct client_req *req;
 
+	/* Which cfg.ipv4_dst entry we're connected to */
+	int dst_idx;
+
+	/* Is a request outstanding (counted in the dst inflight count?) */
+	int req_inflight;
+
+	/* Has this given back its budget connection slot already? */
+	int slot_shed;
+
 	/* Schedule to issue a new HTTP request */
 	event_t *ev_new_http_req;
 
 	/* Shutdown/delete the current connection */
 	event_t *ev_conn_destroy;
 
+	/* Entry on the idle list, if on_idle */
+	TAILQ_ENTRY(clt_mgr_conn) idle_node;
+	int on_idle;
+
+	/*
+	 * When the current request was sent - or, for open loop,
+	 * scheduled - for latency; and the scheduled time of the
+	 * next open loop request, or 0.
+	 */
+	uint64_t req_start_usec;
+	uint64_t ol_intended_usec;
+
+	/* Trace record for the next request, if replaying a trace */
+	const struct trace_rec *trace_rec;
+
 	/* Is a (new) queued HTTP request pending? */
 	/* (Ie, it hasn't yet been started; just queued */
 	int pending_http_req;
 };
 
 extern	const char *clt_mgr_state_str(clt_mgr_state_t state);
-extern	int clt_mgr_setup(struct clt_mgr *m, struct clt_thr *th,
-	    clt_thr_stats_notify_cb *scb, void *scb_data);
+extern	int clt_mgr_setup(struct clt_mgr *m, struct clt_thr *th);
 extern	int clt_mgr_start(struct clt_mgr *m);
+extern	void clt_mgr_run(struct clt_mgr *m);
+extern	void clt_mgr_free(struct clt_mgr *m);
 
 #endif	/* __MGR_H__ */
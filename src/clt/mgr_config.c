@@ -1,14 +1,37 @@
+#include <sys/types.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+
+#include "rng.h"
 #include "mgr_config.h"
 
+/*
+ * Split a global value between nthreads; the first (value % nthreads)
+ * threads get one more, so the parts add up to the whole.  Values
+ * <= 0 mean "unlimited" or "none" and are passed through.
+ */
+static int
+mgr_config_split(int val, int nthreads, int tid)
+{
+
+	if (val <= 0)
+		return (val);
+	return (val / nthreads + (tid < val % nthreads ? 1 : 0));
+}
+
 /*
  * Divvy up the thread contents of the configuration
  * setup to each thread.
+ *
+ * Connection slots, request/connection rates and the global counts
+ * are enforced through the shared budget, so the split values here
+ * are only each thread's nominal share.
  */
 int
 mgr_config_copy_thread(const struct mgr_config *src_cfg,
-    struct mgr_config *cfg, int nthreads)
+    struct mgr_config *cfg, int nthreads, int tid)
 {
 
 	/* Paranoia */
@@ -16,39 +39,67 @@ mgr_config_copy_thread(const struct mgr_config *src_cfg,
 		nthreads = 1;
 
 	cfg->num_threads = src_cfg->num_threads;
-	cfg->burst_conn = src_cfg->burst_conn / nthreads;
-	cfg->target_nconn = src_cfg->target_nconn / nthreads;
+	cfg->burst_conn = mgr_config_split(src_cfg->burst_conn, nthreads, tid);
+	cfg->target_nconn = mgr_config_split(src_cfg->target_nconn, nthreads,
+	    tid);
 	cfg->target_request_count = src_cfg->target_request_count;
-
-	if (src_cfg->target_request_rate > 0) {
-		cfg->target_request_rate = src_cfg->target_request_rate / nthreads;
-	} else {
-		cfg->target_request_rate = src_cfg->target_request_rate;
-	}
-
-	if (src_cfg->target_global_request_count > 0) {
-		cfg->target_global_request_count = src_cfg->target_global_request_count / nthreads;
-	} else {
-		cfg->target_global_request_count = src_cfg->target_global_request_count;
-	}
-
-	if (src_cfg->target_total_nconn_count > 0) {
-		cfg->target_total_nconn_count = src_cfg->target_total_nconn_count / nthreads;
-	} else {
-		cfg->target_total_nconn_count = src_cfg->target_total_nconn_count;
-	}
+	cfg->target_request_rate =
+	    mgr_config_split(src_cfg->target_request_rate, nthreads, tid);
+	cfg->target_conn_rate =
+	    mgr_config_split(src_cfg->target_conn_rate, nthreads, tid);
+	cfg->target_global_request_count =
+	    mgr_config_split(src_cfg->target_global_request_count, nthreads,
+	    tid);
+	cfg->target_total_nconn_count =
+	    mgr_config_split(src_cfg->target_total_nconn_count, nthreads, tid);
 
 	cfg->running_period_sec = src_cfg->running_period_sec;
+	cfg->warmup_period_sec = src_cfg->warmup_period_sec;
+	cfg->loop_lag_warn_usec = src_cfg->loop_lag_warn_usec;
 	cfg->waiting_period_sec = src_cfg->waiting_period_sec;
 
 	cfg_ipv4_array_dup(&cfg->ipv4_dst, &src_cfg->ipv4_dst);
+	cfg->dst_policy = src_cfg->dst_policy;
+	cfg_ipv4_array_dup(&cfg->ipv4_src, &src_cfg->ipv4_src);
 
 	if (src_cfg->host_hdr != NULL)
 		cfg->host_hdr = strdup(src_cfg->host_hdr);
 	cfg->port = src_cfg->port;
-	cfg->uri = strdup(src_cfg->uri);
+	if (src_cfg->uri != NULL)
+		cfg->uri = strdup(src_cfg->uri);
+	if (src_cfg->trace_file != NULL)
+		cfg->trace_file = strdup(src_cfg->trace_file);
 	cfg->wait_time_pre_http_req_msec = src_cfg->wait_time_pre_http_req_msec;
 	cfg->http_keepalive = src_cfg->http_keepalive;
+	cfg->idle_timeout_msec = src_cfg->idle_timeout_msec;
+	cfg->request_timeout_msec = src_cfg->request_timeout_msec;
+	if (cfg_hdr_array_dup(&cfg->hdrs, &src_cfg->hdrs) != 0)
+		return (-1);
+	cfg->http_method = src_cfg->http_method;
+	if (src_cfg->body_size != NULL)
+		cfg->body_size = strdup(src_cfg->body_size);
+	if (src_cfg->body_file != NULL)
+		cfg->body_file = strdup(src_cfg->body_file);
+	cfg->body_chunked = src_cfg->body_chunked;
+	cfg->body = src_cfg->body;
+	cfg->trace = src_cfg->trace;
+	cfg->tls = src_cfg->tls;
+	cfg->tls_session_reuse = src_cfg->tls_session_reuse;
+	cfg->tls_tickets = src_cfg->tls_tickets;
+	if (src_cfg->tls_ciphers != NULL)
+		cfg->tls_ciphers = strdup(src_cfg->tls_ciphers);
+	if (src_cfg->tls_alpn != NULL)
+		cfg->tls_alpn = strdup(src_cfg->tls_alpn);
+
+	cfg->open_loop = src_cfg->open_loop;
+	cfg->open_loop_backlog = mgr_config_split(src_cfg->open_loop_backlog,
+	    nthreads, tid);
+	if (cfg->open_loop_backlog < 1)
+		cfg->open_loop_backlog = 1;
+	cfg->budget = src_cfg->budget;
+	cfg->profile = src_cfg->profile;
+	cfg->runctl = src_cfg->runctl;
+	cfg->adaptive_conc = src_cfg->adaptive_conc;
 
 	return (0);
 }
@@ -67,6 +118,39 @@ cfg_ipv4_array_add(struct cfg_ipv4_array *a, const char *addr)
 	if (a->n >= CFG_IPV4_ARRAY_MAX)
 		return (-1);
 	a->ipv4[a->n] = strdup(addr);
+	a->weight[a->n] = 1;
+	a->n++;
+
+	return (0);
+}
+
+/*
+ * Add an "addr[:weight]" entry.
+ */
+int
+cfg_ipv4_array_add_weighted(struct cfg_ipv4_array *a, const char *str)
+{
+	char *p, *s;
+	int w = 1;
+
+	if (a->n >= CFG_IPV4_ARRAY_MAX)
+		return (-1);
+
+	s = strdup(str);
+	if (s == NULL)
+		return (-1);
+	p = strchr(s, ':');
+	if (p != NULL) {
+		*p = '\0';
+		w = atoi(p + 1);
+		if (w <= 0) {
+			free(s);
+			return (-1);
+		}
+	}
+
+	a->ipv4[a->n] = s;
+	a->weight[a->n] = w;
 	a->n++;
 
 	return (0);
@@ -79,29 +163,216 @@ cfg_ipv4_array_dup(struct cfg_ipv4_array *dst, const struct cfg_ipv4_array *src)
 
 	for (i = 0; i < src->n; i++) {
 		dst->ipv4[i] = strdup(src->ipv4[i]);
+		dst->weight[i] = src->weight[i];
+		dst->cur_weight[i] = 0;
+		dst->inflight[i] = 0;
 	}
 	dst->n = src->n;
 }
 
-const char *
-cfg_ipv4_array_get_random(const struct cfg_ipv4_array *r)
+static int
+cfg_ipv4_array_get_random_idx(const struct cfg_ipv4_array *r,
+    struct rng *rng)
 {
 
-	/* Don't bother calling random() if we only have one address */
+	/* Don't bother with the rng if we only have one address */
 	if (r->n == 1)
-		return (r->ipv4[0]);
+		return (0);
+
+	return (rng_uniform(rng, r->n));
+}
 
-	return (r->ipv4[random() % r->n]);
+const char *
+cfg_ipv4_array_get_random(const struct cfg_ipv4_array *r, struct rng *rng)
+{
+
+	return (r->ipv4[cfg_ipv4_array_get_random_idx(r, rng)]);
 }
 
 const char *
 cfg_ipv4_array_get_next(struct cfg_ipv4_array *r)
 {
-	const char *c;
 
-	c = r->ipv4[r->cur];
+	return (r->ipv4[cfg_ipv4_array_get_next_idx(r)]);
+}
+
+int
+cfg_ipv4_array_get_next_idx(struct cfg_ipv4_array *r)
+{
+	int i;
+
+	i = r->cur;
+	r->cur = (r->cur + 1) % r->n;
+	return (i);
+}
+
+/*
+ * Smooth weighted round robin - each entry gets picked in proportion
+ * to its weight, but interleaved rather than in runs.
+ */
+static int
+cfg_ipv4_array_get_weighted_idx(struct cfg_ipv4_array *r)
+{
+	int i, best = 0, total = 0;
+
+	for (i = 0; i < r->n; i++) {
+		r->cur_weight[i] += r->weight[i];
+		total += r->weight[i];
+		if (r->cur_weight[i] > r->cur_weight[best])
+			best = i;
+	}
+	r->cur_weight[best] -= total;
+	return (best);
+}
+
+/*
+ * Pick the entry with the fewest outstanding requests.
+ *
+ * The scan starts from a rotating position so ties are spread out
+ * rather than always landing on the first entry.
+ */
+static int
+cfg_ipv4_array_get_least_idx(struct cfg_ipv4_array *r)
+{
+	int i, j, best;
+
+	best = r->cur;
+	for (i = 1; i < r->n; i++) {
+		j = (r->cur + i) % r->n;
+		if (r->inflight[j] < r->inflight[best])
+			best = j;
+	}
 	r->cur = (r->cur + 1) % r->n;
-	return (c);
+	return (best);
+}
+
+/*
+ * Power of two choices - pick two entries at random and use the one
+ * with fewer outstanding requests.
+ */
+static int
+cfg_ipv4_array_get_p2c_idx(struct cfg_ipv4_array *r, struct rng *rng)
+{
+	int a, b;
+
+	if (r->n == 1)
+		return (0);
+
+	a = rng_uniform(rng, r->n);
+	b = rng_uniform(rng, r->n - 1);
+	if (b >= a)
+		b++;
+
+	return (r->inflight[b] < r->inflight[a] ? b : a);
+}
+
+/*
+ * Select a destination according to the given policy; returns
+ * its index.
+ */
+int
+cfg_ipv4_array_select(struct cfg_ipv4_array *r, cfg_dst_policy_t policy,
+    struct rng *rng)
+{
+
+	switch (policy) {
+	case CFG_DST_POLICY_RANDOM:
+		return (cfg_ipv4_array_get_random_idx(r, rng));
+	case CFG_DST_POLICY_WEIGHTED:
+		return (cfg_ipv4_array_get_weighted_idx(r));
+	case CFG_DST_POLICY_LEAST_OUTSTANDING:
+		return (cfg_ipv4_array_get_least_idx(r));
+	case CFG_DST_POLICY_P2C:
+		return (cfg_ipv4_array_get_p2c_idx(r, rng));
+	case CFG_DST_POLICY_RR:
+	default:
+		return (cfg_ipv4_array_get_next_idx(r));
+	}
+}
+
+void
+cfg_ipv4_array_inflight_inc(struct cfg_ipv4_array *r, int i)
+{
+
+	r->inflight[i]++;
+}
+
+void
+cfg_ipv4_array_inflight_dec(struct cfg_ipv4_array *r, int i)
+{
+
+	r->inflight[i]--;
+}
+
+int
+cfg_dst_policy_parse(const char *str, cfg_dst_policy_t *p)
+{
+
+	if (strcasecmp(str, "rr") == 0 ||
+	    strcasecmp(str, "round-robin") == 0)
+		*p = CFG_DST_POLICY_RR;
+	else if (strcasecmp(str, "random") == 0)
+		*p = CFG_DST_POLICY_RANDOM;
+	else if (strcasecmp(str, "weighted") == 0)
+		*p = CFG_DST_POLICY_WEIGHTED;
+	else if (strcasecmp(str, "least-outstanding") == 0)
+		*p = CFG_DST_POLICY_LEAST_OUTSTANDING;
+	else if (strcasecmp(str, "p2c") == 0)
+		*p = CFG_DST_POLICY_P2C;
+	else
+		return (-1);
+	return (0);
+}
+
+const char *
+cfg_dst_policy_str(cfg_dst_policy_t p)
+{
+
+	switch (p) {
+	case CFG_DST_POLICY_RR:
+		return "rr";
+	case CFG_DST_POLICY_RANDOM:
+		return "random";
+	case CFG_DST_POLICY_WEIGHTED:
+		return "weighted";
+	case CFG_DST_POLICY_LEAST_OUTSTANDING:
+		return "least-outstanding";
+	case CFG_DST_POLICY_P2C:
+		return "p2c";
+	default:
+		return "<unknown>";
+	}
+}
+
+int
+cfg_open_loop_parse(const char *str, cfg_open_loop_t *p)
+{
+
+	if (strcasecmp(str, "none") == 0)
+		*p = CFG_OPEN_LOOP_NONE;
+	else if (strcasecmp(str, "const") == 0)
+		*p = CFG_OPEN_LOOP_CONST;
+	else if (strcasecmp(str, "poisson") == 0)
+		*p = CFG_OPEN_LOOP_POISSON;
+	else
+		return (-1);
+	return (0);
+}
+
+const char *
+cfg_open_loop_str(cfg_open_loop_t p)
+{
+
+	switch (p) {
+	case CFG_OPEN_LOOP_NONE:
+		return "none";
+	case CFG_OPEN_LOOP_CONST:
+		return "const";
+	case CFG_OPEN_LOOP_POISSON:
+		return "poisson";
+	default:
+		return "<unknown>";
+	}
 }
 
 int
@@ -110,3 +381,44 @@ cfg_ipv4_array_nentries(const struct cfg_ipv4_array *r)
 
 	return (r->n);
 }
+
+int
+cfg_hdr_array_add(struct cfg_hdr_array *a, const char *hdr)
+{
+
+	if (a->n >= CFG_HDR_ARRAY_MAX)
+		return (-1);
+
+	/* Must at least look like "Name: value" */
+	if (strchr(hdr, ':') == NULL || hdr[0] == ':')
+		return (-1);
+
+	a->hdr[a->n] = strdup(hdr);
+	if (a->hdr[a->n] == NULL)
+		return (-1);
+	a->n++;
+
+	return (0);
+}
+
+int
+cfg_hdr_array_dup(struct cfg_hdr_array *dst, const struct cfg_hdr_array *src)
+{
+	int i;
+
+	for (i = 0; i < src->n; i++) {
+		dst->hdr[i] = strdup(src->hdr[i]);
+		if (dst->hdr[i] == NULL)
+			goto error;
+	}
+	dst->n = src->n;
+	return (0);
+
+error:
+	while (i-- > 0) {
+		free(dst->hdr[i]);
+		dst->hdr[i] = NULL;
+	}
+	dst->n = 0;
+	return (-1);
+}
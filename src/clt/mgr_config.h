@@ -9,10 +9,55 @@
  */
 #define	CFG_IPV4_ARRAY_MAX	16
 
+struct rng;
+struct budget;
+struct profile;
+struct runctl;
+
 struct cfg_ipv4_array {
 	char *ipv4[CFG_IPV4_ARRAY_MAX];
 	int n;
 	int cur;
+
+	/* Relative weights, for weighted selection; default 1 */
+	int weight[CFG_IPV4_ARRAY_MAX];
+
+	/*
+	 * Per-thread selection state - smooth weighted round robin
+	 * state and how many requests are outstanding to each entry.
+	 */
+	int cur_weight[CFG_IPV4_ARRAY_MAX];
+	int inflight[CFG_IPV4_ARRAY_MAX];
+};
+
+/*
+ * How to pick a destination for each new connection.
+ */
+typedef enum {
+	CFG_DST_POLICY_RR,
+	CFG_DST_POLICY_RANDOM,
+	CFG_DST_POLICY_WEIGHTED,
+	CFG_DST_POLICY_LEAST_OUTSTANDING,
+	CFG_DST_POLICY_P2C,
+} cfg_dst_policy_t;
+
+/*
+ * Open loop arrival process; NONE is the default closed loop.
+ */
+typedef enum {
+	CFG_OPEN_LOOP_NONE,
+	CFG_OPEN_LOOP_CONST,
+	CFG_OPEN_LOOP_POISSON,
+} cfg_open_loop_t;
+
+/*
+ * Extra request headers, as "Name: value" strings.
+ */
+#define	CFG_HDR_ARRAY_MAX	16
+
+struct cfg_hdr_array {
+	char *hdr[CFG_HDR_ARRAY_MAX];
+	int n;
 };
 
 /*
@@ -31,6 +76,9 @@ struct mgr_config {
 	/* how many requests per second, or -1 for no limit */
 	int target_request_rate;
 
+	/* how many new connections per second, or -1 for no limit */
+	int target_conn_rate;
+
 	/* how many requests each conn should run before finishing */
 	int target_request_count;
 
@@ -43,6 +91,12 @@ struct mgr_config {
 	/* How long to run for in RUNNING before finishing */
 	int running_period_sec;
 
+	/* How long to apply load before RUNNING without counting it */
+	int warmup_period_sec;
+
+	/* Periodic timer lag over this means the client is saturated */
+	uint64_t loop_lag_warn_usec;
+
 	/* WAITING phase configuration */
 	/*
 	 * How long to wait for connections to complete
@@ -53,22 +107,130 @@ struct mgr_config {
 	/* Array of servers to hit */
 	struct cfg_ipv4_array ipv4_dst;
 
+	/* .. and how to pick between them */
+	cfg_dst_policy_t dst_policy;
+
+	/* Array of local addresses to connect from; empty for any */
+	struct cfg_ipv4_array ipv4_src;
+
 	/* Configuration for clients */
 	char *host_hdr;
 	int port;
 	char *uri;
 	int wait_time_pre_http_req_msec;
 	int http_keepalive;
+
+	/*
+	 * Request timeouts: idle is the time without any response
+	 * progress, total is the time since the request was issued.
+	 * -1 to disable.
+	 */
+	int idle_timeout_msec;
+	int request_timeout_msec;
+
+	/* Binary trace file to replay instead of uri, or NULL */
+	char *trace_file;
+
+	/* The mapped trace; owned by the caller, not the config */
+	const struct trace *trace;
+
+	/* Extra headers to add to each request */
+	struct cfg_hdr_array hdrs;
+
+	/* HTTP method (a htp_method) for non-trace requests */
+	int http_method;
+
+	/*
+	 * Request body: a size distribution (see dist.h) and/or a
+	 * file to send; NULL for no body.
+	 */
+	char *body_size;
+	char *body_file;
+	int body_chunked;
+
+	/* The shared body buffer; owned by the caller, not the config */
+	const struct req_body *body;
+
+	/* TLS */
+	int tls;
+	int tls_session_reuse;
+	int tls_tickets;
+	char *tls_ciphers;
+	char *tls_alpn;
+
+	/*
+	 * Open loop: requests arrive at target_request_rate on a
+	 * schedule regardless of completions, queueing in a bounded
+	 * backlog until a connection is free.
+	 */
+	cfg_open_loop_t open_loop;
+	int open_loop_backlog;
+
+	/*
+	 * The global budget the threads draw rate tokens, request and
+	 * connection counts and connection slots from; owned by the
+	 * caller, not the config.
+	 */
+	struct budget *budget;
+
+	/*
+	 * Load profile to follow in RUNNING, or NULL for the fixed
+	 * targets above; also owned by the caller.
+	 */
+	struct profile *profile;
+
+	/* The start barrier; also owned by the caller */
+	struct runctl *runctl;
+
+	/* The --profile string main() parses it from */
+	char *profile_spec;
+
+	/*
+	 * Grow and shrink each worker's connection count from the
+	 * latency it sees (see aconc.h), up to target_nconn.
+	 */
+	int adaptive_conc;
+
+	/*
+	 * Search for the highest rate within a p99 SLO (see findmax.h);
+	 * run by main(), not the workers.
+	 */
+	int find_max;
+	uint64_t slo_p99_usec;
+	int find_max_window_msec;
+
+	/*
+	 * Time series stats export (see stats_out.h); only used by
+	 * the stats thread, so not copied to the workers.
+	 */
+	char *stats_out;
+	int stats_format;		/* a stats_out_fmt_t */
+	int stats_interval_msec;
 };
 
 extern	int mgr_config_copy_thread(const struct mgr_config *src_cfg,
-	    struct mgr_config *cfg, int nthreads);
+	    struct mgr_config *cfg, int nthreads, int tid);
 extern	int cfg_ipv4_array_add(struct cfg_ipv4_array *a,
 	    const char *addr);
 extern	void cfg_ipv4_array_dup(struct cfg_ipv4_array *dst,
 	    const struct cfg_ipv4_array *src);
-extern	const char * cfg_ipv4_array_get_random(const struct cfg_ipv4_array *r);
+extern	int cfg_ipv4_array_add_weighted(struct cfg_ipv4_array *a,
+	    const char *str);
+extern	const char * cfg_ipv4_array_get_random(const struct cfg_ipv4_array *r,
+	    struct rng *rng);
 extern	const char * cfg_ipv4_array_get_next(struct cfg_ipv4_array *r);
+extern	int cfg_ipv4_array_get_next_idx(struct cfg_ipv4_array *r);
+extern	int cfg_ipv4_array_select(struct cfg_ipv4_array *r,
+	    cfg_dst_policy_t policy, struct rng *rng);
+extern	void cfg_ipv4_array_inflight_inc(struct cfg_ipv4_array *r, int i);
+extern	void cfg_ipv4_array_inflight_dec(struct cfg_ipv4_array *r, int i);
+extern	int cfg_dst_policy_parse(const char *str, cfg_dst_policy_t *p);
+extern	const char * cfg_dst_policy_str(cfg_dst_policy_t p);
+extern	int cfg_open_loop_parse(const char *str, cfg_open_loop_t *p);
+extern	const char * cfg_open_loop_str(cfg_open_loop_t p);
 extern	int cfg_ipv4_array_nentries(const struct cfg_ipv4_array *r);
+extern	int cfg_hdr_array_add(struct cfg_hdr_array *a, const char *hdr);
+extern	int cfg_hdr_array_dup(struct cfg_hdr_array *dst,
+	    const struct cfg_hdr_array *src);
 
 #endif	/* __MGR_CONFIG_H__ */
@@ -1,5 +1,9 @@
+#include <strings.h>
+
 #include <sys/types.h>
+#include <stdint.h>
 
+#include "hist.h"
 #include "mgr_stats.h"
 
 void
@@ -9,12 +13,42 @@ mgr_stats_copy(const struct mgr_stats *src, struct mgr_stats *dst)
 	*dst = *src;
 }
 
+/*
+ * Zero the counters and histograms, keeping the gauges.
+ */
+void
+mgr_stats_reset(struct mgr_stats *stats)
+{
+	struct mgr_stats s;
+
+	bzero(&s, sizeof(s));
+	s.gen = stats->gen + 1;
+	s.nconn = stats->nconn;
+	s.ol_backlog = stats->ol_backlog;
+	s.conc_limit = stats->conc_limit;
+	s.conc_knee = stats->conc_knee;
+	s.conc_knee_rate = stats->conc_knee_rate;
+	*stats = s;
+}
+
 void
 mgr_stats_diff(const struct mgr_stats *sfrom, const struct mgr_stats *sto,
     struct mgr_stats *res)
 {
+	int i;
+
+	/* Reset in between; everything since is new */
+	if (sfrom->gen != sto->gen) {
+		*res = *sto;
+		return;
+	}
 
 	res->nconn = sto->nconn - sfrom->nconn;
+	/* Gauges; the interval's value is the latest one */
+	res->ol_backlog = sto->ol_backlog;
+	res->conc_limit = sto->conc_limit;
+	res->conc_knee = sto->conc_knee;
+	res->conc_knee_rate = sto->conc_knee_rate;
 	res->nconn_create_failed = sto->nconn_create_failed - sfrom->nconn_create_failed;
 
 	res->conn_count = sto->conn_count - sfrom->conn_count;
@@ -25,17 +59,56 @@ mgr_stats_diff(const struct mgr_stats *sfrom, const struct mgr_stats *sto,
 	res->req_count_err  = sto->req_count_err - sfrom->req_count_err;
 	res->req_count_create_err = sto->req_count_create_err - sfrom->req_count_create_err;
 	res->req_count_timeout = sto->req_count_timeout - sfrom->req_count_timeout;
+	res->req_body_bytes_sent = sto->req_body_bytes_sent - sfrom->req_body_bytes_sent;
+	res->req_body_clamped = sto->req_body_clamped - sfrom->req_body_clamped;
+	res->req_bytes_sent = sto->req_bytes_sent - sfrom->req_bytes_sent;
+	res->resp_hdr_bytes = sto->resp_hdr_bytes - sfrom->resp_hdr_bytes;
+	res->resp_body_bytes = sto->resp_body_bytes - sfrom->resp_body_bytes;
+
+	hist_diff(&sfrom->req_latency_usec, &sto->req_latency_usec, &res->req_latency_usec);
+	res->ol_scheduled = sto->ol_scheduled - sfrom->ol_scheduled;
+	res->ol_dropped = sto->ol_dropped - sfrom->ol_dropped;
 
-	res->req_statustype_200 = sto->req_statustype_200 - sfrom->req_statustype_200;
-	res->req_statustype_302  = sto->req_statustype_302 - sfrom->req_statustype_302;
-	res->req_statustype_other  = sto->req_statustype_other - sfrom->req_statustype_other;
+	res->tls_hs_full = sto->tls_hs_full - sfrom->tls_hs_full;
+	res->tls_hs_resumed = sto->tls_hs_resumed - sfrom->tls_hs_resumed;
+	res->tls_hs_err = sto->tls_hs_err - sfrom->tls_hs_err;
+	hist_diff(&sfrom->tls_hs_usec, &sto->tls_hs_usec, &res->tls_hs_usec);
+
+	hist_diff(&sfrom->loop_lag_usec, &sto->loop_lag_usec, &res->loop_lag_usec);
+	res->loop_lag_over = sto->loop_lag_over - sfrom->loop_lag_over;
+	res->loop_busy_usec = sto->loop_busy_usec - sfrom->loop_busy_usec;
+	res->loop_wait_usec = sto->loop_wait_usec - sfrom->loop_wait_usec;
+	res->loop_iterations = sto->loop_iterations - sfrom->loop_iterations;
+	res->loop_callbacks = sto->loop_callbacks - sfrom->loop_callbacks;
+
+	res->err_connect_refused = sto->err_connect_refused - sfrom->err_connect_refused;
+	res->err_connect_timeout = sto->err_connect_timeout - sfrom->err_connect_timeout;
+	res->err_connect_other = sto->err_connect_other - sfrom->err_connect_other;
+	res->err_reset_headers = sto->err_reset_headers - sfrom->err_reset_headers;
+	res->err_reset_body = sto->err_reset_body - sfrom->err_reset_body;
+	res->err_timeout = sto->err_timeout - sfrom->err_timeout;
+	res->err_parse = sto->err_parse - sfrom->err_parse;
+
+	for (i = 0; i < MGR_STATS_STATUS_NCLASS; i++)
+		res->req_status_class[i] = sto->req_status_class[i] - sfrom->req_status_class[i];
+	for (i = 0; i < MGR_STATS_STATUS_NUM; i++)
+		res->req_status[i] = sto->req_status[i] - sfrom->req_status[i];
 }
 
+/*
+ * Sum sfrom into sto.  The generation is left alone; summing stats
+ * from different generations is the caller's problem.
+ */
 void
 mgr_stats_add(const struct mgr_stats *sfrom, struct mgr_stats *sto)
 {
+	int i;
 
 	sto->nconn += sfrom->nconn;
+	sto->ol_backlog += sfrom->ol_backlog;
+	sto->conc_limit += sfrom->conc_limit;
+	sto->conc_knee += sfrom->conc_knee;
+	sto->conc_knee_rate += sfrom->conc_knee_rate;
 	sto->nconn_create_failed += sfrom->nconn_create_failed;
 
 	sto->conn_count += sfrom->conn_count;
@@ -46,8 +119,38 @@ mgr_stats_add(const struct mgr_stats *sfrom, struct mgr_stats *sto)
 	sto->req_count_err += sfrom->req_count_err;
 	sto->req_count_create_err += sfrom->req_count_create_err;
 	sto->req_count_timeout += sfrom->req_count_timeout;
+	sto->req_body_bytes_sent += sfrom->req_body_bytes_sent;
+	sto->req_body_clamped += sfrom->req_body_clamped;
+	sto->req_bytes_sent += sfrom->req_bytes_sent;
+	sto->resp_hdr_bytes += sfrom->resp_hdr_bytes;
+	sto->resp_body_bytes += sfrom->resp_body_bytes;
+
+	hist_sum(&sfrom->req_latency_usec, &sto->req_latency_usec);
+	sto->ol_scheduled += sfrom->ol_scheduled;
+	sto->ol_dropped += sfrom->ol_dropped;
+
+	sto->tls_hs_full += sfrom->tls_hs_full;
+	sto->tls_hs_resumed += sfrom->tls_hs_resumed;
+	sto->tls_hs_err += sfrom->tls_hs_err;
+	hist_sum(&sfrom->tls_hs_usec, &sto->tls_hs_usec);
+
+	hist_sum(&sfrom->loop_lag_usec, &sto->loop_lag_usec);
+	sto->loop_lag_over += sfrom->loop_lag_over;
+	sto->loop_busy_usec += sfrom->loop_busy_usec;
+	sto->loop_wait_usec += sfrom->loop_wait_usec;
+	sto->loop_iterations += sfrom->loop_iterations;
+	sto->loop_callbacks += sfrom->loop_callbacks;
+
+	sto->err_connect_refused += sfrom->err_connect_refused;
+	sto->err_connect_timeout += sfrom->err_connect_timeout;
+	sto->err_connect_other += sfrom->err_connect_other;
+	sto->err_reset_headers += sfrom->err_reset_headers;
+	sto->err_reset_body += sfrom->err_reset_body;
+	sto->err_timeout += sfrom->err_timeout;
+	sto->err_parse += sfrom->err_parse;
 
-	sto->req_statustype_200 += sfrom->req_statustype_200;
-	sto->req_statustype_302 += sfrom->req_statustype_302;
-	sto->req_statustype_other += sfrom->req_statustype_other;
+	for (i = 0; i < MGR_STATS_STATUS_NCLASS; i++)
+		sto->req_status_class[i] += sfrom->req_status_class[i];
+	for (i = 0; i < MGR_STATS_STATUS_NUM; i++)
+		sto->req_status[i] += sfrom->req_status[i];
 }
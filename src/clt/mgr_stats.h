@@ -1,10 +1,36 @@
 #ifndef	__MGR_STATS_H__
 #define	__MGR_STATS_H__
 
+/*
+ * Response status codes counted individually; anything outside
+ * this range is only counted in req_status_class[0].
+ */
+#define	MGR_STATS_STATUS_MIN	100
+#define	MGR_STATS_STATUS_MAX	599
+#define	MGR_STATS_STATUS_NUM	(MGR_STATS_STATUS_MAX - MGR_STATS_STATUS_MIN + 1)
+#define	MGR_STATS_STATUS_NCLASS	6
+
 struct mgr_stats {
+	/*
+	 * Bumped each time the counters are reset (eg at the end of
+	 * warmup); diffs across a reset are taken from zero.
+	 */
+	uint64_t gen;
+
 	/* How many open connections - gauge, not counter */
 	int nconn;
 
+	/* Open loop backlog depth - gauge */
+	int ol_backlog;
+
+	/*
+	 * Adaptive concurrency (see aconc.h): the current connection
+	 * limit, the knee found so far and its requests/sec - gauges.
+	 */
+	int conc_limit;
+	int conc_knee;
+	int conc_knee_rate;
+
 	uint64_t nconn_create_failed;
 	uint64_t conn_count;
 	uint64_t conn_closing_count;
@@ -15,14 +41,72 @@ struct mgr_stats {
 	uint64_t req_count_create_err;
 	uint64_t req_count_timeout;
 
-	uint64_t req_statustype_200;
-	uint64_t req_statustype_302;
-	uint64_t req_statustype_other;
+	/* Request body bytes queued to be sent */
+	uint64_t req_body_bytes_sent;
+
+	/* Sampled body sizes clamped to REQ_BODY_SIZE_MAX */
+	uint64_t req_body_clamped;
+
+	/*
+	 * All request bytes queued to be sent (request line, headers
+	 * and body) and response header and body bytes received.
+	 * Body bytes are the payload, without chunk framing; none of
+	 * these include TLS overhead.
+	 */
+	uint64_t req_bytes_sent;
+	uint64_t resp_hdr_bytes;
+	uint64_t resp_body_bytes;
+
+	/*
+	 * Request latency.  Open loop measures from the scheduled
+	 * send time, so queueing behind a slow server is included.
+	 */
+	struct hist req_latency_usec;
+
+	/* Open loop arrivals scheduled, and dropped on a full backlog */
+	uint64_t ol_scheduled;
+	uint64_t ol_dropped;
+
+	/* TLS handshakes */
+	uint64_t tls_hs_full;
+	uint64_t tls_hs_resumed;
+	uint64_t tls_hs_err;
+	struct hist tls_hs_usec;
+
+	/*
+	 * Event loop health (see loopmon.h): periodic timer lag, how
+	 * often it was over the warning threshold, time in callbacks
+	 * versus waiting, and loop iterations/callbacks run.
+	 */
+	struct hist loop_lag_usec;
+	uint64_t loop_lag_over;
+	uint64_t loop_busy_usec;
+	uint64_t loop_wait_usec;
+	uint64_t loop_iterations;
+	uint64_t loop_callbacks;
+
+	/*
+	 * Why connections and requests failed (see clt_err_t.)
+	 * err_timeout only counts timeouts once connected; all
+	 * timeouts are in req_count_timeout.
+	 */
+	uint64_t err_connect_refused;
+	uint64_t err_connect_timeout;
+	uint64_t err_connect_other;
+	uint64_t err_reset_headers;
+	uint64_t err_reset_body;
+	uint64_t err_timeout;
+	uint64_t err_parse;
+
+	/* Response status: per class (index status / 100) and per code */
+	uint64_t req_status_class[MGR_STATS_STATUS_NCLASS];
+	uint64_t req_status[MGR_STATS_STATUS_NUM];
 };
 
 extern	void mgr_stats_copy(const struct mgr_stats *src, struct mgr_stats *dst);
 extern	void mgr_stats_diff(const struct mgr_stats *sfrom,
 	    const struct mgr_stats *sto, struct mgr_stats *res);
+extern	void mgr_stats_reset(struct mgr_stats *stats);
 extern	void mgr_stats_add(const struct mgr_stats *from, struct mgr_stats *sto);
 
 #endif	/* __MGR_STATS_H__ */
@@ -0,0 +1,15 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mtime.h"
+
+uint64_t
+mtime_now_usec(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000ULL +
+	    (uint64_t) ts.tv_nsec / 1000ULL);
+}
@@ -0,0 +1,12 @@
+#ifndef	__MTIME_H__
+#define	__MTIME_H__
+
+/*
+ * Monotonic time, in microseconds.
+ *
+ * This is what everything that needs to measure elapsed time
+ * (timeouts, pacing, latency) should use; wall-clock time can step.
+ */
+extern	uint64_t mtime_now_usec(void);
+
+#endif	/* __MTIME_H__ */
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "profile.h"
+
+static const struct {
+	const char *name;
+	profile_stage_type_t type;
+} profile_types[] = {
+	{ "ramp", PROFILE_STAGE_RAMP },
+	{ "hold", PROFILE_STAGE_HOLD },
+	{ "step", PROFILE_STAGE_STEP },
+	{ "sine", PROFILE_STAGE_SINE },
+	{ NULL, 0 }
+};
+
+const char *
+profile_stage_type_str(profile_stage_type_t type)
+{
+	int i;
+
+	for (i = 0; profile_types[i].name != NULL; i++) {
+		if (profile_types[i].type == type)
+			return (profile_types[i].name);
+	}
+	return ("unknown");
+}
+
+/*
+ * Parse a duration with an optional ms/s/m suffix; seconds if none.
+ */
+static int
+profile_parse_dur(const char *s, uint64_t *usec)
+{
+	char *ep;
+	double d;
+
+	d = strtod(s, &ep);
+	if (ep == s || d <= 0.0)
+		return (-1);
+	if (strcmp(ep, "ms") == 0)
+		d *= 1000.0;
+	else if (strcmp(ep, "s") == 0 || *ep == '\0')
+		d *= 1000000.0;
+	else if (strcmp(ep, "m") == 0)
+		d *= 60000000.0;
+	else
+		return (-1);
+	*usec = (uint64_t) d;
+	return (*usec > 0 ? 0 : -1);
+}
+
+/*
+ * Parse "<a>" or "<a>-<b>"; returns how many numbers were found.
+ */
+static int
+profile_parse_range(const char *s, double *a, double *b)
+{
+	char *ep;
+
+	*a = strtod(s, &ep);
+	if (ep == s || *a < 0.0)
+		return (-1);
+	if (*ep == '\0') {
+		*b = *a;
+		return (1);
+	}
+	if (*ep != '-')
+		return (-1);
+	s = ep + 1;
+	*b = strtod(s, &ep);
+	if (ep == s || *ep != '\0' || *b < 0.0)
+		return (-1);
+	return (2);
+}
+
+/*
+ * Parse one stage.  'rate' and 'nconn' are where the previous stage
+ * finished, and are updated to where this one does.
+ */
+static int
+profile_parse_stage(struct profile_stage *st, char *str, double *rate,
+    int *nconn)
+{
+	char *kind, *vals, *conns, *cnt, *ep;
+	double a, b;
+	int i, n;
+
+	bzero(st, sizeof(*st));
+	kind = strsep(&str, ":");
+	for (i = 0; profile_types[i].name != NULL; i++) {
+		if (strcmp(profile_types[i].name, kind) == 0)
+			break;
+	}
+	if (profile_types[i].name == NULL || str == NULL)
+		return (-1);
+	st->type = profile_types[i].type;
+
+	vals = strsep(&str, "/");
+	if (str == NULL)
+		return (-1);
+
+	/* Duration, and repeat count for step/sine */
+	st->count = 1;
+	cnt = strchr(str, '*');
+	if (cnt != NULL) {
+		*cnt++ = '\0';
+		if (st->type != PROFILE_STAGE_STEP &&
+		    st->type != PROFILE_STAGE_SINE)
+			return (-1);
+		st->count = atoi(cnt);
+		if (st->count < 1)
+			return (-1);
+	}
+	if (profile_parse_dur(str, &st->period_usec) != 0)
+		return (-1);
+	st->dur_usec = st->period_usec * st->count;
+
+	/* Connection count */
+	conns = strchr(vals, '@');
+	if (conns != NULL) {
+		*conns++ = '\0';
+		if (profile_parse_range(conns, &a, &b) < 0)
+			return (-1);
+		st->nconn_from = (int) a;
+		st->nconn_to = (int) b;
+	} else {
+		st->nconn_from = st->nconn_to = *nconn;
+	}
+
+	/* Rate */
+	switch (st->type) {
+	case PROFILE_STAGE_RAMP:
+		n = profile_parse_range(vals, &a, &b);
+		if (n < 0)
+			return (-1);
+		st->rate_from = (n == 1) ? *rate : a;
+		st->rate_to = b;
+		break;
+	case PROFILE_STAGE_HOLD:
+		if (profile_parse_range(vals, &a, &b) != 1)
+			return (-1);
+		st->rate_from = st->rate_to = a;
+		break;
+	case PROFILE_STAGE_STEP:
+		if (vals[0] != '+' && vals[0] != '-')
+			return (-1);
+		st->rate_step = strtod(vals, &ep);
+		if (ep == vals || *ep != '\0')
+			return (-1);
+		st->rate_from = *rate;
+		st->rate_to = *rate + st->rate_step * st->count;
+		if (st->rate_to < 0.0)
+			return (-1);
+		break;
+	case PROFILE_STAGE_SINE:
+		if (profile_parse_range(vals, &a, &b) != 2)
+			return (-1);
+		st->rate_from = a;
+		st->rate_to = b;
+		break;
+	}
+
+	*rate = (st->type == PROFILE_STAGE_SINE) ? st->rate_from : st->rate_to;
+	*nconn = st->nconn_to;
+	return (0);
+}
+
+/*
+ * Parse a profile; 'rate' and 'nconn' are the starting values, used
+ * until a stage sets them.
+ */
+int
+profile_parse(struct profile *p, const char *str, double rate, int nconn)
+{
+	char *s, *sp, *st;
+
+	bzero(p, sizeof(*p));
+	s = sp = strdup(str);
+	if (s == NULL)
+		return (-1);
+
+	while ((st = strsep(&sp, ",")) != NULL) {
+		if (p->n >= PROFILE_STAGES_MAX) {
+			fprintf(stderr, "%s: too many stages\n", __func__);
+			goto error;
+		}
+		if (profile_parse_stage(&p->stages[p->n], st, &rate,
+		    &nconn) != 0) {
+			fprintf(stderr, "%s: invalid stage %d in (%s)\n",
+			    __func__, p->n + 1, str);
+			goto error;
+		}
+		p->dur_usec += p->stages[p->n].dur_usec;
+		p->n++;
+	}
+	free(s);
+	if (p->n == 0)
+		return (-1);
+	return (0);
+
+error:
+	free(s);
+	return (-1);
+}
+
+/*
+ * Work out the rate and connection count at the given time, for a
+ * profile that started at start_usec.
+ *
+ * Returns the stage index, or -1 once the profile has finished (the
+ * values are then where it ended.)
+ */
+int
+profile_at(const struct profile *p, uint64_t start_usec, uint64_t now_usec,
+    double *rate, int *nconn)
+{
+	const struct profile_stage *st;
+	uint64_t t;
+	double f;
+	int i;
+
+	t = (now_usec > start_usec) ? now_usec - start_usec : 0;
+
+	for (i = 0; i < p->n; i++) {
+		st = &p->stages[i];
+		if (t < st->dur_usec)
+			break;
+		t -= st->dur_usec;
+	}
+	if (i == p->n) {
+		st = &p->stages[p->n - 1];
+		*rate = (st->type == PROFILE_STAGE_SINE) ?
+		    st->rate_from : st->rate_to;
+		*nconn = st->nconn_to;
+		return (-1);
+	}
+
+	f = (double) t / (double) st->dur_usec;
+	switch (st->type) {
+	case PROFILE_STAGE_RAMP:
+		*rate = st->rate_from + (st->rate_to - st->rate_from) * f;
+		break;
+	case PROFILE_STAGE_HOLD:
+		*rate = st->rate_from;
+		break;
+	case PROFILE_STAGE_STEP:
+		*rate = st->rate_from +
+		    st->rate_step * (double) (t / st->period_usec + 1);
+		break;
+	case PROFILE_STAGE_SINE:
+		*rate = st->rate_from + (st->rate_to - st->rate_from) *
+		    (1.0 - cos(2.0 * M_PI * (double) (t % st->period_usec) /
+		    (double) st->period_usec)) / 2.0;
+		break;
+	}
+	*nconn = st->nconn_from +
+	    (int) lround((double) (st->nconn_to - st->nconn_from) * f);
+
+	return (i);
+}
@@ -0,0 +1,65 @@
+#ifndef	__PROFILE_H__
+#define	__PROFILE_H__
+
+/*
+ * A load profile: a schedule of stages run back to back in the
+ * RUNNING phase, each setting the request rate and (optionally) the
+ * number of connections over time.
+ *
+ * The textual form is a comma separated list of stages:
+ *
+ * + ramp:<from>-<to>/<dur>	- linear from -> to
+ * + ramp:<to>/<dur>		- linear from the previous stage's end
+ * + hold:<rate>/<dur>
+ * + step:<+|-><delta>/<dur>*<n>	- n steps of dur each, the first
+ *				  one delta from the previous end
+ * + sine:<lo>-<hi>/<period>[*<n>]	- n cycles (default 1) starting
+ *				  and ending at lo
+ *
+ * Any rate may be followed by "@<nconn>" or "@<from>-<to>" to set the
+ * connection count, linearly over the stage; otherwise it carries on
+ * from the previous stage.  Durations take a ms, s (default) or m
+ * suffix.
+ *
+ * Eg: ramp:0-50000/60s,hold:50000/120s,step:+10000/30s*5
+ */
+#define	PROFILE_STAGES_MAX	32
+
+typedef enum {
+	PROFILE_STAGE_RAMP,
+	PROFILE_STAGE_HOLD,
+	PROFILE_STAGE_STEP,
+	PROFILE_STAGE_SINE,
+} profile_stage_type_t;
+
+struct profile_stage {
+	profile_stage_type_t type;
+
+	/* Rate at the start and end; step uses rate_step per step */
+	double rate_from;
+	double rate_to;
+	double rate_step;
+
+	/* Connection count at the start and end */
+	int nconn_from;
+	int nconn_to;
+
+	/* Step length/sine period, how many, and the whole stage */
+	uint64_t period_usec;
+	int count;
+	uint64_t dur_usec;
+};
+
+struct profile {
+	struct profile_stage stages[PROFILE_STAGES_MAX];
+	int n;
+	uint64_t dur_usec;
+};
+
+extern	int profile_parse(struct profile *p, const char *str, double rate,
+	    int nconn);
+extern	int profile_at(const struct profile *p, uint64_t start_usec,
+	    uint64_t now_usec, double *rate, int *nconn);
+extern	const char *profile_stage_type_str(profile_stage_type_t type);
+
+#endif	/* __PROFILE_H__ */
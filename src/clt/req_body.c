@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "req_body.h"
+
+/*
+ * Fill the buffer with a printable repeating pattern.
+ */
+int
+req_body_init_fill(struct req_body *b, size_t len)
+{
+	static const char pat[] =
+	    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789\n";
+	size_t i;
+
+	bzero(b, sizeof(*b));
+	b->buf = malloc(len);
+	if (b->buf == NULL) {
+		warn("%s: malloc", __func__);
+		return (-1);
+	}
+	for (i = 0; i < len; i++)
+		b->buf[i] = pat[i % (sizeof(pat) - 1)];
+	b->len = len;
+
+	return (0);
+}
+
+int
+req_body_init_file(struct req_body *b, const char *path)
+{
+	struct stat sb;
+	ssize_t r;
+	size_t ofs;
+	int fd;
+
+	bzero(b, sizeof(*b));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("%s: open (%s)", __func__, path);
+		return (-1);
+	}
+	if (fstat(fd, &sb) != 0) {
+		warn("%s: fstat (%s)", __func__, path);
+		close(fd);
+		return (-1);
+	}
+	if (sb.st_size <= 0) {
+		fprintf(stderr, "%s: %s: empty file\n", __func__, path);
+		close(fd);
+		return (-1);
+	}
+
+	b->len = sb.st_size;
+	b->buf = malloc(b->len);
+	if (b->buf == NULL) {
+		warn("%s: malloc", __func__);
+		close(fd);
+		return (-1);
+	}
+
+	for (ofs = 0; ofs < b->len; ofs += r) {
+		r = read(fd, b->buf + ofs, b->len - ofs);
+		if (r <= 0) {
+			warn("%s: read (%s)", __func__, path);
+			close(fd);
+			req_body_free(b);
+			return (-1);
+		}
+	}
+	close(fd);
+
+	return (0);
+}
+
+void
+req_body_free(struct req_body *b)
+{
+
+	free(b->buf);
+	bzero(b, sizeof(*b));
+}
@@ -0,0 +1,33 @@
+#ifndef	__REQ_BODY_H__
+#define	__REQ_BODY_H__
+
+/* Size of the generated body buffer */
+#define	REQ_BODY_FILL_SIZE	(1024 * 1024)
+
+/*
+ * Largest body sent; bigger --body-size samples are clamped to it.
+ * Distributions are unbounded unless given a max, and the whole body
+ * is queued at once.
+ */
+#define	REQ_BODY_SIZE_MAX	(64 * 1024 * 1024)
+
+/* Maximum chunk size when sending a chunked body */
+#define	REQ_BODY_CHUNK_SIZE	16384
+
+/*
+ * A read-only request body buffer, shared by all worker threads.
+ *
+ * Request bodies are added to the connection output buffer by
+ * reference to this; bodies longer than the buffer just reference
+ * it again.  It must outlive every connection.
+ */
+struct req_body {
+	char *buf;
+	size_t len;
+};
+
+extern	int req_body_init_fill(struct req_body *b, size_t len);
+extern	int req_body_init_file(struct req_body *b, const char *path);
+extern	void req_body_free(struct req_body *b);
+
+#endif	/* __REQ_BODY_H__ */
@@ -0,0 +1,57 @@
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+/*
+ * Seed via a round of splitmix64, so nearby seeds (eg thread ids)
+ * don't produce correlated streams - and so the state is never zero.
+ */
+void
+rng_seed(struct rng *r, uint64_t seed)
+{
+	uint64_t z;
+
+	z = seed + 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	z = z ^ (z >> 31);
+	if (z == 0)
+		z = 0x9e3779b97f4a7c15ULL;
+	r->s = z;
+}
+
+uint64_t
+rng_next(struct rng *r)
+{
+	uint64_t x = r->s;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	r->s = x;
+	return (x * 0x2545f4914f6cdd1dULL);
+}
+
+/*
+ * Return a value in [0, n).
+ *
+ * This uses the multiply-shift trick rather than modulo; the bias
+ * is negligible for the small ranges used here.
+ */
+uint32_t
+rng_uniform(struct rng *r, uint32_t n)
+{
+
+	return ((uint32_t) (((rng_next(r) >> 32) * (uint64_t) n) >> 32));
+}
+
+/*
+ * Return a value in [0, 1).
+ */
+double
+rng_double(struct rng *r)
+{
+
+	return ((rng_next(r) >> 11) * (1.0 / 9007199254740992.0));
+}
@@ -0,0 +1,19 @@
+#ifndef	__RNG_H__
+#define	__RNG_H__
+
+/*
+ * A small, fast, per-thread pseudo-random number generator
+ * (xorshift64*.)  It's not at all cryptographically secure; it's
+ * for picking destinations and generating workloads without
+ * contending on the global random() state.
+ */
+struct rng {
+	uint64_t s;
+};
+
+extern	void rng_seed(struct rng *r, uint64_t seed);
+extern	uint64_t rng_next(struct rng *r);
+extern	uint32_t rng_uniform(struct rng *r, uint32_t n);
+extern	double rng_double(struct rng *r);
+
+#endif	/* __RNG_H__ */
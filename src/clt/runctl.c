@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include <machine/atomic.h>
+
+#include "mtime.h"
+#include "runctl.h"
+
+void
+runctl_init(struct runctl *rc, int nthreads, uint64_t warmup_usec)
+{
+
+	bzero(rc, sizeof(*rc));
+	rc->nthreads = nthreads;
+	rc->warmup_usec = warmup_usec;
+}
+
+/*
+ * This worker is ready; call once.  The last one in sets the start.
+ */
+void
+runctl_arrive(struct runctl *rc)
+{
+	uint64_t start;
+
+	if (atomic_fetchadd_int(&rc->nready, 1) + 1 != (u_int) rc->nthreads)
+		return;
+
+	start = mtime_now_usec() + RUNCTL_START_DELAY_USEC;
+	atomic_store_rel_long(&rc->start_usec, start);
+}
+
+/*
+ * When everyone starts, or 0 if some are still getting ready.
+ */
+uint64_t
+runctl_start_usec(struct runctl *rc)
+{
+
+	return (atomic_load_acq_long(&rc->start_usec));
+}
+
+/*
+ * .. and when the warmup finishes and RUNNING starts.
+ */
+uint64_t
+runctl_running_usec(struct runctl *rc)
+{
+	uint64_t start;
+
+	start = runctl_start_usec(rc);
+	if (start == 0)
+		return (0);
+	return (start + rc->warmup_usec);
+}
@@ -0,0 +1,38 @@
+#ifndef	__RUNCTL_H__
+#define	__RUNCTL_H__
+
+/*
+ * Run control: the start barrier shared by the worker threads.
+ *
+ * Each worker opens its connections in INIT and then arrives at the
+ * barrier; it doesn't block, it just keeps checking from its periodic
+ * timer.  The last to arrive picks a start time a little in the
+ * future - so everyone has a chance to see it - and every worker arms
+ * a timer for that same absolute time.  WARMUP (if any) runs from
+ * there, and RUNNING from start_usec + warmup_usec.
+ */
+#define	RUNCTL_START_DELAY_USEC		(20 * 1000)
+
+/* Give up on connections that haven't come up by then */
+#define	RUNCTL_PREWARM_TIMEOUT_USEC	(10 * 1000 * 1000)
+
+struct runctl {
+	volatile u_int nready;
+	int nthreads;
+	uint64_t warmup_usec;
+
+	/*
+	 * 0 until the last worker arrives.  This is the only place the
+	 * start is published; read it with runctl_start_usec() or
+	 * runctl_running_usec() rather than keeping a copy elsewhere.
+	 */
+	volatile u_long start_usec;
+};
+
+extern	void runctl_init(struct runctl *rc, int nthreads,
+	    uint64_t warmup_usec);
+extern	void runctl_arrive(struct runctl *rc);
+extern	uint64_t runctl_start_usec(struct runctl *rc);
+extern	uint64_t runctl_running_usec(struct runctl *rc);
+
+#endif	/* __RUNCTL_H__ */
@@ -0,0 +1,74 @@
+#include <sys/types.h>
+#include <string.h>
+
+#include <machine/atomic.h>
+
+#include "seqlock.h"
+
+/*
+ * Bracket updates to the published data.
+ *
+ * Only the owning thread may call these.
+ */
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+
+	sl->seq++;
+	atomic_thread_fence_rel();
+}
+
+void
+seqlock_write_end(struct seqlock *sl)
+{
+
+	atomic_store_rel_int(&sl->seq, sl->seq + 1);
+}
+
+/*
+ * Copy len bytes from src into the published copy at dst.
+ */
+void
+seqlock_publish(struct seqlock *sl, void *dst, const void *src, size_t len)
+{
+
+	seqlock_write_begin(sl);
+	memcpy(dst, src, len);
+	seqlock_write_end(sl);
+}
+
+/*
+ * Bracket reads of the published data; if seqlock_read_retry()
+ * returns true the reader raced with a publish and must re-read.
+ */
+u_int
+seqlock_read_begin(struct seqlock *sl)
+{
+	u_int seq;
+
+	while ((seq = atomic_load_acq_int(&sl->seq)) & 1)
+		;
+	return (seq);
+}
+
+int
+seqlock_read_retry(struct seqlock *sl, u_int seq)
+{
+
+	atomic_thread_fence_acq();
+	return (sl->seq != seq);
+}
+
+/*
+ * Take a consistent copy of the published data at src.
+ */
+void
+seqlock_read(struct seqlock *sl, void *dst, const void *src, size_t len)
+{
+	u_int seq;
+
+	do {
+		seq = seqlock_read_begin(sl);
+		memcpy(dst, src, len);
+	} while (seqlock_read_retry(sl, seq));
+}
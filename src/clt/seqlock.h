@@ -0,0 +1,27 @@
+#ifndef	__SEQLOCK_H__
+#define	__SEQLOCK_H__
+
+/*
+ * A single writer sequence lock, for publishing a snapshot of some
+ * thread-local state to readers on other threads.
+ *
+ * The writer never blocks; readers retry if they raced with a
+ * publish.  The sequence is odd while a publish is in progress.
+ *
+ * Anything that can be copied with memcpy() can be published this
+ * way, histograms included.
+ */
+struct seqlock {
+	volatile u_int seq;
+};
+
+extern	void seqlock_write_begin(struct seqlock *sl);
+extern	void seqlock_write_end(struct seqlock *sl);
+extern	void seqlock_publish(struct seqlock *sl, void *dst, const void *src,
+	    size_t len);
+extern	u_int seqlock_read_begin(struct seqlock *sl);
+extern	int seqlock_read_retry(struct seqlock *sl, u_int seq);
+extern	void seqlock_read(struct seqlock *sl, void *dst, const void *src,
+	    size_t len);
+
+#endif	/* __SEQLOCK_H__ */
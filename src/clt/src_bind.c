@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "debug.h"
+#include "src_bind.h"
+
+typedef	int connect_fn(int, const struct sockaddr *, socklen_t);
+
+static connect_fn *src_bind_real_connect = NULL;
+static pthread_once_t src_bind_once = PTHREAD_ONCE_INIT;
+
+/* Source address for the next connect() on this thread, or NULL */
+static __thread const struct sockaddr_in *src_bind_cur = NULL;
+
+static void
+src_bind_init(void)
+{
+
+	src_bind_real_connect = (connect_fn *) dlsym(RTLD_NEXT, "connect");
+	if (src_bind_real_connect == NULL)
+		errx(127, "%s: dlsym(connect): %s", __func__, dlerror());
+}
+
+void
+src_bind_set(const struct sockaddr_in *sin)
+{
+
+	src_bind_cur = sin;
+}
+
+int
+src_bind_parse(struct sockaddr_in *sin, const char *addr)
+{
+
+	bzero(sin, sizeof(*sin));
+#ifdef	__FreeBSD__
+	sin->sin_len = sizeof(*sin);
+#endif
+	sin->sin_family = AF_INET;
+	sin->sin_port = 0;
+	if (inet_pton(AF_INET, addr, &sin->sin_addr) != 1)
+		return (-1);
+	return (0);
+}
+
+static int
+src_bind_socket(int s, const struct sockaddr_in *sin)
+{
+#ifdef	IP_BIND_ADDRESS_NO_PORT
+	int one = 1;
+
+	/*
+	 * Defer the local port choice to connect(), so the
+	 * kernel only has to keep the 4-tuple unique rather
+	 * than reserving a port per source address.
+	 */
+	(void) setsockopt(s, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT,
+	    &one, sizeof(one));
+#endif
+
+	if (bind(s, (const struct sockaddr *) sin, sizeof(*sin)) < 0) {
+		debug_printf("%s: bind: %s\n", __func__, strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+int
+connect(int s, const struct sockaddr *name, socklen_t namelen)
+{
+
+	(void) pthread_once(&src_bind_once, src_bind_init);
+
+	if (src_bind_cur != NULL && name->sa_family == AF_INET) {
+		if (src_bind_socket(s, src_bind_cur) < 0)
+			return (-1);
+	}
+
+	return (src_bind_real_connect(s, name, namelen));
+}
@@ -0,0 +1,16 @@
+#ifndef	__SRC_BIND_H__
+#define	__SRC_BIND_H__
+
+/*
+ * Source address binding for outbound connections.
+ *
+ * libevhtp creates and connects the client socket inside
+ * evhtp_connection_new() and there's no hook to bind() it first.
+ * So, the caller sets a source address for the current thread
+ * around the evhtp_connection_new() call and connect() is interposed
+ * to bind the socket to it before the real connect() happens.
+ */
+extern	void src_bind_set(const struct sockaddr_in *sin);
+extern	int src_bind_parse(struct sockaddr_in *sin, const char *addr);
+
+#endif	/* __SRC_BIND_H__ */
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hist.h"
+#include "mgr_stats.h"
+#include "stats_out.h"
+
+/*
+ * The mgr_stats counters, in output order.
+ */
+#define	SO_COUNTER(f)	{ #f, offsetof(struct mgr_stats, f) }
+#define	SO_COUNTER_NAMED(n, f)	{ n, offsetof(struct mgr_stats, f) }
+
+static const struct {
+	const char *name;
+	size_t ofs;
+} stats_out_counters[] = {
+	SO_COUNTER(nconn_create_failed),
+	SO_COUNTER(conn_count),
+	SO_COUNTER(conn_closing_count),
+	SO_COUNTER(req_count),
+	SO_COUNTER(req_count_ok),
+	SO_COUNTER(req_count_err),
+	SO_COUNTER(req_count_create_err),
+	SO_COUNTER(req_count_timeout),
+	SO_COUNTER(req_body_bytes_sent),
+	SO_COUNTER(req_body_clamped),
+	SO_COUNTER(req_bytes_sent),
+	SO_COUNTER(resp_hdr_bytes),
+	SO_COUNTER(resp_body_bytes),
+	SO_COUNTER(ol_scheduled),
+	SO_COUNTER(ol_dropped),
+	SO_COUNTER(tls_hs_full),
+	SO_COUNTER(tls_hs_resumed),
+	SO_COUNTER(tls_hs_err),
+	SO_COUNTER(loop_lag_over),
+	SO_COUNTER(loop_busy_usec),
+	SO_COUNTER(loop_wait_usec),
+	SO_COUNTER(loop_iterations),
+	SO_COUNTER(loop_callbacks),
+	SO_COUNTER(err_connect_refused),
+	SO_COUNTER(err_connect_timeout),
+	SO_COUNTER(err_connect_other),
+	SO_COUNTER(err_reset_headers),
+	SO_COUNTER(err_reset_body),
+	SO_COUNTER(err_timeout),
+	SO_COUNTER(err_parse),
+	/* Per class only; there are too many codes for a column each */
+	SO_COUNTER_NAMED("status_1xx", req_status_class[1]),
+	SO_COUNTER_NAMED("status_2xx", req_status_class[2]),
+	SO_COUNTER_NAMED("status_3xx", req_status_class[3]),
+	SO_COUNTER_NAMED("status_4xx", req_status_class[4]),
+	SO_COUNTER_NAMED("status_5xx", req_status_class[5]),
+	SO_COUNTER_NAMED("status_other", req_status_class[0]),
+};
+
+#define	SO_NCOUNTERS	(sizeof(stats_out_counters) / sizeof(stats_out_counters[0]))
+
+/*
+ * .. and the histograms, summarised over each interval.
+ */
+#define	SO_HIST(f)	{ #f, offsetof(struct mgr_stats, f) }
+
+static const struct {
+	const char *name;
+	size_t ofs;
+} stats_out_hists[] = {
+	SO_HIST(req_latency_usec),
+	SO_HIST(tls_hs_usec),
+	SO_HIST(loop_lag_usec),
+};
+
+#define	SO_NHISTS	(sizeof(stats_out_hists) / sizeof(stats_out_hists[0]))
+
+static const struct {
+	const char *name;
+	double pct;
+} stats_out_pcts[] = {
+	{ "p50", 50.0 },
+	{ "p90", 90.0 },
+	{ "p99", 99.0 },
+	{ "p999", 99.9 },
+};
+
+#define	SO_NPCTS	(sizeof(stats_out_pcts) / sizeof(stats_out_pcts[0]))
+
+static uint64_t
+stats_out_counter(const struct mgr_stats *s, u_int i)
+{
+
+	return (*(const uint64_t *) ((const char *) s +
+	    stats_out_counters[i].ofs));
+}
+
+static const struct hist *
+stats_out_hist(const struct mgr_stats *s, u_int i)
+{
+
+	return ((const struct hist *) ((const char *) s +
+	    stats_out_hists[i].ofs));
+}
+
+int
+stats_out_fmt_parse(const char *str, stats_out_fmt_t *fmt)
+{
+
+	if (strcasecmp(str, "csv") == 0)
+		*fmt = STATS_OUT_FMT_CSV;
+	else if (strcasecmp(str, "jsonl") == 0)
+		*fmt = STATS_OUT_FMT_JSONL;
+	else
+		return (-1);
+	return (0);
+}
+
+static void
+stats_out_csv_header(struct stats_out *so)
+{
+	u_int i, j;
+
+	fprintf(so->fp, "time_usec,elapsed_usec,thread,state,stage,"
+	    "nconn,ol_backlog,conc_limit,conc_knee,conc_knee_rate");
+	for (i = 0; i < SO_NCOUNTERS; i++)
+		fprintf(so->fp, ",%s", stats_out_counters[i].name);
+	for (i = 0; i < SO_NHISTS; i++) {
+		fprintf(so->fp, ",%s_count,%s_mean", stats_out_hists[i].name,
+		    stats_out_hists[i].name);
+		for (j = 0; j < SO_NPCTS; j++)
+			fprintf(so->fp, ",%s_%s", stats_out_hists[i].name,
+			    stats_out_pcts[j].name);
+	}
+	fprintf(so->fp, "\n");
+}
+
+int
+stats_out_open(struct stats_out *so, const char *path, stats_out_fmt_t fmt,
+    int nthreads, uint64_t start_usec)
+{
+
+	bzero(so, sizeof(*so));
+	so->fmt = fmt;
+	so->nthreads = nthreads;
+	so->start_usec = start_usec;
+	so->last_flush_usec = start_usec;
+
+	so->prev = calloc(nthreads + 1, sizeof(*so->prev));
+	so->diff = calloc(1, sizeof(*so->diff));
+	so->buf = malloc(STATS_OUT_BUF_SIZE);
+	if (so->prev == NULL || so->diff == NULL || so->buf == NULL) {
+		warn("%s: calloc", __func__);
+		goto error;
+	}
+
+	so->fp = fopen(path, "w");
+	if (so->fp == NULL) {
+		warn("%s: fopen (%s)", __func__, path);
+		goto error;
+	}
+	setvbuf(so->fp, so->buf, _IOFBF, STATS_OUT_BUF_SIZE);
+
+	if (so->fmt == STATS_OUT_FMT_CSV)
+		stats_out_csv_header(so);
+
+	return (0);
+
+error:
+	free(so->prev);
+	free(so->diff);
+	free(so->buf);
+	bzero(so, sizeof(*so));
+	return (-1);
+}
+
+/*
+ * Write one set of stats: as a CSV row, or the members of a JSON
+ * object.  'prev' is updated for the next interval.
+ */
+static void
+stats_out_stats(struct stats_out *so, const struct mgr_stats *s,
+    struct mgr_stats *prev)
+{
+	const struct hist *h;
+	u_int i, j;
+
+	mgr_stats_diff(prev, s, so->diff);
+
+	if (so->fmt == STATS_OUT_FMT_CSV) {
+		fprintf(so->fp, ",%d,%d,%d,%d,%d", s->nconn, s->ol_backlog,
+		    s->conc_limit, s->conc_knee, s->conc_knee_rate);
+		for (i = 0; i < SO_NCOUNTERS; i++)
+			fprintf(so->fp, ",%llu",
+			    (unsigned long long) stats_out_counter(s, i));
+		for (i = 0; i < SO_NHISTS; i++) {
+			h = stats_out_hist(so->diff, i);
+			fprintf(so->fp, ",%llu,%llu",
+			    (unsigned long long) h->count,
+			    (unsigned long long) hist_mean(h));
+			for (j = 0; j < SO_NPCTS; j++)
+				fprintf(so->fp, ",%llu", (unsigned long long)
+				    hist_percentile(h, stats_out_pcts[j].pct));
+		}
+	} else {
+		fprintf(so->fp,
+		    "\"nconn\":%d,\"ol_backlog\":%d,\"conc_limit\":%d,"
+		    "\"conc_knee\":%d,\"conc_knee_rate\":%d",
+		    s->nconn, s->ol_backlog, s->conc_limit, s->conc_knee,
+		    s->conc_knee_rate);
+		for (i = 0; i < SO_NCOUNTERS; i++)
+			fprintf(so->fp, ",\"%s\":%llu",
+			    stats_out_counters[i].name,
+			    (unsigned long long) stats_out_counter(s, i));
+		for (i = 0; i < SO_NHISTS; i++) {
+			h = stats_out_hist(so->diff, i);
+			fprintf(so->fp, ",\"%s\":{\"count\":%llu,\"mean\":%llu",
+			    stats_out_hists[i].name,
+			    (unsigned long long) h->count,
+			    (unsigned long long) hist_mean(h));
+			for (j = 0; j < SO_NPCTS; j++)
+				fprintf(so->fp, ",\"%s\":%llu",
+				    stats_out_pcts[j].name,
+				    (unsigned long long)
+				    hist_percentile(h, stats_out_pcts[j].pct));
+			fprintf(so->fp, "}");
+		}
+	}
+
+	mgr_stats_copy(s, prev);
+}
+
+/*
+ * Write a record: the total, in 'state' and profile 'stage', then
+ * each thread.
+ */
+void
+stats_out_write(struct stats_out *so, uint64_t now_usec, const char *state,
+    const char *stage, const struct mgr_stats *total,
+    const char * const *thr_state, const struct mgr_stats *thr)
+{
+	uint64_t elapsed;
+	int i;
+
+	if (so->fp == NULL)
+		return;
+
+	elapsed = now_usec - so->start_usec;
+
+	if (so->fmt == STATS_OUT_FMT_CSV) {
+		fprintf(so->fp, "%llu,%llu,all,%s,%s",
+		    (unsigned long long) now_usec,
+		    (unsigned long long) elapsed, state, stage);
+		stats_out_stats(so, total, &so->prev[so->nthreads]);
+		fprintf(so->fp, "\n");
+		for (i = 0; i < so->nthreads; i++) {
+			fprintf(so->fp, "%llu,%llu,%d,%s,%s",
+			    (unsigned long long) now_usec,
+			    (unsigned long long) elapsed, i, thr_state[i],
+			    stage);
+			stats_out_stats(so, &thr[i], &so->prev[i]);
+			fprintf(so->fp, "\n");
+		}
+	} else {
+		fprintf(so->fp, "{\"time_usec\":%llu,\"elapsed_usec\":%llu,"
+		    "\"state\":\"%s\",\"stage\":\"%s\",",
+		    (unsigned long long) now_usec,
+		    (unsigned long long) elapsed, state, stage);
+		stats_out_stats(so, total, &so->prev[so->nthreads]);
+		fprintf(so->fp, ",\"threads\":[");
+		for (i = 0; i < so->nthreads; i++) {
+			fprintf(so->fp, "%s{\"thread\":%d,\"state\":\"%s\",",
+			    i > 0 ? "," : "", i, thr_state[i]);
+			stats_out_stats(so, &thr[i], &so->prev[i]);
+			fprintf(so->fp, "}");
+		}
+		fprintf(so->fp, "]}\n");
+	}
+
+	if (now_usec - so->last_flush_usec >= 1000000) {
+		fflush(so->fp);
+		so->last_flush_usec = now_usec;
+	}
+}
+
+void
+stats_out_close(struct stats_out *so)
+{
+
+	if (so->fp != NULL && fclose(so->fp) != 0)
+		warn("%s: fclose", __func__);
+	free(so->prev);
+	free(so->diff);
+	free(so->buf);
+	bzero(so, sizeof(*so));
+}
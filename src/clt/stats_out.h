@@ -0,0 +1,54 @@
+#ifndef	__STATS_OUT_H__
+#define	__STATS_OUT_H__
+
+/*
+ * Time series statistics export, for plotting runs and lining them
+ * up with server side metrics.
+ *
+ * Each record carries the monotonic time, the manager state, the
+ * load profile stage (if any) and every mgr_stats field for the whole client and for each worker
+ * thread.  Counters are cumulative; the latency percentiles are for
+ * the interval since the previous record.
+ *
+ * + CSV writes one row per thread plus a row for the total
+ *   (thread "all") per record, after a header row.
+ * + JSON lines writes one object per record with a "threads" array.
+ *
+ * This is only called from the stats thread and writes through a
+ * large stdio buffer, so a slow disk never holds up the workers.
+ */
+typedef enum {
+	STATS_OUT_FMT_CSV,
+	STATS_OUT_FMT_JSONL,
+} stats_out_fmt_t;
+
+/* Shortest --stats-interval-msec */
+#define	STATS_OUT_INTERVAL_MIN_MSEC	100
+
+/* Write buffer size; it's flushed at least once a second */
+#define	STATS_OUT_BUF_SIZE		(256 * 1024)
+
+struct stats_out {
+	FILE *fp;
+	char *buf;
+	stats_out_fmt_t fmt;
+	int nthreads;
+	uint64_t start_usec;
+	uint64_t last_flush_usec;
+
+	/* Previous stats, per thread then the total, for intervals */
+	struct mgr_stats *prev;
+
+	/* Scratch for the interval diff */
+	struct mgr_stats *diff;
+};
+
+extern	int stats_out_fmt_parse(const char *str, stats_out_fmt_t *fmt);
+extern	int stats_out_open(struct stats_out *so, const char *path,
+	    stats_out_fmt_t fmt, int nthreads, uint64_t start_usec);
+extern	void stats_out_write(struct stats_out *so, uint64_t now_usec,
+	    const char *state, const char *stage, const struct mgr_stats *total,
+	    const char * const *thr_state, const struct mgr_stats *thr);
+extern	void stats_out_close(struct stats_out *so);
+
+#endif	/* __STATS_OUT_H__ */
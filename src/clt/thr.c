@@ -13,15 +13,21 @@
 #include <sys/param.h>
 #include <sys/cpuset.h>
 #include <sys/socket.h>
+#include <sys/queue.h>
 
 #include <netinet/in.h>
 
 #include <evhtp.h>
 
 #include "debug.h"
+#include "rng.h"
 #include "mgr_config.h"
+#include "hist.h"
 #include "mgr_stats.h"
+#include "seqlock.h"
 #include "thr.h"
+#include "tw.h"
+#include "clt.h"
 #include "mgr.h"
 
 int
@@ -32,8 +38,10 @@ clt_thr_setup(struct clt_thr *th, int tid)
 	th->t_tid = tid;
 	th->t_evbase = event_base_new();
 	th->t_htp = evhtp_new(th->t_evbase, NULL);
-
-	pthread_mutex_init(&th->prev_stats_mtx, NULL);
+	th->t_tw = tw_new(th->t_evbase);
+	if (th->t_tw == NULL)
+		return (-1);
+	TAILQ_INIT(&th->t_req_pool);
 
 	return (0);
 }
@@ -42,7 +50,39 @@ void
 clt_thr_free(struct clt_thr *th)
 {
 
-	pthread_mutex_destroy(&th->prev_stats_mtx);
+	clt_conn_pool_drain(th);
+	tw_free(th->t_tw);
 	evhtp_free(th->t_htp);
 	event_base_free(th->t_evbase);
 }
+
+/*
+ * Publish the worker's state and statistics; only the worker calls
+ * this.
+ */
+void
+clt_thr_stats_publish(struct clt_thr *th, int state,
+    const struct mgr_stats *stats)
+{
+
+	seqlock_write_begin(&th->t_stats_seq);
+	th->t_stats_state = state;
+	mgr_stats_copy(stats, &th->t_stats);
+	seqlock_write_end(&th->t_stats_seq);
+}
+
+/*
+ * Copy out the last published state and statistics; safe from any
+ * thread.
+ */
+void
+clt_thr_stats_read(struct clt_thr *th, int *state, struct mgr_stats *stats)
+{
+	u_int seq;
+
+	do {
+		seq = seqlock_read_begin(&th->t_stats_seq);
+		*state = th->t_stats_state;
+		mgr_stats_copy(&th->t_stats, stats);
+	} while (seqlock_read_retry(&th->t_stats_seq, seq));
+}
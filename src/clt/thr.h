@@ -10,12 +10,34 @@ struct clt_thr {
 	evbase_t *t_evbase;
 	evhtp_t  *t_htp;
 
-	/* Previous statistics */
-	pthread_mutex_t prev_stats_mtx;
-	struct mgr_stats prev_stats;
+	/* Request timeout wheel */
+	struct tw *t_tw;
+
+	/* TLS context and session cache; NULL for cleartext */
+	struct clt_tls *t_tls;
+
+	/* The manager's running stats; only touched by this thread */
+	struct mgr_stats *t_mstats;
+
+	/* Free pool of client_req entries */
+	TAILQ_HEAD(, client_req) t_req_pool;
+	int t_req_pool_count;
+
+	/*
+	 * Statistics snapshot, published by the worker each periodic
+	 * tick and read by the stats thread without locking.  It starts
+	 * on its own cache line, away from the state above.
+	 */
+	struct seqlock t_stats_seq __aligned(CACHE_LINE_SIZE);
+	int t_stats_state;		/* clt_mgr_state_t */
+	struct mgr_stats t_stats;
 };
 
 extern	int clt_thr_setup(struct clt_thr *th, int tid);
 extern	void clt_thr_free(struct clt_thr *th);
+extern	void clt_thr_stats_publish(struct clt_thr *th, int state,
+	    const struct mgr_stats *stats);
+extern	void clt_thr_stats_read(struct clt_thr *th, int *state,
+	    struct mgr_stats *stats);
 
 #endif	/* __THR_H__ */
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+
+#include "trace.h"
+
+static const char *trace_method_names[TRACE_METHOD_MAX] = {
+	"GET",
+	"HEAD",
+	"POST",
+	"PUT",
+	"DELETE",
+	"OPTIONS",
+};
+
+const char *
+trace_method_str(trace_method_t m)
+{
+
+	if (m >= TRACE_METHOD_MAX)
+		return "<unknown>";
+	return (trace_method_names[m]);
+}
+
+int
+trace_method_parse(const char *str, trace_method_t *m)
+{
+	int i;
+
+	for (i = 0; i < TRACE_METHOD_MAX; i++) {
+		if (strcasecmp(str, trace_method_names[i]) == 0) {
+			*m = i;
+			return (0);
+		}
+	}
+	return (-1);
+}
+
+/*
+ * Check the whole file up front, so the replay path can trust it.
+ */
+static int
+trace_validate(struct trace *t, const char *path)
+{
+	const struct trace_rec *r;
+	uint64_t i, ofs;
+
+	if (t->len < sizeof(struct trace_file_hdr)) {
+		warnx("%s: %s: too short", __func__, path);
+		return (-1);
+	}
+	if (t->hdr->magic != TRACE_MAGIC || t->hdr->version != TRACE_VERSION) {
+		warnx("%s: %s: bad magic/version", __func__, path);
+		return (-1);
+	}
+	if (t->hdr->nrecords == 0) {
+		warnx("%s: %s: no records", __func__, path);
+		return (-1);
+	}
+	if (t->hdr->index_ofs % sizeof(uint64_t) != 0 ||
+	    t->hdr->index_ofs > t->len ||
+	    (t->len - t->hdr->index_ofs) / sizeof(uint64_t) < t->hdr->nrecords) {
+		warnx("%s: %s: bad index", __func__, path);
+		return (-1);
+	}
+	t->index = (const uint64_t *) ((const char *) t->base +
+	    t->hdr->index_ofs);
+
+	for (i = 0; i < t->hdr->nrecords; i++) {
+		ofs = t->index[i];
+		if (ofs % TRACE_REC_ALIGN != 0 ||
+		    ofs < sizeof(struct trace_file_hdr) ||
+		    ofs + sizeof(struct trace_rec) > t->hdr->index_ofs) {
+			warnx("%s: %s: record %llu: bad offset", __func__, path,
+			    (unsigned long long) i);
+			return (-1);
+		}
+		r = trace_get(t, i);
+		if (ofs + sizeof(*r) + r->uri_len + 1 + r->hdr_len >
+		    t->hdr->index_ofs ||
+		    r->method >= TRACE_METHOD_MAX ||
+		    trace_rec_uri(r)[r->uri_len] != '\0') {
+			warnx("%s: %s: record %llu: bad record", __func__, path,
+			    (unsigned long long) i);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+int
+trace_open(struct trace *t, const char *path)
+{
+	struct stat sb;
+	int fd;
+
+	bzero(t, sizeof(*t));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		warn("%s: open (%s)", __func__, path);
+		return (-1);
+	}
+	if (fstat(fd, &sb) < 0) {
+		warn("%s: fstat (%s)", __func__, path);
+		close(fd);
+		return (-1);
+	}
+
+	t->len = sb.st_size;
+	t->base = mmap(NULL, t->len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (t->base == MAP_FAILED) {
+		warn("%s: mmap (%s)", __func__, path);
+		t->base = NULL;
+		return (-1);
+	}
+
+	t->hdr = t->base;
+	if (trace_validate(t, path) != 0) {
+		trace_close(t);
+		return (-1);
+	}
+	t->nrecords = t->hdr->nrecords;
+
+	return (0);
+}
+
+void
+trace_close(struct trace *t)
+{
+
+	if (t->base != NULL)
+		munmap(t->base, t->len);
+	bzero(t, sizeof(*t));
+}
@@ -0,0 +1,99 @@
+#ifndef	__TRACE_H__
+#define	__TRACE_H__
+
+/*
+ * Binary request trace format.
+ *
+ * This is shared between the client (which mmap()s it and replays
+ * it) and the trace converter.  Everything is in host byte order;
+ * traces aren't meant to be moved between architectures.
+ *
+ * Layout:
+ *
+ *   struct trace_file_hdr
+ *   records, each TRACE_REC_ALIGN aligned:
+ *     struct trace_rec
+ *     uri bytes, then a NUL
+ *     header bytes - pre-serialised "Name: value\r\n" lines
+ *   uint64_t index[nrecords] - file offset of each record
+ *
+ * The NUL after the URI means it can be used in place, and the index
+ * means a worker can jump straight to any record without parsing.
+ */
+
+#define	TRACE_MAGIC		0x43525448	/* "HTRC" */
+#define	TRACE_VERSION		1
+#define	TRACE_REC_ALIGN		8
+
+typedef enum {
+	TRACE_METHOD_GET = 0,
+	TRACE_METHOD_HEAD,
+	TRACE_METHOD_POST,
+	TRACE_METHOD_PUT,
+	TRACE_METHOD_DELETE,
+	TRACE_METHOD_OPTIONS,
+	TRACE_METHOD_MAX
+} trace_method_t;
+
+struct trace_file_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t nrecords;
+	uint64_t index_ofs;
+};
+
+struct trace_rec {
+	/* Time since the previous request, or 0 for none */
+	uint32_t iat_usec;
+
+	/* trace_method_t */
+	uint8_t method;
+	uint8_t pad0;
+
+	/* URI length, not including the trailing NUL */
+	uint16_t uri_len;
+
+	/* Length of the pre-serialised header lines */
+	uint16_t hdr_len;
+	uint16_t pad1;
+};
+
+static inline const char *
+trace_rec_uri(const struct trace_rec *r)
+{
+
+	return ((const char *) (r + 1));
+}
+
+static inline const char *
+trace_rec_hdrs(const struct trace_rec *r)
+{
+
+	return (trace_rec_uri(r) + r->uri_len + 1);
+}
+
+/*
+ * A mapped trace file.
+ */
+struct trace {
+	void *base;
+	size_t len;
+	const struct trace_file_hdr *hdr;
+	const uint64_t *index;
+	uint64_t nrecords;
+};
+
+extern	int trace_open(struct trace *t, const char *path);
+extern	void trace_close(struct trace *t);
+extern	const char * trace_method_str(trace_method_t m);
+extern	int trace_method_parse(const char *str, trace_method_t *m);
+
+static inline const struct trace_rec *
+trace_get(const struct trace *t, uint64_t i)
+{
+
+	return ((const struct trace_rec *)
+	    ((const char *) t->base + t->index[i]));
+}
+
+#endif	/* __TRACE_H__ */
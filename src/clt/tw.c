@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <evhtp.h>
+
+#include "debug.h"
+#include "mtime.h"
+#include "tw.h"
+
+#define	TW_SLOT_MASK		(TW_NSLOTS - 1)
+#define	TW_TICK_USEC		(TW_TICK_MSEC * 1000)
+
+static uint64_t
+tw_clock_tick(const struct tw *tw)
+{
+
+	return ((mtime_now_usec() - tw->base_usec) / TW_TICK_USEC);
+}
+
+/*
+ * Return the tick at which the entry should expire, given its
+ * current timestamps.
+ */
+static uint64_t
+tw_ent_deadline(const struct tw *tw, const struct tw_ent *e)
+{
+	uint64_t d = UINT64_MAX;
+
+	if (tw->idle_ticks > 0)
+		d = e->last + tw->idle_ticks;
+	if (tw->total_ticks > 0 && e->start + tw->total_ticks < d)
+		d = e->start + tw->total_ticks;
+
+	return (d);
+}
+
+static void
+tw_ent_insert(struct tw *tw, struct tw_ent *e, uint64_t deadline)
+{
+
+	e->slot = deadline & TW_SLOT_MASK;
+	TAILQ_INSERT_TAIL(&tw->slots[e->slot], e, node);
+}
+
+static void
+tw_schedule(struct tw *tw)
+{
+	struct timeval tv;
+
+	tv.tv_sec = 0;
+	tv.tv_usec = TW_TICK_USEC;
+	evtimer_add(tw->ev, &tv);
+	tw->ev_pending = 1;
+}
+
+/*
+ * Walk the slot for the given tick, expiring entries whose deadline
+ * has passed and moving the rest to the slot for their new deadline.
+ */
+static void
+tw_run_slot(struct tw *tw, uint64_t tick)
+{
+	struct tw_ent *e, *en;
+	TAILQ_HEAD(, tw_ent) expired;
+	uint64_t d;
+	int s;
+
+	TAILQ_INIT(&expired);
+	s = tick & TW_SLOT_MASK;
+
+	TAILQ_FOREACH_SAFE(e, &tw->slots[s], node, en) {
+		d = tw_ent_deadline(tw, e);
+		if (d <= tick) {
+			TAILQ_REMOVE(&tw->slots[s], e, node);
+			TAILQ_INSERT_TAIL(&expired, e, node);
+			continue;
+		}
+		/* Still on this slot - it's a later lap; leave it be */
+		if ((int) (d & TW_SLOT_MASK) == s)
+			continue;
+		TAILQ_REMOVE(&tw->slots[s], e, node);
+		tw_ent_insert(tw, e, d);
+	}
+
+	/*
+	 * Run the callbacks once the slot walk is done; they're
+	 * free to stop/start other entries.
+	 */
+	while ((e = TAILQ_FIRST(&expired)) != NULL) {
+		TAILQ_REMOVE(&expired, e, node);
+		e->slot = -1;
+		tw->nents--;
+		e->cb(e, e->cbdata);
+	}
+}
+
+static void
+tw_timer(evutil_socket_t sock, short which, void *arg)
+{
+	struct tw *tw = arg;
+	uint64_t t, n;
+
+	tw->ev_pending = 0;
+
+	/*
+	 * Catch up on however many ticks have actually passed;
+	 * the timer won't fire exactly on time.  There's no point
+	 * walking more than one full lap.
+	 */
+	t = tw_clock_tick(tw);
+	if (t - tw->now > TW_NSLOTS)
+		tw->now = t - TW_NSLOTS;
+	for (n = tw->now + 1; n <= t; n++) {
+		tw->now = n;
+		tw_run_slot(tw, n);
+	}
+
+	if (tw->nents > 0 && tw->ev_pending == 0)
+		tw_schedule(tw);
+}
+
+struct tw *
+tw_new(evbase_t *evbase)
+{
+	struct tw *tw;
+	int i;
+
+	tw = calloc(1, sizeof(*tw));
+	if (tw == NULL) {
+		warn("%s: calloc", __func__);
+		return (NULL);
+	}
+
+	tw->ev = evtimer_new(evbase, tw_timer, tw);
+	if (tw->ev == NULL) {
+		warnx("%s: evtimer_new failed", __func__);
+		free(tw);
+		return (NULL);
+	}
+
+	for (i = 0; i < TW_NSLOTS; i++)
+		TAILQ_INIT(&tw->slots[i]);
+
+	tw->base_usec = mtime_now_usec();
+	tw->now = 0;
+
+	return (tw);
+}
+
+void
+tw_free(struct tw *tw)
+{
+
+	evtimer_del(tw->ev);
+	event_free(tw->ev);
+	free(tw);
+}
+
+void
+tw_set_timeouts(struct tw *tw, int idle_msec, int total_msec)
+{
+
+	tw->idle_msec = idle_msec;
+	tw->total_msec = total_msec;
+
+	/* Round up so a short timeout doesn't become zero */
+	tw->idle_ticks = -1;
+	if (idle_msec > 0)
+		tw->idle_ticks = (idle_msec + TW_TICK_MSEC - 1) / TW_TICK_MSEC;
+	tw->total_ticks = -1;
+	if (total_msec > 0)
+		tw->total_ticks = (total_msec + TW_TICK_MSEC - 1) / TW_TICK_MSEC;
+}
+
+void
+tw_ent_init(struct tw_ent *e, tw_expire_cb *cb, void *cbdata)
+{
+
+	e->slot = -1;
+	e->last = e->start = 0;
+	e->cb = cb;
+	e->cbdata = cbdata;
+}
+
+void
+tw_ent_start(struct tw *tw, struct tw_ent *e)
+{
+
+	if (e->slot != -1)
+		tw_ent_stop(tw, e);
+
+	/* Nothing to time out on? */
+	if (tw->idle_ticks <= 0 && tw->total_ticks <= 0)
+		return;
+
+	/*
+	 * If the wheel timer isn't running then tw->now is stale;
+	 * resync it before it's used as a timestamp.
+	 */
+	if (tw->ev_pending == 0)
+		tw->now = tw_clock_tick(tw);
+
+	e->start = e->last = tw->now;
+	tw_ent_insert(tw, e, tw_ent_deadline(tw, e));
+	tw->nents++;
+
+	if (tw->ev_pending == 0)
+		tw_schedule(tw);
+}
+
+void
+tw_ent_stop(struct tw *tw, struct tw_ent *e)
+{
+
+	if (e->slot == -1)
+		return;
+	TAILQ_REMOVE(&tw->slots[e->slot], e, node);
+	e->slot = -1;
+	tw->nents--;
+}
@@ -0,0 +1,87 @@
+#ifndef	__TW_H__
+#define	__TW_H__
+
+/*
+ * A coarse hashed timer wheel for per-request timeouts.
+ *
+ * Each entry tracks an idle deadline (time since the last activity)
+ * and a total deadline (time since the request started.)  Noting
+ * activity only updates the entry timestamp; the entry stays in
+ * whichever slot it's in and is moved along when that slot comes
+ * around and the deadline hasn't yet passed.
+ *
+ * The wheel timer is only scheduled whilst there are entries on it,
+ * so an idle wheel doesn't keep the event loop alive.
+ */
+
+/* Number of slots; must be a power of two */
+#define	TW_NSLOTS		1024
+
+/* Tick length */
+#define	TW_TICK_MSEC		10
+
+struct tw;
+struct tw_ent;
+
+typedef	void tw_expire_cb(struct tw_ent *e, void *arg);
+
+struct tw_ent {
+	TAILQ_ENTRY(tw_ent) node;
+
+	/* Slot we're on, or -1 if we're not on the wheel */
+	int slot;
+
+	/* Tick of the last activity */
+	uint64_t last;
+
+	/* Tick the entry was started */
+	uint64_t start;
+
+	tw_expire_cb *cb;
+	void *cbdata;
+};
+
+struct tw {
+	event_t *ev;
+	int ev_pending;
+
+	/* Current tick */
+	uint64_t now;
+
+	/* Monotonic time of tick 0 */
+	uint64_t base_usec;
+
+	/* Timeouts in ticks; <= 0 is disabled */
+	int idle_ticks;
+	int total_ticks;
+
+	/* .. and as configured */
+	int idle_msec;
+	int total_msec;
+
+	/* How many entries are on the wheel */
+	int nents;
+
+	TAILQ_HEAD(, tw_ent) slots[TW_NSLOTS];
+};
+
+extern	struct tw * tw_new(evbase_t *evbase);
+extern	void tw_free(struct tw *tw);
+extern	void tw_set_timeouts(struct tw *tw, int idle_msec, int total_msec);
+extern	void tw_ent_init(struct tw_ent *e, tw_expire_cb *cb, void *cbdata);
+extern	void tw_ent_start(struct tw *tw, struct tw_ent *e);
+extern	void tw_ent_stop(struct tw *tw, struct tw_ent *e);
+
+/*
+ * Note activity on an entry; this pushes the idle deadline out.
+ *
+ * It's deliberately just a timestamp update.
+ */
+static inline void
+tw_ent_touch(struct tw *tw, struct tw_ent *e)
+{
+
+	e->last = tw->now;
+}
+
+#endif	/* __TW_H__ */
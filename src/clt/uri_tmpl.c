@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <err.h>
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "rng.h"
+#include "dist.h"
+#include "uri_tmpl.h"
+
+/* Enough for a uint64_t in decimal */
+#define	URI_TMPL_NUM_MAX	20
+
+static struct uri_tmpl_op *
+uri_tmpl_op_add(struct uri_tmpl *t, uri_tmpl_op_type_t type)
+{
+	struct uri_tmpl_op *o;
+
+	o = realloc(t->ops, (t->nops + 1) * sizeof(*o));
+	if (o == NULL) {
+		warn("%s: realloc", __func__);
+		return (NULL);
+	}
+	t->ops = o;
+	o = &t->ops[t->nops++];
+	bzero(o, sizeof(*o));
+	o->type = type;
+	return (o);
+}
+
+int
+uri_tmpl_compile(struct uri_tmpl *t, const char *src, int tid)
+{
+	struct uri_tmpl_op *o;
+	const char *p, *s, *e;
+	char name[128];
+	size_t len, max;
+
+	bzero(t, sizeof(*t));
+	t->tid = tid;
+	t->src = strdup(src);
+	if (t->src == NULL) {
+		warn("%s: strdup", __func__);
+		return (-1);
+	}
+
+	/* Worst-case expansion size is worked out as we go */
+	max = 1;
+	for (p = t->src; *p != '\0'; p = e) {
+		s = strchr(p, '{');
+		if (s == NULL)
+			s = p + strlen(p);
+
+		/* Literal run up to the next substitution */
+		if (s > p) {
+			o = uri_tmpl_op_add(t, URI_TMPL_OP_LITERAL);
+			if (o == NULL)
+				goto error;
+			o->ofs = p - t->src;
+			o->len = s - p;
+			max += o->len;
+		}
+		if (*s == '\0')
+			break;
+
+		e = strchr(s, '}');
+		if (e == NULL) {
+			fprintf(stderr, "%s: unterminated '{' in '%s'\n",
+			    __func__, src);
+			goto error;
+		}
+		len = e - s - 1;
+		e++;
+		if (len == 0 || len >= sizeof(name)) {
+			fprintf(stderr, "%s: invalid substitution in '%s'\n",
+			    __func__, src);
+			goto error;
+		}
+		memcpy(name, s + 1, len);
+		name[len] = '\0';
+
+		if (strcmp(name, "seq") == 0) {
+			o = uri_tmpl_op_add(t, URI_TMPL_OP_SEQ);
+		} else if (strcmp(name, "tid") == 0) {
+			o = uri_tmpl_op_add(t, URI_TMPL_OP_TID);
+		} else {
+			o = uri_tmpl_op_add(t, URI_TMPL_OP_DIST);
+			if (o != NULL && dist_parse(&o->dist, name) != 0) {
+				fprintf(stderr, "%s: invalid substitution '{%s}'\n",
+				    __func__, name);
+				goto error;
+			}
+		}
+		if (o == NULL)
+			goto error;
+		max += URI_TMPL_NUM_MAX;
+	}
+
+	t->size = max;
+	t->buf = malloc(t->size);
+	if (t->buf == NULL) {
+		warn("%s: malloc", __func__);
+		goto error;
+	}
+
+	return (0);
+
+error:
+	uri_tmpl_free(t);
+	return (-1);
+}
+
+/*
+ * Write a uint64_t in decimal; returns the number of characters.
+ */
+static size_t
+uri_tmpl_put_num(char *p, uint64_t v)
+{
+	char tmp[URI_TMPL_NUM_MAX];
+	size_t n = 0, i;
+
+	do {
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while (v != 0);
+	for (i = 0; i < n; i++)
+		p[i] = tmp[n - 1 - i];
+	return (n);
+}
+
+/*
+ * Expand the template for the next request.
+ *
+ * The returned string is owned by the template and is only valid
+ * until the next call.
+ */
+const char *
+uri_tmpl_expand(struct uri_tmpl *t, struct rng *r)
+{
+	const struct uri_tmpl_op *o;
+	char *p = t->buf;
+	int i;
+
+	for (i = 0; i < t->nops; i++) {
+		o = &t->ops[i];
+		switch (o->type) {
+		case URI_TMPL_OP_LITERAL:
+			memcpy(p, t->src + o->ofs, o->len);
+			p += o->len;
+			break;
+		case URI_TMPL_OP_SEQ:
+			p += uri_tmpl_put_num(p, t->seq);
+			break;
+		case URI_TMPL_OP_TID:
+			p += uri_tmpl_put_num(p, t->tid);
+			break;
+		case URI_TMPL_OP_DIST:
+			p += uri_tmpl_put_num(p, dist_sample(&o->dist, r));
+			break;
+		}
+	}
+	*p = '\0';
+	t->seq++;
+
+	return (t->buf);
+}
+
+void
+uri_tmpl_free(struct uri_tmpl *t)
+{
+
+	free(t->src);
+	free(t->ops);
+	free(t->buf);
+	bzero(t, sizeof(*t));
+}
@@ -0,0 +1,62 @@
+#ifndef	__URI_TMPL_H__
+#define	__URI_TMPL_H__
+
+/*
+ * A URI template, eg "/size?size={lognormal:16k,2.0}&id={seq}".
+ *
+ * The template is compiled once into a list of ops (literal runs
+ * and substitutions) and then expanded per request into a per-thread
+ * buffer, so the request path never parses the template.
+ *
+ * Substitutions:
+ *
+ * + {seq}		- a per-thread request sequence number
+ * + {tid}		- the thread id
+ * + {<dist>}		- a sample from a distribution (see dist.h)
+ */
+typedef enum {
+	URI_TMPL_OP_LITERAL,
+	URI_TMPL_OP_SEQ,
+	URI_TMPL_OP_TID,
+	URI_TMPL_OP_DIST,
+} uri_tmpl_op_type_t;
+
+struct uri_tmpl_op {
+	uri_tmpl_op_type_t type;
+
+	/* Literal: offset/length into the template string */
+	size_t ofs;
+	size_t len;
+
+	/* Distribution */
+	struct dist dist;
+};
+
+struct uri_tmpl {
+	char *src;
+	struct uri_tmpl_op *ops;
+	int nops;
+
+	int tid;
+	uint64_t seq;
+
+	/* Expansion buffer */
+	char *buf;
+	size_t size;
+};
+
+extern	int uri_tmpl_compile(struct uri_tmpl *t, const char *src, int tid);
+extern	const char *uri_tmpl_expand(struct uri_tmpl *t, struct rng *r);
+extern	void uri_tmpl_free(struct uri_tmpl *t);
+
+/*
+ * Does this string contain any substitutions?
+ */
+static inline int
+uri_tmpl_is_template(const char *s)
+{
+
+	return (s != NULL && strchr(s, '{') != NULL);
+}
+
+#endif	/* __URI_TMPL_H__ */
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stdint.h>
+
+#include <machine/atomic.h>
+
+#include "alloc_stats.h"
+
+/*
+ * Per-thread counters live in a static array rather than in TLS, so
+ * they're still there to report after the thread exits.  Threads
+ * past the end share the last slot, and its counts are approximate.
+ */
+#define	ALLOC_STATS_THREADS_MAX		256
+
+/* dlsym() may allocate before we've found the real allocator */
+#define	ALLOC_STATS_BOOTSTRAP_SIZE	(64 * 1024)
+
+struct alloc_stats_phase {
+	uint64_t nalloc;
+	uint64_t nbytes;
+	uint64_t nfree;
+};
+
+struct alloc_stats_thr {
+	struct alloc_stats_phase phase[ALLOC_PHASE_MAX];
+	uint64_t nreq;
+} __aligned(CACHE_LINE_SIZE);
+
+static struct alloc_stats_thr alloc_stats_thr[ALLOC_STATS_THREADS_MAX];
+static volatile u_int alloc_stats_nthr;
+
+static __thread struct alloc_stats_thr *alloc_stats_self;
+static __thread int alloc_stats_cur_phase;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void (*real_free)(void *);
+
+static char alloc_stats_bootstrap[ALLOC_STATS_BOOTSTRAP_SIZE]
+    __aligned(16);
+static size_t alloc_stats_bootstrap_used;
+static int alloc_stats_resolving;
+
+static void
+alloc_stats_resolve(void)
+{
+
+	alloc_stats_resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_free = dlsym(RTLD_NEXT, "free");
+	alloc_stats_resolving = 0;
+	if (real_malloc == NULL || real_calloc == NULL ||
+	    real_realloc == NULL || real_posix_memalign == NULL ||
+	    real_free == NULL) {
+		fprintf(stderr, "alloc_stats: can't find the allocator\n");
+		abort();
+	}
+}
+
+static void *
+alloc_stats_bootstrap_alloc(size_t size)
+{
+	void *p;
+
+	size = roundup2(size, 16);
+	if (alloc_stats_bootstrap_used + size > ALLOC_STATS_BOOTSTRAP_SIZE)
+		return (NULL);
+	p = alloc_stats_bootstrap + alloc_stats_bootstrap_used;
+	alloc_stats_bootstrap_used += size;
+	return (p);
+}
+
+static int
+alloc_stats_is_bootstrap(const void *p)
+{
+
+	return ((const char *) p >= alloc_stats_bootstrap &&
+	    (const char *) p < alloc_stats_bootstrap +
+	    ALLOC_STATS_BOOTSTRAP_SIZE);
+}
+
+static struct alloc_stats_thr *
+alloc_stats_get(void)
+{
+	u_int i;
+
+	if (alloc_stats_self == NULL) {
+		i = atomic_fetchadd_int(&alloc_stats_nthr, 1);
+		if (i >= ALLOC_STATS_THREADS_MAX)
+			i = ALLOC_STATS_THREADS_MAX - 1;
+		alloc_stats_self = &alloc_stats_thr[i];
+	}
+	return (alloc_stats_self);
+}
+
+static void
+alloc_stats_count_alloc(size_t size)
+{
+	struct alloc_stats_phase *ph;
+
+	ph = &alloc_stats_get()->phase[alloc_stats_cur_phase];
+	ph->nalloc++;
+	ph->nbytes += size;
+}
+
+void *
+malloc(size_t size)
+{
+
+	if (real_malloc == NULL) {
+		if (alloc_stats_resolving)
+			return (alloc_stats_bootstrap_alloc(size));
+		alloc_stats_resolve();
+	}
+	alloc_stats_count_alloc(size);
+	return (real_malloc(size));
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+
+	if (real_calloc == NULL) {
+		/* The bootstrap buffer is static, so already zeroed */
+		if (alloc_stats_resolving)
+			return (alloc_stats_bootstrap_alloc(n * size));
+		alloc_stats_resolve();
+	}
+	alloc_stats_count_alloc(n * size);
+	return (real_calloc(n, size));
+}
+
+void *
+realloc(void *p, size_t size)
+{
+	void *np;
+
+	if (real_realloc == NULL) {
+		if (alloc_stats_resolving)
+			return (alloc_stats_bootstrap_alloc(size));
+		alloc_stats_resolve();
+	}
+
+	/* Bootstrap memory can't be handed to the real allocator */
+	if (p != NULL && alloc_stats_is_bootstrap(p)) {
+		np = malloc(size);
+		if (np != NULL)
+			memcpy(np, p, MIN(size, (size_t) (alloc_stats_bootstrap +
+			    ALLOC_STATS_BOOTSTRAP_SIZE - (char *) p)));
+		return (np);
+	}
+	alloc_stats_count_alloc(size);
+	return (real_realloc(p, size));
+}
+
+int
+posix_memalign(void **pp, size_t align, size_t size)
+{
+
+	if (real_posix_memalign == NULL) {
+		if (alloc_stats_resolving)
+			return (ENOMEM);
+		alloc_stats_resolve();
+	}
+	alloc_stats_count_alloc(size);
+	return (real_posix_memalign(pp, align, size));
+}
+
+void
+free(void *p)
+{
+
+	if (p == NULL || alloc_stats_is_bootstrap(p))
+		return;
+	alloc_stats_get()->phase[alloc_stats_cur_phase].nfree++;
+	real_free(p);
+}
+
+int
+alloc_stats_phase_enter(int phase)
+{
+	int prev;
+
+	prev = alloc_stats_cur_phase;
+	alloc_stats_cur_phase = phase;
+	return (prev);
+}
+
+void
+alloc_stats_phase_exit(int prev)
+{
+
+	alloc_stats_cur_phase = prev;
+}
+
+void
+alloc_stats_request_done(void)
+{
+
+	alloc_stats_get()->nreq++;
+}
+
+static const char *
+alloc_stats_phase_str(int phase)
+{
+
+	switch (phase) {
+	case ALLOC_PHASE_OTHER:
+		return ("other");
+	case ALLOC_PHASE_CONNECT:
+		return ("connect");
+	case ALLOC_PHASE_REQUEST:
+		return ("request");
+	case ALLOC_PHASE_RESPONSE:
+		return ("response");
+	case ALLOC_PHASE_TEARDOWN:
+		return ("teardown");
+	default:
+		return ("<unknown>");
+	}
+}
+
+/*
+ * Sum every thread's counters and print them.  Other threads may
+ * still be running, so the figures are as of about now.
+ */
+void
+alloc_stats_report(FILE *fp, const char *prog)
+{
+	struct alloc_stats_phase sum[ALLOC_PHASE_MAX], total;
+	uint64_t nreq = 0;
+	u_int i, n;
+	int j;
+
+	memset(sum, 0, sizeof(sum));
+	memset(&total, 0, sizeof(total));
+	n = atomic_load_acq_int(&alloc_stats_nthr);
+	if (n > ALLOC_STATS_THREADS_MAX)
+		n = ALLOC_STATS_THREADS_MAX;
+	for (i = 0; i < n; i++) {
+		nreq += alloc_stats_thr[i].nreq;
+		for (j = 0; j < ALLOC_PHASE_MAX; j++) {
+			sum[j].nalloc += alloc_stats_thr[i].phase[j].nalloc;
+			sum[j].nbytes += alloc_stats_thr[i].phase[j].nbytes;
+			sum[j].nfree += alloc_stats_thr[i].phase[j].nfree;
+		}
+	}
+
+	fprintf(fp, "%s: allocations over %llu requests, %u threads:\n",
+	    prog, (unsigned long long) nreq, n);
+	for (j = 0; j <= ALLOC_PHASE_MAX; j++) {
+		const struct alloc_stats_phase *ph;
+
+		if (j < ALLOC_PHASE_MAX) {
+			ph = &sum[j];
+			total.nalloc += ph->nalloc;
+			total.nbytes += ph->nbytes;
+			total.nfree += ph->nfree;
+		} else
+			ph = &total;
+		fprintf(fp, "  %-9s allocs=%llu bytes=%llu frees=%llu",
+		    j < ALLOC_PHASE_MAX ? alloc_stats_phase_str(j) : "total",
+		    (unsigned long long) ph->nalloc,
+		    (unsigned long long) ph->nbytes,
+		    (unsigned long long) ph->nfree);
+		if (nreq > 0)
+			fprintf(fp, ", per request allocs=%.2f bytes=%.1f",
+			    (double) ph->nalloc / (double) nreq,
+			    (double) ph->nbytes / (double) nreq);
+		fprintf(fp, "\n");
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef	__ALLOC_STATS_H__
+#define	__ALLOC_STATS_H__
+
+/*
+ * Allocation accounting, for driving allocations on the hot paths
+ * down to zero.
+ *
+ * Built with -DALLOC_STATS (make -DALLOC_STATS), malloc(), calloc(),
+ * realloc(), posix_memalign() and free() are interposed and counted
+ * per thread, into whichever phase the thread is in: the code marks
+ * its connect/request/response/teardown paths, and everything else
+ * (eg libevent reading off the socket between our callbacks) is
+ * "other".  realloc() counts as an allocation of its new size.
+ * alloc_stats_report() prints the totals and the per request figures
+ * over the requests marked done.
+ *
+ * Without ALLOC_STATS the macros compile away.
+ */
+typedef enum {
+	ALLOC_PHASE_OTHER,
+	ALLOC_PHASE_CONNECT,
+	ALLOC_PHASE_REQUEST,
+	ALLOC_PHASE_RESPONSE,
+	ALLOC_PHASE_TEARDOWN,
+	ALLOC_PHASE_MAX
+} alloc_phase_t;
+
+#ifdef	ALLOC_STATS
+
+extern	int alloc_stats_phase_enter(int phase);
+extern	void alloc_stats_phase_exit(int prev);
+extern	void alloc_stats_request_done(void);
+extern	void alloc_stats_report(FILE *fp, const char *prog);
+
+/* Returns the previous phase, to hand back to ALLOC_PHASE_EXIT() */
+#define	ALLOC_PHASE_ENTER(p)		alloc_stats_phase_enter(p)
+#define	ALLOC_PHASE_EXIT(o)		alloc_stats_phase_exit(o)
+#define	ALLOC_REQUEST_DONE()		alloc_stats_request_done()
+#define	ALLOC_REPORT(fp, prog)		alloc_stats_report(fp, prog)
+
+#else
+
+#define	ALLOC_PHASE_ENTER(p)		(ALLOC_PHASE_OTHER)
+#define	ALLOC_PHASE_EXIT(o)		do { (void) (o); } while (0)
+#define	ALLOC_REQUEST_DONE()		do { } while (0)
+#define	ALLOC_REPORT(fp, prog)		do { } while (0)
+
+#endif	/* ALLOC_STATS */
+
+#endif	/* __ALLOC_STATS_H__ */
@@ -0,0 +1,45 @@
+#ifndef	__USDT_H__
+#define	__USDT_H__
+
+/*
+ * Static (USDT) tracepoints, compiled out unless built with
+ * -DWITH_USDT (make -DWITH_USDT).
+ *
+ * These use the DTRACE_PROBEn() macros from <sys/sdt.h>: with
+ * SystemTap's header (Linux) each probe is a single nop plus an ELF
+ * note, which perf, bpftrace and stap can attach to, eg
+ *
+ *   bpftrace -e 'usdt:./httpclt:httpclt:req_done { ... }'
+ *
+ * On FreeBSD the probes must also be declared in the program's
+ * provider file (httpclt.d, httpsrv.d); with it in SRCS bsd.prog.mk
+ * runs dtrace -h and the dtrace -G pass over the objects before
+ * linking.  Add new probes there as well.
+ *
+ * The client's provider is "httpclt" and the server's "httpsrv";
+ * the first argument is always the request/connection pointer, so
+ * events can be matched up per request.
+ */
+#ifdef	WITH_USDT
+
+#include <sys/sdt.h>
+
+#define	USDT_PROBE0(prov, name)			\
+	DTRACE_PROBE(prov, name)
+#define	USDT_PROBE1(prov, name, a)		\
+	DTRACE_PROBE1(prov, name, a)
+#define	USDT_PROBE2(prov, name, a, b)		\
+	DTRACE_PROBE2(prov, name, a, b)
+#define	USDT_PROBE3(prov, name, a, b, c)	\
+	DTRACE_PROBE3(prov, name, a, b, c)
+
+#else
+
+#define	USDT_PROBE0(prov, name)			do { } while (0)
+#define	USDT_PROBE1(prov, name, a)		do { } while (0)
+#define	USDT_PROBE2(prov, name, a, b)		do { } while (0)
+#define	USDT_PROBE3(prov, name, a, b, c)	do { } while (0)
+
+#endif	/* WITH_USDT */
+
+#endif	/* __USDT_H__ */
@@ -19,6 +19,9 @@
 
 #include <evhtp.h>
 
+#include "alloc_stats.h"
+#include "usdt.h"
+
 #define	debug_printf(...)
 //#define	debug_printf(...) fprintf(stderr, __VA_ARGS__)
 
@@ -166,6 +169,7 @@ req_write_line(struct req *r)
 	evbuffer_add_reference(evb, "foobar\r\n", 8, NULL, NULL);
 	evhtp_send_reply_chunk(r->req, evb);
 	evbuffer_free(evb);
+	USDT_PROBE2(httpsrv, chunk_write, r, 8);
 
 	r->cur_count++;
 	if (r->cur_count >= r->max_count) {
@@ -202,6 +206,7 @@ req_write_buf(struct req *r)
 	r->refcnt++;
 	evhtp_send_reply_chunk(r->req, evb);
 	evbuffer_free(evb);
+	USDT_PROBE2(httpsrv, chunk_write, r, write_size);
 
 	r->current_ofs += write_size;
 	if (r->current_ofs >= r->reply_size) {
@@ -249,6 +254,7 @@ send_upstream_error(evhtp_request_t * req, evhtp_error_flags errtype, void * arg
 	struct req *r = arg;
 
 	debug_printf("%s: %p: called\n", __func__, r);
+	USDT_PROBE2(httpsrv, req_error, r, errtype);
 	evhtp_unset_all_hooks(&req->hooks);
 	r->req = NULL;
 	req_free(r);
@@ -267,19 +273,27 @@ evhtp_res
 send_upstream_on_write(evhtp_connection_t * conn, void * arg)
 {
 	struct req *r = arg;
+	evhtp_res res;
+	int ap;
 
 	debug_printf("%s: %p: called\n", __func__, r);
 
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_RESPONSE);
 	switch (r->req_type) {
 	case REQ_TYPE_LINE:
-		return req_write_line(r);
+		res = req_write_line(r);
+		break;
 	case REQ_TYPE_SIZE:
-		return req_write_buf(r);
+		res = req_write_buf(r);
+		break;
 	default:
 		fprintf(stderr, "%s: %p: invalid type (%d)\n",
 		    __func__, r, r->req_type);
-		return (EVHTP_RES_ERROR);
+		res = EVHTP_RES_ERROR;
+		break;
 	}
+	ALLOC_PHASE_EXIT(ap);
+	return (res);
 }
 
 /*
@@ -289,12 +303,17 @@ evhtp_res
 send_upstream_fini(evhtp_request_t * upstream_req, void * arg)
 {
 	struct req *r = arg;
+	int ap;
 
 	debug_printf("%s: %p: called\n", __func__, r);
+	USDT_PROBE1(httpsrv, req_fini, r);
 
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_TEARDOWN);
 	evhtp_unset_all_hooks(&r->req->hooks);
 	r->req = NULL;
 	req_free(r);
+	ALLOC_PHASE_EXIT(ap);
+	ALLOC_REQUEST_DONE();
 
 	return (EVHTP_RES_OK);
 }
@@ -303,6 +322,7 @@ static void
 req_start_response(struct req *r)
 {
 	struct evbuffer *evb;
+	int ap;
 
 	/*
 	 * Start an "OK" response for now.
@@ -334,38 +354,47 @@ req_start_response(struct req *r)
 	/* XXX timeout? */
 
 	/* .. ok, start the reply */
+	USDT_PROBE3(httpsrv, req_start, r, r->req_type,
+	    r->req_type == REQ_TYPE_SIZE ? r->reply_size :
+	    (size_t) r->max_count);
 
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_RESPONSE);
 	switch (r->req_type) {
 	case REQ_TYPE_LINE:
 		evhtp_send_reply_chunk_start(r->req, EVHTP_RES_OK);
 		req_write_line(r);
-		return;
+		break;
 	case REQ_TYPE_SIZE:
 		evhtp_send_reply_chunk_start(r->req, EVHTP_RES_OK);
 		req_write_buf(r);
-		return;
+		break;
 	default:
 		fprintf(stderr, "%s: %p: invalid type (%d)\n",
 		    __func__, r, r->req_type);
 		evhtp_send_reply(r->req, EVHTP_RES_ERROR);
-		return;
+		break;
 	}
+	ALLOC_PHASE_EXIT(ap);
 }
 
 void
 linecb(evhtp_request_t * req, void * a)
 {
 	struct req *r;
+	int ap;
 
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_REQUEST);
 	r = req_create(req);
 	if (r == NULL) {
 		/* XXX need to signal error; close connection */
 		evhtp_send_reply(req, EVHTP_RES_ERROR);
-		return;
+		goto done;
 	}
 	/* XXX for now, type 'line' */
 	req_set_type_line(r, 16);
 	req_start_response(r);
+done:
+	ALLOC_PHASE_EXIT(ap);
 }
 
 void
@@ -375,14 +404,16 @@ sizecb(evhtp_request_t * req, void * a)
 	evhtp_query_t *q;
 	evhtp_kv_t *f;
 	size_t reqsize;
+	int ap;
 
+	ap = ALLOC_PHASE_ENTER(ALLOC_PHASE_REQUEST);
 	q = req->uri->query;
 
 	/* Search the query string for a size parameter */
 	f = evhtp_kvs_find_kv(q, "size");
 	if (f == NULL) {
 		evhtp_send_reply(req, EVHTP_RES_ERROR);
-		return;
+		goto done;
 	}
 
 	reqsize = strtoull(f->val, NULL, 10);
@@ -390,18 +421,20 @@ sizecb(evhtp_request_t * req, void * a)
 	/* Again, default to 128k for now */
 	if (reqsize == ULLONG_MAX) {
 		evhtp_send_reply(req, EVHTP_RES_ERROR);
-		return;
+		goto done;
 	}
 
 	r = req_create(req);
 	if (r == NULL) {
 		evhtp_send_reply(req, EVHTP_RES_ERROR);
-		return;
+		goto done;
 	}
 
 	req_set_type_buf(r, reqsize);
 
 	req_start_response(r);
+done:
+	ALLOC_PHASE_EXIT(ap);
 }
 
 #if 0
@@ -434,6 +467,39 @@ http_init_thread(evhtp_t *http, evthr_t *thread, void *arg)
 	printf("%s: called\n", __func__);
 }
 
+#ifdef	ALLOC_STATS
+/*
+ * libevhtp sets up a new connection - its bufferevent and so on -
+ * between these two, on the thread that'll run it.
+ */
+static evhtp_res
+http_pre_accept(evhtp_connection_t *conn, void *arg)
+{
+
+	(void) ALLOC_PHASE_ENTER(ALLOC_PHASE_CONNECT);
+	return (EVHTP_RES_OK);
+}
+
+static evhtp_res
+http_post_accept(evhtp_connection_t *conn, void *arg)
+{
+
+	(void) ALLOC_PHASE_ENTER(ALLOC_PHASE_OTHER);
+	return (EVHTP_RES_OK);
+}
+
+/*
+ * Stop on SIGINT so the allocation counts can be reported.
+ */
+static void
+http_sigint(evutil_socket_t sig, short which, void *arg)
+{
+	struct http_app *app = arg;
+
+	event_base_loopbreak(app->evbase);
+}
+#endif
+
 static void
 usage(const char *progname)
 {
@@ -503,6 +569,9 @@ int
 main(int argc, char ** argv)
 {
 	struct http_app app;
+#ifdef	ALLOC_STATS
+	struct event *ev_sigint;
+#endif
 
 	if (argc < 2) {
 		usage(argv[0]);
@@ -526,9 +595,19 @@ main(int argc, char ** argv)
 	evhtp_set_cb(app.htp, "/line", linecb, NULL);
 	evhtp_set_cb(app.htp, "/size", sizecb, NULL);
 
+#ifdef	ALLOC_STATS
+	evhtp_set_pre_accept_cb(app.htp, http_pre_accept, NULL);
+	evhtp_set_post_accept_cb(app.htp, http_post_accept, NULL);
+	ev_sigint = evsignal_new(app.evbase, SIGINT, http_sigint, &app);
+	evsignal_add(ev_sigint, NULL);
+#endif
+
 	evhtp_use_threads(app.htp, http_init_thread, app.ncpu, &app);
 	evhtp_bind_socket(app.htp, "0.0.0.0", app.port, 1024);
 	event_base_loop(app.evbase, 0);
 
+	/* Worker threads are still running; it's a snapshot */
+	ALLOC_REPORT(stdout, "httpsrv");
+
 	exit(0);
 }
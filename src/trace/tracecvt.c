@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <err.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include <stdint.h>
+
+#include "trace.h"
+
+/*
+ * Convert a plain-text access log into a binary trace for httpclt
+ * --trace.
+ *
+ * Two input formats are understood, picked per line:
+ *
+ * + Common/Combined Log Format:
+ *   host ident user [10/Oct/2000:13:55:36 -0700] "GET /a HTTP/1.1" 200 2326 ["referer" "ua"]
+ *
+ *   Timestamps only have one second resolution, so the requests
+ *   logged in each second are spread evenly across it when working
+ *   out inter-arrival times.  A Referer, if present, is carried
+ *   through as a request header.
+ *
+ * + A simple "METHOD URI [iat_usec]" format.
+ */
+
+struct cvt_ent {
+	trace_method_t method;
+	char *uri;
+	char *hdrs;
+	size_t hdr_len;
+
+	/* Log timestamp (seconds), or -1 if there wasn't one */
+	int64_t ts;
+
+	/* Explicit inter-arrival time, or -1 */
+	int64_t iat;
+};
+
+struct cvt {
+	struct cvt_ent *ents;
+	size_t n;
+	size_t size;
+	int no_iat;
+};
+
+static void
+usage(const char *progname)
+{
+
+	printf("Usage: %s [-n] -o <output trace> [input log ...]\n", progname);
+	printf("  -n: don't record inter-arrival times\n");
+	printf("  Input is read from stdin if no files are given.\n");
+}
+
+static int
+cvt_add(struct cvt *c, const struct cvt_ent *e)
+{
+	struct cvt_ent *n;
+
+	if (c->n == c->size) {
+		c->size = c->size ? c->size * 2 : 1024;
+		n = realloc(c->ents, c->size * sizeof(*n));
+		if (n == NULL) {
+			warn("%s: realloc", __func__);
+			return (-1);
+		}
+		c->ents = n;
+	}
+	c->ents[c->n++] = *e;
+	return (0);
+}
+
+/*
+ * Parse a [dd/Mon/yyyy:HH:MM:SS zone] timestamp; the zone is ignored
+ * as only the deltas matter.
+ */
+static int64_t
+cvt_parse_ts(const char *s)
+{
+	struct tm tm;
+
+	bzero(&tm, sizeof(tm));
+	if (strptime(s, "%d/%b/%Y:%H:%M:%S", &tm) == NULL)
+		return (-1);
+	return ((int64_t) timegm(&tm));
+}
+
+static int
+cvt_parse_clf(struct cvt_ent *e, char *line)
+{
+	char *p, *q, *req, *meth, *uri, *ref = NULL;
+
+	/* Timestamp */
+	p = strchr(line, '[');
+	q = (p != NULL) ? strchr(p, ']') : NULL;
+	if (p == NULL || q == NULL)
+		return (-1);
+	*q = '\0';
+	e->ts = cvt_parse_ts(p + 1);
+
+	/* Request line */
+	p = strchr(q + 1, '"');
+	q = (p != NULL) ? strchr(p + 1, '"') : NULL;
+	if (p == NULL || q == NULL)
+		return (-1);
+	*q = '\0';
+	req = p + 1;
+
+	/* Optional referer, from the combined format */
+	p = strchr(q + 1, '"');
+	q = (p != NULL) ? strchr(p + 1, '"') : NULL;
+	if (p != NULL && q != NULL) {
+		*q = '\0';
+		if (strcmp(p + 1, "-") != 0 && p[1] != '\0')
+			ref = p + 1;
+	}
+
+	meth = strsep(&req, " ");
+	uri = strsep(&req, " ");
+	if (meth == NULL || uri == NULL || *uri == '\0')
+		return (-1);
+	if (trace_method_parse(meth, &e->method) != 0)
+		return (-1);
+	e->uri = strdup(uri);
+	if (e->uri == NULL)
+		return (-1);
+	if (ref != NULL) {
+		if (asprintf(&e->hdrs, "Referer: %s\r\n", ref) < 0)
+			return (-1);
+		e->hdr_len = strlen(e->hdrs);
+	}
+
+	return (0);
+}
+
+static int
+cvt_parse_simple(struct cvt_ent *e, char *line)
+{
+	char *meth, *uri, *iat;
+
+	meth = strsep(&line, " \t");
+	uri = strsep(&line, " \t");
+	if (meth == NULL || uri == NULL || *uri == '\0')
+		return (-1);
+	if (trace_method_parse(meth, &e->method) != 0)
+		return (-1);
+	iat = strsep(&line, " \t");
+	if (iat != NULL && *iat != '\0')
+		e->iat = strtoll(iat, NULL, 10);
+	e->uri = strdup(uri);
+	if (e->uri == NULL)
+		return (-1);
+
+	return (0);
+}
+
+static int
+cvt_read(struct cvt *c, FILE *fp, const char *name)
+{
+	struct cvt_ent e;
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t len;
+	unsigned long lineno = 0;
+	int r;
+
+	while ((len = getline(&line, &linecap, fp)) > 0) {
+		lineno++;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+
+		bzero(&e, sizeof(e));
+		e.ts = -1;
+		e.iat = -1;
+		if (strchr(line, '"') != NULL)
+			r = cvt_parse_clf(&e, line);
+		else
+			r = cvt_parse_simple(&e, line);
+		if (r != 0 || strlen(e.uri) > UINT16_MAX ||
+		    e.hdr_len > UINT16_MAX) {
+			warnx("%s:%lu: skipping unparseable line", name, lineno);
+			free(e.uri);
+			free(e.hdrs);
+			continue;
+		}
+		if (cvt_add(c, &e) != 0)
+			return (-1);
+	}
+	free(line);
+	return (0);
+}
+
+/*
+ * Work out each request's inter-arrival time.
+ *
+ * Explicit values win; otherwise requests sharing a log second are
+ * spread evenly across that second.
+ */
+static void
+cvt_compute_iat(const struct cvt *c, uint32_t *iat)
+{
+	const struct cvt_ent *e;
+	int64_t t, d, prev_usec = -1;
+	size_t i, first, last;
+
+	for (first = 0; first < c->n; first = last + 1) {
+		/* Find the run of requests logged in the same second */
+		for (last = first;
+		    last + 1 < c->n && c->ents[last + 1].ts == c->ents[first].ts;
+		    last++)
+			;
+
+		for (i = first; i <= last; i++) {
+			e = &c->ents[i];
+			iat[i] = 0;
+			if (c->no_iat)
+				continue;
+			if (e->iat >= 0) {
+				iat[i] = e->iat > UINT32_MAX ?
+				    UINT32_MAX : (uint32_t) e->iat;
+				continue;
+			}
+			if (e->ts < 0)
+				continue;
+
+			t = e->ts * 1000000LL +
+			    (int64_t) ((i - first) * 1000000ULL /
+			    (last - first + 1));
+			d = (prev_usec >= 0 && t > prev_usec) ? t - prev_usec : 0;
+			prev_usec = t;
+			iat[i] = d > UINT32_MAX ? UINT32_MAX : (uint32_t) d;
+		}
+	}
+}
+
+static int
+cvt_write_pad(FILE *fp, uint64_t *ofs)
+{
+	static const char zero[TRACE_REC_ALIGN] = { 0 };
+	size_t pad;
+
+	pad = (TRACE_REC_ALIGN - (*ofs % TRACE_REC_ALIGN)) % TRACE_REC_ALIGN;
+	if (pad > 0 && fwrite(zero, pad, 1, fp) != 1)
+		return (-1);
+	*ofs += pad;
+	return (0);
+}
+
+static int
+cvt_write(const struct cvt *c, const char *path)
+{
+	struct trace_file_hdr hdr;
+	struct trace_rec rec;
+	uint64_t *index, ofs;
+	uint32_t *iat;
+	FILE *fp;
+	size_t i;
+
+	index = calloc(c->n, sizeof(*index));
+	iat = calloc(c->n, sizeof(*iat));
+	if (index == NULL || iat == NULL) {
+		warn("%s: calloc", __func__);
+		free(index);
+		free(iat);
+		return (-1);
+	}
+	cvt_compute_iat(c, iat);
+
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		warn("%s: fopen (%s)", __func__, path);
+		free(index);
+		free(iat);
+		return (-1);
+	}
+
+	/* Placeholder header; rewritten once the index offset is known */
+	bzero(&hdr, sizeof(hdr));
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto error;
+	ofs = sizeof(hdr);
+
+	for (i = 0; i < c->n; i++) {
+		if (cvt_write_pad(fp, &ofs) != 0)
+			goto error;
+		index[i] = ofs;
+
+		bzero(&rec, sizeof(rec));
+		rec.iat_usec = iat[i];
+		rec.method = c->ents[i].method;
+		rec.uri_len = strlen(c->ents[i].uri);
+		rec.hdr_len = c->ents[i].hdr_len;
+
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+		    fwrite(c->ents[i].uri, rec.uri_len + 1, 1, fp) != 1)
+			goto error;
+		if (rec.hdr_len > 0 &&
+		    fwrite(c->ents[i].hdrs, rec.hdr_len, 1, fp) != 1)
+			goto error;
+		ofs += sizeof(rec) + rec.uri_len + 1 + rec.hdr_len;
+	}
+
+	if (cvt_write_pad(fp, &ofs) != 0)
+		goto error;
+	if (fwrite(index, sizeof(*index), c->n, fp) != c->n)
+		goto error;
+
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.nrecords = c->n;
+	hdr.index_ofs = ofs;
+	if (fseek(fp, 0, SEEK_SET) != 0 ||
+	    fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto error;
+
+	if (fclose(fp) != 0) {
+		warn("%s: fclose (%s)", __func__, path);
+		free(index);
+		free(iat);
+		return (-1);
+	}
+	free(index);
+	free(iat);
+	return (0);
+
+error:
+	warn("%s: write (%s)", __func__, path);
+	fclose(fp);
+	free(index);
+	free(iat);
+	return (-1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct cvt c;
+	const char *progname = argv[0];
+	const char *outfile = NULL;
+	FILE *fp;
+	int ch, i;
+
+	bzero(&c, sizeof(c));
+
+	while ((ch = getopt(argc, argv, "hno:")) != -1) {
+		switch (ch) {
+		case 'n':
+			c.no_iat = 1;
+			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'h':
+		default:
+			usage(progname);
+			exit(127);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (outfile == NULL) {
+		usage(progname);
+		exit(127);
+	}
+
+	if (argc == 0) {
+		if (cvt_read(&c, stdin, "<stdin>") != 0)
+			exit(1);
+	}
+	for (i = 0; i < argc; i++) {
+		fp = fopen(argv[i], "r");
+		if (fp == NULL)
+			err(1, "fopen (%s)", argv[i]);
+		if (cvt_read(&c, fp, argv[i]) != 0)
+			exit(1);
+		fclose(fp);
+	}
+
+	if (c.n == 0)
+		errx(1, "no requests found");
+
+	if (cvt_write(&c, outfile) != 0)
+		exit(1);
+
+	printf("%s: wrote %zu requests\n", outfile, c.n);
+
+	exit(0);
+}